@@ -0,0 +1,219 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "symbol_table.h"
+
+namespace {
+
+// The scripts [begin, end) of a worker not yet taken, and the interpreter of
+// the one it is running. On a cache line of its own, since the owner updates
+// it for every script.
+struct alignas(64) Share {
+    std::mutex mutex;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    Interpreter* running = nullptr;
+};
+
+// Makes an interpreter its worker's running one for as long as it exists.
+class Running {
+private:
+    Share& share_;
+public:
+    Running(Share& share, Interpreter* interpreter) : share_(share) {
+        std::lock_guard lock(share_.mutex);
+        share_.running = interpreter;
+    }
+    Running(const Running&) = delete;
+    Running& operator=(const Running&) = delete;
+    ~Running() {
+        std::lock_guard lock(share_.mutex);
+        share_.running = nullptr;
+    }
+};
+
+class Pool {
+private:
+    const std::vector<std::string>& scripts_;
+    const BatchOptions& options_;
+    std::vector<BatchResult>& results_;
+    std::vector<Share> shares_;
+    std::atomic<std::size_t> steals_{0};
+    std::atomic<bool> done_{false};
+
+    bool Cancelled() const {
+        return options_.cancel != nullptr && options_.cancel->load(std::memory_order_relaxed);
+    }
+
+    bool TakeFront(Share& share, std::size_t* index) {
+        std::lock_guard lock(share.mutex);
+        if (share.begin == share.end) {
+            return false;
+        }
+        *index = share.begin++;
+        return true;
+    }
+
+    // Takes the back half of another worker's scripts: the first to run now,
+    // the rest into the empty share of worker self. Fails once every share is
+    // empty; as no scripts are added, those still running are then the last.
+    bool Steal(std::size_t self, std::size_t* index) {
+        for (std::size_t i = 1; i < shares_.size(); ++i) {
+            Share& victim = shares_[(self + i) % shares_.size()];
+            std::size_t begin, end;
+            {
+                std::lock_guard lock(victim.mutex);
+                std::size_t left = victim.end - victim.begin;
+                if (left == 0) {
+                    continue;
+                }
+                end = victim.end;
+                begin = end - (left + 1) / 2;
+                victim.end = begin;
+            }
+            *index = begin;
+            Share& own = shares_[self];
+            std::lock_guard lock(own.mutex);
+            own.begin = begin + 1;
+            own.end = end;
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void Work(std::size_t self) {
+        std::size_t index;
+        while (TakeFront(shares_[self], &index) || Steal(self, &index)) {
+            results_[index] = RunScript(scripts_[index], shares_[self]);
+        }
+    }
+
+    // Until the workers are done, cancels the running interpreters once the
+    // batch is cancelled. Again and again: a Cancel made just before a run
+    // starts is dropped.
+    void Watch() {
+        while (!done_.load()) {
+            if (Cancelled()) {
+                for (Share& share : shares_) {
+                    std::lock_guard lock(share.mutex);
+                    if (share.running != nullptr) {
+                        share.running->Cancel();
+                    }
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    BatchResult RunScript(const std::string& script, Share& share) const {
+        BatchResult result;
+        if (Cancelled()) {
+            result.status = BatchStatus::kCancelled;
+            result.error = "not run";
+            return result;
+        }
+        try {
+            Interpreter interpreter;
+            interpreter.SetLimits(options_.limits);
+            Running running(share, &interpreter);
+            interpreter.RunAll(script, [&result](const std::string& value) { result.values.push_back(value); });
+        } catch (const CancelledError& e) {
+            result.status = BatchStatus::kCancelled;
+            result.error = e.what();
+        } catch (const SyntaxError& e) {
+            result.status = BatchStatus::kSyntaxError;
+            result.error = e.what();
+        } catch (const NameError& e) {
+            result.status = BatchStatus::kNameError;
+            result.error = e.what();
+        } catch (const LimitError& e) {
+            result.status = BatchStatus::kLimitError;
+            result.error = e.what();
+        } catch (const std::exception& e) {
+            // RuntimeError, or anything else: one script never stops the
+            // batch.
+            result.status = BatchStatus::kRuntimeError;
+            result.error = e.what();
+        }
+        return result;
+    }
+public:
+    Pool(const std::vector<std::string>& scripts, const BatchOptions& options, std::vector<BatchResult>& results,
+         std::size_t threads)
+        : scripts_(scripts), options_(options), results_(results), shares_(threads) {
+        for (std::size_t i = 0; i < threads; ++i) {
+            shares_[i].begin = scripts.size() * i / threads;
+            shares_[i].end = scripts.size() * (i + 1) / threads;
+        }
+    }
+
+    std::size_t Run() {
+        std::thread watcher;
+        if (options_.cancel != nullptr) {
+            watcher = std::thread([this] { Watch(); });
+        }
+        std::vector<std::thread> workers;
+        for (std::size_t i = 1; i < shares_.size(); ++i) {
+            workers.emplace_back([this, i] { Work(i); });
+        }
+        Work(0);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        done_.store(true);
+        if (watcher.joinable()) {
+            watcher.join();
+        }
+        return steals_.load();
+    }
+};
+
+}  // namespace
+
+const char* StatusName(BatchStatus status) {
+    switch (status) {
+        case BatchStatus::kOk:
+            return "ok";
+        case BatchStatus::kSyntaxError:
+            return "SyntaxError";
+        case BatchStatus::kRuntimeError:
+            return "RuntimeError";
+        case BatchStatus::kNameError:
+            return "NameError";
+        case BatchStatus::kLimitError:
+            return "LimitError";
+        case BatchStatus::kCancelled:
+            return "cancelled";
+    }
+    return "?";
+}
+
+std::vector<BatchResult> RunBatch(const std::vector<std::string>& scripts, const BatchOptions& options,
+                                  BatchStats* stats) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t symbols = SymbolTable::Instance().Size();
+    std::size_t threads = options.threads != 0 ? options.threads : std::thread::hardware_concurrency();
+    threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(scripts.size(), 1));
+    std::vector<BatchResult> results(scripts.size());
+    std::size_t steals = Pool(scripts, options, results, threads).Run();
+    if (stats != nullptr) {
+        stats->scripts = scripts.size();
+        stats->failed = std::count_if(results.begin(), results.end(), [](const BatchResult& result) {
+            return result.status != BatchStatus::kOk && result.status != BatchStatus::kCancelled;
+        });
+        stats->cancelled = std::count_if(results.begin(), results.end(), [](const BatchResult& result) {
+            return result.status == BatchStatus::kCancelled;
+        });
+        stats->threads = threads;
+        stats->steals = steals;
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats->new_symbols = SymbolTable::Instance().Size() - symbols;
+    }
+    return results;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "scheme.h"
+
+enum class BatchStatus { kOk, kSyntaxError, kRuntimeError, kNameError, kLimitError, kCancelled };
+
+// "ok", "cancelled" or the name of the error.
+const char* StatusName(BatchStatus status);
+
+// How one script of a batch went.
+struct BatchResult {
+    BatchStatus status = BatchStatus::kOk;
+    // The printed value of every top-level form that ran, in order: those
+    // before the error too when the script failed or was cancelled.
+    std::vector<std::string> values;
+    // The message of the error that stopped the script.
+    std::string error;
+};
+
+struct BatchOptions {
+    // Worker threads; 0 for one per hardware thread.
+    std::size_t threads = 0;
+    // For every script.
+    Limits limits;
+    // Once set, from any thread, the scripts running stop at their next
+    // procedure call and those not started don't run: all of them are
+    // kCancelled.
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+struct BatchStats {
+    std::size_t scripts = 0;
+    // With an error; cancelled scripts aren't counted.
+    std::size_t failed = 0;
+    std::size_t cancelled = 0;
+    std::size_t threads = 0;
+    // Times a worker that ran out of scripts took some from another.
+    std::size_t steals = 0;
+    double seconds = 0;
+    // Names the batch added to the symbol table, which keeps them for as long
+    // as the process runs (symbol_table.h).
+    std::size_t new_symbols = 0;
+
+    double ScriptsPerSecond() const {
+        return seconds > 0 ? static_cast<double>(scripts) / seconds : 0;
+    }
+};
+
+// Runs every script like Interpreter::RunAll in a fresh interpreter of its
+// own, on a pool of worker threads that share nothing but the symbol table.
+// Each worker starts with an equal share of consecutive scripts and takes
+// them from the front; one that is done steals the back half of what is left
+// of another's. The results are in the order of the scripts.
+//
+// The symbol table outlives the batch: a long-running process that keeps
+// batching scripts with names of their own grows it by every new name.
+std::vector<BatchResult> RunBatch(const std::vector<std::string>& scripts, const BatchOptions& options = {},
+                                  BatchStats* stats = nullptr);
@@ -0,0 +1,448 @@
+#include "batch.h"
+#include "parser.h"
+#include "scheme.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+std::atomic<uint64_t> allocated_bytes{0};
+
+void* CountedAlloc(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    return CountedAlloc(size);
+}
+
+void* operator new[](std::size_t size) {
+    return CountedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+    // The most resident memory while it ran; -1 where that can't be told
+    // apart from the peak of the process so far.
+    long bench_peak_rss_kb;
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void()> body;
+};
+
+struct Options {
+    std::string filter;
+    std::string json_path = "bench_results.json";
+    std::string baseline_path;
+    double min_time_ms = 200;
+};
+
+// Starts a new resident memory peak (Linux 4.0 and later), so that each
+// benchmark reports its own instead of the largest of those before it.
+bool ResetPeakRss() {
+    std::ofstream out("/proc/self/clear_refs");
+    out << "5";
+    return static_cast<bool>(out.flush());
+}
+
+long PeakRssKb() {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    return -1;
+}
+
+BenchResult Measure(const Benchmark& bench, double min_time_ms) {
+    using Clock = std::chrono::steady_clock;
+    bool peak_reset = ResetPeakRss();
+    bench.body();
+    uint64_t iterations = 1;
+    while (true) {
+        uint64_t allocs_before = allocations.load(std::memory_order_relaxed);
+        uint64_t bytes_before = allocated_bytes.load(std::memory_order_relaxed);
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            bench.body();
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        uint64_t allocs = allocations.load(std::memory_order_relaxed) - allocs_before;
+        uint64_t bytes = allocated_bytes.load(std::memory_order_relaxed) - bytes_before;
+        if (elapsed >= min_time_ms * 1e6 || iterations >= (uint64_t{1} << 40)) {
+            double n = static_cast<double>(iterations);
+            return BenchResult{bench.name, iterations, elapsed / n, allocs / n, bytes / n,
+                               peak_reset ? PeakRssKb() : -1};
+        }
+        double scale = elapsed > 0 ? min_time_ms * 1e6 / elapsed * 1.2 : 10;
+        iterations = static_cast<uint64_t>(static_cast<double>(iterations) * std::clamp(scale, 2.0, 100.0));
+    }
+}
+
+std::string JsonEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+void WriteJson(const std::string& path, const std::vector<BenchResult>& results) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "cannot write " << path << "\n";
+        return;
+    }
+    out << "{\n  \"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        out << "    {\"name\": \"" << JsonEscape(r.name) << "\", \"iterations\": " << r.iterations
+            << std::fixed << std::setprecision(2) << ", \"ns_per_op\": " << r.ns_per_op
+            << ", \"allocs_per_op\": " << r.allocs_per_op << ", \"bytes_per_op\": " << r.bytes_per_op
+            << ", \"bench_peak_rss_kb\": " << r.bench_peak_rss_kb << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Reads ns_per_op values back from a file written by WriteJson (one benchmark per line).
+std::map<std::string, double> ReadBaseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    std::string line;
+    const std::string name_key = "\"name\": \"";
+    const std::string ns_key = "\"ns_per_op\": ";
+    while (std::getline(in, line)) {
+        auto name_pos = line.find(name_key);
+        auto ns_pos = line.find(ns_key);
+        if (name_pos == std::string::npos || ns_pos == std::string::npos) {
+            continue;
+        }
+        name_pos += name_key.size();
+        auto name_end = line.find('"', name_pos);
+        baseline[line.substr(name_pos, name_end - name_pos)] = std::atof(line.c_str() + ns_pos + ns_key.size());
+    }
+    return baseline;
+}
+
+std::string NumberList(int n) {
+    std::string s = "(";
+    for (int i = 0; i < n; ++i) {
+        s += std::to_string(i);
+        s += (i + 1 < n) ? " " : ")";
+    }
+    return s;
+}
+
+std::string TokenizerInput(int lines) {
+    std::string s;
+    for (int i = 0; i < lines; ++i) {
+        s += "(define var-" + std::to_string(i % 97) + " (+ " + std::to_string(i) + " -17 (* 3 x?)))\n";
+        s += "'(a b . c) (set! flag #t) (list-ref lst 12)\n";
+    }
+    return s;
+}
+
+std::vector<Benchmark> MakeBenchmarks() {
+    std::vector<Benchmark> benchmarks;
+
+    auto tokenizer_input = std::make_shared<std::string>(TokenizerInput(5000));
+    benchmarks.push_back({"tokenize/large_input", [tokenizer_input] {
+        std::stringstream ss{*tokenizer_input};
+        Tokenizer tokenizer{&ss};
+        while (!tokenizer.IsEnd()) {
+            tokenizer.Next();
+        }
+    }});
+
+    benchmarks.push_back({"tokenize/large_input_view", [tokenizer_input] {
+        Tokenizer tokenizer{std::string_view(*tokenizer_input)};
+        while (!tokenizer.IsEnd()) {
+            tokenizer.Next();
+        }
+    }});
+
+    // Parsed forms are garbage right away; the heap has no roots and is
+    // collected like an interpreter's.
+    auto long_list = std::make_shared<std::string>(NumberList(2000));
+    auto parse_heap = std::make_shared<Heap>();
+    benchmarks.push_back({"parse/long_list", [long_list, parse_heap] {
+        HeapScope scope(*parse_heap);
+        std::stringstream ss{*long_list};
+        Tokenizer tokenizer{&ss};
+        Read(&tokenizer);
+        parse_heap->Safepoint();
+    }});
+
+    auto deep_list = std::make_shared<std::string>(std::string(1000, '(') + "1" + std::string(1000, ')'));
+    benchmarks.push_back({"parse/deep_list", [deep_list, parse_heap] {
+        HeapScope scope(*parse_heap);
+        std::stringstream ss{*deep_list};
+        Tokenizer tokenizer{&ss};
+        Read(&tokenizer);
+        parse_heap->Safepoint();
+    }});
+
+    Object* printed_list;
+    {
+        std::string nested = "(" + NumberList(100) + " " + NumberList(100) + " . 7)";
+        std::string source = "(";
+        for (int i = 0; i < 100; ++i) {
+            source += nested;
+        }
+        source += ")";
+        Tokenizer tokenizer{std::string_view(source)};
+        printed_list = Read(&tokenizer);
+    }
+    auto printer = std::make_shared<Printer>();
+    auto printed = std::make_shared<std::string>();
+    benchmarks.push_back({"print/nested_lists", [printed_list, printer, printed] {
+        printed->clear();
+        printer->Print(printed_list, *printed);
+    }});
+
+    auto interpreter = std::make_shared<Interpreter>();
+    auto run = [interpreter](std::string expr) {
+        return [interpreter, expr] { interpreter->Run(expr); };
+    };
+    interpreter->Run("(define x 5)");
+    interpreter->Run("(define (square n) (* n n))");
+    interpreter->Run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+    interpreter->Run("(define (count n acc) (if (= n 0) acc (count (- n 1) (+ acc 1))))");
+    interpreter->Run("(define (fact n) (if (< n 2) 1 (* n (fact (- n 1)))))");
+    interpreter->Run("(define series (vector-map (lambda (x) (* x 7919)) (make-vector 1000000 -3)))");
+    interpreter->Run("(define small (make-vector 10000 3))");
+    interpreter->Run("(define (deadline n) (if (> n (* 60 60 24)) (- n (* 60 60 24)) (+ n (max 3 7) (* 60 60))))");
+
+    benchmarks.push_back({"eval/sum", run("(+ 1 2 3 4 5 6 7 8 9 10)")});
+    benchmarks.push_back({"eval/nested_arithmetic", run("(+ (* 2 3) (- 10 4) (/ 20 5) (max 1 7) (abs -3))")});
+    benchmarks.push_back({"eval/compare", run("(< 1 2 3 4 5 6 7 8)")});
+    benchmarks.push_back({"eval/compare_nested", run("(= (+ 1 2) (- 5 2) (* 1 3))")});
+    benchmarks.push_back({"eval/list_ref", run("(list-ref '" + NumberList(100) + " 50)")});
+    benchmarks.push_back({"eval/list_tail", run("(list-tail '" + NumberList(100) + " 90)")});
+    benchmarks.push_back({"eval/define", run("(define y 42)")});
+    benchmarks.push_back({"eval/set", run("(set! x (+ 1 2))")});
+    benchmarks.push_back({"eval/symbol", run("x")});
+    benchmarks.push_back({"eval/call_procedure", run("(square x)")});
+    benchmarks.push_back({"eval/fib_15", run("(fib 15)")});
+    benchmarks.push_back({"eval/tail_loop_10000", run("(count 10000 0)")});
+    benchmarks.push_back({"eval/factorial_100", run("(fact 100)")});
+    benchmarks.push_back({"eval/folded_constants", run("(deadline x)")});
+    // A rule submitted as text every time, and prepared once.
+    const std::string rule = "(if (> x 10) (* x 2) (+ (square x) (- x 1)))";
+    benchmarks.push_back({"eval/rule", run(rule)});
+    std::shared_ptr<Program> prepared = interpreter->Prepare(rule);
+    benchmarks.push_back({"eval/rule_prepared", [interpreter, prepared] { interpreter->Execute(*prepared); }});
+    auto profiled = std::make_shared<Interpreter>();
+    profiled->Run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+    profiled->EnableProfiling();
+    benchmarks.push_back({"eval/fib_15_profiled", [profiled] { profiled->Run("(fib 15)"); }});
+    auto limited = std::make_shared<Interpreter>();
+    limited->Run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+    limited->SetLimits(Limits{64 << 20, 10000, 100000000});
+    benchmarks.push_back({"eval/fib_15_limited", [limited] { limited->Run("(fib 15)"); }});
+    benchmarks.push_back({"eval/vector_sum_1m", run("(vector-sum series)")});
+    benchmarks.push_back({"eval/vector_max_1m", run("(vector-max series)")});
+    benchmarks.push_back({"eval/vector_map_10k", run("(vector-map (lambda (x) (+ x 1)) small)")});
+    benchmarks.push_back({"eval/vector_fold_10k", run("(vector-fold + 0 small)")});
+
+    // A parsed form compiled once, its bytecode run again and again.
+    struct ExecState {
+        Environment env;
+        Object* form;
+        Chunk chunk;
+        VM vm;
+    };
+    auto exec = std::make_shared<ExecState>();
+    exec->env.Define(Intern("+"), Make<Sum>());
+    exec->env.Define(Intern("*"), Make<Multiplication>());
+    exec->env.Define(Intern("<"), Make<Less>());
+    exec->env.Define(Intern("="), Make<Equal>());
+    exec->env.Define(Intern("if"), Make<SpecialForm>(Syntax::kIf));
+    exec->env.Define(Intern("and"), Make<SpecialForm>(Syntax::kAnd));
+    exec->env.Define(Intern("or"), Make<SpecialForm>(Syntax::kOr));
+    exec->env.Define(Intern("x"), Number::Make(5));
+    {
+        Tokenizer tokenizer{std::string_view(
+            "(if (and (< 0 x 10) (or (= x 3) (< x 7))) (+ (* x x) (* 2 x) 1) (* x 3))")};
+        exec->form = Read(&tokenizer);
+    }
+    Compile(exec->form, exec->env, &exec->chunk);
+    benchmarks.push_back({"exec/bytecode", [exec] {
+        exec->vm.Execute(exec->chunk, exec->env);
+    }});
+
+    auto forms = std::make_shared<std::string>();
+    for (int i = 0; i < 1000; ++i) {
+        *forms += "(set! x (+ " + std::to_string(i) + " 1)) ";
+    }
+    benchmarks.push_back({"eval/batch_1000_forms", [interpreter, forms] {
+        interpreter->RunAll(*forms, nullptr);
+    }});
+
+    // Starting an interpreter with 1000 rules by evaluating their source, and
+    // by loading the image of one that did.
+    auto rules = std::make_shared<std::string>();
+    for (int i = 0; i < 1000; ++i) {
+        std::string n = std::to_string(i);
+        *rules += "(define (rule-" + n + " x) (if (> x " + n + ") (* x 2) (+ x (* " + n + " 3))))\n";
+    }
+    auto image_path =
+        std::make_shared<std::string>((std::filesystem::temp_directory_path() / "scheme_bench_rules.img").string());
+    {
+        Interpreter warm;
+        warm.RunAll(*rules, nullptr);
+        warm.SaveImage(*image_path);
+    }
+    benchmarks.push_back({"image/define_1000_rules", [rules] {
+        Interpreter fresh;
+        fresh.RunAll(*rules, nullptr);
+    }});
+    benchmarks.push_back({"image/load_1000_rules", [image_path] {
+        Interpreter fresh;
+        fresh.LoadImage(*image_path);
+    }});
+
+    // Loading the rules from a file, and with the code compiled from it cached.
+    auto temp = std::filesystem::temp_directory_path();
+    auto rules_path = std::make_shared<std::string>((temp / "scheme_bench_rules.scm").string());
+    auto cache_path = std::make_shared<std::string>((temp / "scheme_bench_rules.scc").string());
+    std::ofstream(*rules_path) << *rules;
+    std::filesystem::remove(*cache_path);
+    benchmarks.push_back({"load/1000_rules", [rules_path] {
+        Interpreter fresh;
+        fresh.Load(*rules_path);
+    }});
+    benchmarks.push_back({"load/1000_rules_cached", [rules_path, cache_path] {
+        Interpreter fresh;
+        fresh.LoadCached(*rules_path, *cache_path);
+    }});
+
+    // Independent scripts, each in an interpreter of its own, on one worker
+    // and on one per hardware thread.
+    auto scripts = std::make_shared<std::vector<std::string>>();
+    for (int i = 0; i < 1000; ++i) {
+        std::string n = std::to_string(i % 12);
+        scripts->push_back("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib " + n + ")");
+    }
+    benchmarks.push_back({"batch/1000_scripts_1_thread", [scripts] {
+        BatchOptions options;
+        options.threads = 1;
+        RunBatch(*scripts, options);
+    }});
+    benchmarks.push_back({"batch/1000_scripts", [scripts] {
+        RunBatch(*scripts);
+    }});
+
+    return benchmarks;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << "\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--filter") {
+            options.filter = value();
+        } else if (arg == "--json") {
+            options.json_path = value();
+        } else if (arg == "--baseline") {
+            options.baseline_path = value();
+        } else if (arg == "--min-time-ms") {
+            options.min_time_ms = std::atof(value().c_str());
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--filter SUBSTR] [--json PATH] [--baseline PATH] [--min-time-ms MS]\n";
+            std::exit(arg == "--help" ? 0 : 2);
+        }
+    }
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options = ParseOptions(argc, argv);
+    std::map<std::string, double> baseline;
+    if (!options.baseline_path.empty()) {
+        baseline = ReadBaseline(options.baseline_path);
+    }
+
+    std::vector<BenchResult> results;
+    std::printf("%-28s %12s %14s %12s %14s %18s\n", "benchmark", "iterations", "ns/op", "allocs/op",
+                "bytes/op", "bench_peak_rss_kb");
+    for (const auto& bench : MakeBenchmarks()) {
+        if (bench.name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        auto r = Measure(bench, options.min_time_ms);
+        std::printf("%-28s %12llu %14.1f %12.1f %14.1f %18ld", r.name.c_str(),
+                    static_cast<unsigned long long>(r.iterations), r.ns_per_op, r.allocs_per_op,
+                    r.bytes_per_op, r.bench_peak_rss_kb);
+        auto it = baseline.find(r.name);
+        if (it != baseline.end() && it->second > 0) {
+            std::printf("  %+7.1f%%", (r.ns_per_op / it->second - 1) * 100);
+        }
+        std::printf("\n");
+        results.push_back(r);
+    }
+    WriteJson(options.json_path, results);
+    return 0;
+}
@@ -0,0 +1,363 @@
+#include "bignum.h"
+
+#include <algorithm>
+
+namespace {
+
+using Limbs = std::vector<uint32_t>;
+
+constexpr uint32_t kDecimalBase = 1000000000;
+constexpr int kDecimalDigits = 9;
+// Below this many limbs in the shorter operand, schoolbook multiplication
+// beats Karatsuba.
+constexpr std::size_t kKaratsubaThreshold = 40;
+
+void Trim(Limbs& limbs) {
+    while (!limbs.empty() && limbs.back() == 0) {
+        limbs.pop_back();
+    }
+}
+
+// limbs = limbs * factor + addend.
+void MultiplyAdd(Limbs& limbs, uint32_t factor, uint32_t addend) {
+    uint64_t carry = addend;
+    for (uint32_t& limb : limbs) {
+        uint64_t value = uint64_t{limb} * factor + carry;
+        limb = static_cast<uint32_t>(value);
+        carry = value >> 32;
+    }
+    if (carry != 0) {
+        limbs.push_back(static_cast<uint32_t>(carry));
+    }
+}
+
+// limbs /= divisor, returns the remainder.
+uint32_t DivideSmall(Limbs& limbs, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (std::size_t i = limbs.size(); i > 0; --i) {
+        uint64_t value = (remainder << 32) | limbs[i - 1];
+        limbs[i - 1] = static_cast<uint32_t>(value / divisor);
+        remainder = value % divisor;
+    }
+    Trim(limbs);
+    return static_cast<uint32_t>(remainder);
+}
+
+// out[0, a_size + b_size) = a * b, out must be zeroed.
+void Schoolbook(const uint32_t* a, std::size_t a_size, const uint32_t* b, std::size_t b_size, uint32_t* out) {
+    for (std::size_t i = 0; i < a_size; ++i) {
+        uint64_t carry = 0;
+        uint64_t digit = a[i];
+        for (std::size_t j = 0; j < b_size; ++j) {
+            uint64_t value = digit * b[j] + out[i + j] + carry;
+            out[i + j] = static_cast<uint32_t>(value);
+            carry = value >> 32;
+        }
+        out[i + b_size] = static_cast<uint32_t>(carry);
+    }
+}
+
+// out[offset...] += value, propagating the carry.
+void AddAt(Limbs& out, std::size_t offset, const Limbs& value) {
+    uint64_t carry = 0;
+    std::size_t i = 0;
+    for (; i < value.size() || carry != 0; ++i) {
+        uint64_t sum = uint64_t{out[offset + i]} + carry + (i < value.size() ? value[i] : 0);
+        out[offset + i] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+}
+
+Limbs Slice(const Limbs& limbs, std::size_t begin, std::size_t end) {
+    end = std::min(end, limbs.size());
+    if (begin >= end) {
+        return Limbs();
+    }
+    Limbs slice(limbs.begin() + begin, limbs.begin() + end);
+    Trim(slice);
+    return slice;
+}
+
+}  // namespace
+
+BigInt::BigInt(Limbs limbs, bool negative) : limbs_(std::move(limbs)), negative_(negative) {
+    Trim(limbs_);
+    if (limbs_.empty()) {
+        negative_ = false;
+    }
+}
+
+BigInt::BigInt(int64_t value) : negative_(value < 0) {
+    uint64_t magnitude = negative_ ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    while (magnitude != 0) {
+        limbs_.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+BigInt BigInt::Parse(std::string_view text) {
+    bool negative = false;
+    if (!text.empty() && (text[0] == '-' || text[0] == '+')) {
+        negative = text[0] == '-';
+        text.remove_prefix(1);
+    }
+    Limbs limbs;
+    std::size_t first = text.size() % kDecimalDigits;
+    if (first == 0) {
+        first = kDecimalDigits;
+    }
+    for (std::size_t pos = 0; pos < text.size();) {
+        std::size_t length = pos == 0 ? first : kDecimalDigits;
+        uint32_t chunk = 0;
+        uint32_t scale = 1;
+        for (std::size_t i = 0; i < length; ++i) {
+            chunk = chunk * 10 + static_cast<uint32_t>(text[pos + i] - '0');
+            scale *= 10;
+        }
+        MultiplyAdd(limbs, scale, chunk);
+        pos += length;
+    }
+    return BigInt(std::move(limbs), negative);
+}
+
+bool BigInt::ToInt64(int64_t* value) const {
+    if (limbs_.size() > 2) {
+        return false;
+    }
+    uint64_t magnitude = 0;
+    for (std::size_t i = limbs_.size(); i > 0; --i) {
+        magnitude = (magnitude << 32) | limbs_[i - 1];
+    }
+    if (negative_) {
+        if (magnitude > uint64_t{1} << 63) {
+            return false;
+        }
+        *value = static_cast<int64_t>(0 - magnitude);
+        return true;
+    }
+    if (magnitude >= uint64_t{1} << 63) {
+        return false;
+    }
+    *value = static_cast<int64_t>(magnitude);
+    return true;
+}
+
+void BigInt::AppendTo(std::string& out) const {
+    if (limbs_.empty()) {
+        out += '0';
+        return;
+    }
+    Limbs limbs = limbs_;
+    std::vector<uint32_t> chunks;
+    while (!limbs.empty()) {
+        chunks.push_back(DivideSmall(limbs, kDecimalBase));
+    }
+    if (negative_) {
+        out += '-';
+    }
+    out += std::to_string(chunks.back());
+    for (std::size_t i = chunks.size() - 1; i > 0; --i) {
+        std::string digits = std::to_string(chunks[i - 1]);
+        out.append(kDecimalDigits - digits.size(), '0');
+        out += digits;
+    }
+}
+
+std::string BigInt::ToString() const {
+    std::string out;
+    AppendTo(out);
+    return out;
+}
+
+BigInt BigInt::Negate() const {
+    return BigInt(limbs_, !negative_);
+}
+
+BigInt BigInt::Abs() const {
+    return BigInt(limbs_, false);
+}
+
+int BigInt::CompareMagnitude(const Limbs& a, const Limbs& b) {
+    if (a.size() != b.size()) {
+        return a.size() < b.size() ? -1 : 1;
+    }
+    for (std::size_t i = a.size(); i > 0; --i) {
+        if (a[i - 1] != b[i - 1]) {
+            return a[i - 1] < b[i - 1] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+BigInt::Limbs BigInt::AddMagnitude(const Limbs& a, const Limbs& b) {
+    const Limbs& longer = a.size() >= b.size() ? a : b;
+    const Limbs& shorter = a.size() >= b.size() ? b : a;
+    Limbs sum(longer.size() + 1);
+    uint64_t carry = 0;
+    for (std::size_t i = 0; i < longer.size(); ++i) {
+        uint64_t value = uint64_t{longer[i]} + (i < shorter.size() ? shorter[i] : 0) + carry;
+        sum[i] = static_cast<uint32_t>(value);
+        carry = value >> 32;
+    }
+    sum[longer.size()] = static_cast<uint32_t>(carry);
+    Trim(sum);
+    return sum;
+}
+
+// a - b for |a| >= |b|.
+BigInt::Limbs BigInt::SubtractMagnitude(const Limbs& a, const Limbs& b) {
+    Limbs difference(a.size());
+    int64_t borrow = 0;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        int64_t value = int64_t{a[i]} - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = value < 0;
+        difference[i] = static_cast<uint32_t>(value + (borrow << 32));
+    }
+    Trim(difference);
+    return difference;
+}
+
+// Karatsuba: with a = a1 * B + a0 and b = b1 * B + b0,
+// a * b = z2 * B^2 + (z1 - z2 - z0) * B + z0 for z2 = a1 * b1, z0 = a0 * b0
+// and z1 = (a1 + a0) * (b1 + b0).
+BigInt::Limbs BigInt::MultiplyMagnitude(const Limbs& a, const Limbs& b) {
+    if (a.empty() || b.empty()) {
+        return Limbs();
+    }
+    if (std::min(a.size(), b.size()) < kKaratsubaThreshold) {
+        Limbs product(a.size() + b.size());
+        Schoolbook(a.data(), a.size(), b.data(), b.size(), product.data());
+        Trim(product);
+        return product;
+    }
+    std::size_t half = std::max(a.size(), b.size()) / 2;
+    Limbs a0 = Slice(a, 0, half);
+    Limbs a1 = Slice(a, half, a.size());
+    Limbs b0 = Slice(b, 0, half);
+    Limbs b1 = Slice(b, half, b.size());
+    Limbs z0 = MultiplyMagnitude(a0, b0);
+    Limbs z2 = MultiplyMagnitude(a1, b1);
+    Limbs z1 = MultiplyMagnitude(AddMagnitude(a1, a0), AddMagnitude(b1, b0));
+    z1 = SubtractMagnitude(SubtractMagnitude(z1, z2), z0);
+
+    Limbs product(a.size() + b.size() + 1);
+    AddAt(product, 0, z0);
+    AddAt(product, half, z1);
+    AddAt(product, 2 * half, z2);
+    Trim(product);
+    return product;
+}
+
+// Knuth's algorithm D (TAOCP 4.3.1) for a multi-limb divisor.
+void BigInt::DivideMagnitude(const Limbs& a, const Limbs& b, Limbs* quotient, Limbs* remainder) {
+    if (CompareMagnitude(a, b) < 0) {
+        quotient->clear();
+        *remainder = a;
+        return;
+    }
+    if (b.size() == 1) {
+        *quotient = a;
+        uint32_t rest = DivideSmall(*quotient, b[0]);
+        remainder->assign(rest == 0 ? 0 : 1, rest);
+        return;
+    }
+    // Normalize so that the divisor's top limb has its high bit set.
+    int shift = __builtin_clz(b.back());
+    auto shifted = [shift](const Limbs& limbs, std::size_t extra) {
+        Limbs out(limbs.size() + extra);
+        for (std::size_t i = 0; i < limbs.size(); ++i) {
+            uint64_t value = uint64_t{limbs[i]} << shift;
+            out[i] |= static_cast<uint32_t>(value);
+            if (i + 1 < out.size()) {
+                out[i + 1] |= static_cast<uint32_t>(value >> 32);
+            }
+        }
+        return out;
+    };
+    Limbs v = shifted(b, 0);
+    Limbs u = shifted(a, 1);
+    std::size_t n = v.size();
+    std::size_t m = a.size() - n;
+    Limbs q(m + 1);
+    uint64_t top = v[n - 1];
+    uint64_t next = v[n - 2];
+    for (std::size_t j = m + 1; j > 0; --j) {
+        std::size_t k = j - 1;
+        uint64_t numerator = (uint64_t{u[k + n]} << 32) | u[k + n - 1];
+        uint64_t estimate = numerator / top;
+        uint64_t rest = numerator % top;
+        while (estimate > 0xffffffffu || estimate * next > ((rest << 32) | u[k + n - 2])) {
+            --estimate;
+            rest += top;
+            if (rest > 0xffffffffu) {
+                break;
+            }
+        }
+        // u[k, k + n] -= estimate * v.
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            uint64_t product = estimate * v[i] + carry;
+            carry = product >> 32;
+            int64_t value = int64_t{u[k + i]} - static_cast<uint32_t>(product) - borrow;
+            borrow = value < 0;
+            u[k + i] = static_cast<uint32_t>(value + (borrow << 32));
+        }
+        int64_t value = int64_t{u[k + n]} - static_cast<int64_t>(carry) - borrow;
+        u[k + n] = static_cast<uint32_t>(value);
+        if (value < 0) {
+            // The estimate was one too large: add the divisor back.
+            --estimate;
+            uint64_t add_carry = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                uint64_t sum = uint64_t{u[k + i]} + v[i] + add_carry;
+                u[k + i] = static_cast<uint32_t>(sum);
+                add_carry = sum >> 32;
+            }
+            u[k + n] += static_cast<uint32_t>(add_carry);
+        }
+        q[k] = static_cast<uint32_t>(estimate);
+    }
+    Trim(q);
+    *quotient = std::move(q);
+    // Undo the normalization of the remainder.
+    remainder->assign(n, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+        uint64_t value = (uint64_t{u[i + 1]} << 32 | u[i]) >> shift;
+        (*remainder)[i] = static_cast<uint32_t>(value);
+    }
+    Trim(*remainder);
+}
+
+BigInt operator+(const BigInt& a, const BigInt& b) {
+    if (a.negative_ == b.negative_) {
+        return BigInt(BigInt::AddMagnitude(a.limbs_, b.limbs_), a.negative_);
+    }
+    if (BigInt::CompareMagnitude(a.limbs_, b.limbs_) >= 0) {
+        return BigInt(BigInt::SubtractMagnitude(a.limbs_, b.limbs_), a.negative_);
+    }
+    return BigInt(BigInt::SubtractMagnitude(b.limbs_, a.limbs_), b.negative_);
+}
+
+BigInt operator-(const BigInt& a, const BigInt& b) {
+    return a + b.Negate();
+}
+
+BigInt operator*(const BigInt& a, const BigInt& b) {
+    return BigInt(BigInt::MultiplyMagnitude(a.limbs_, b.limbs_), a.negative_ != b.negative_);
+}
+
+BigInt operator/(const BigInt& a, const BigInt& b) {
+    BigInt::Limbs quotient;
+    BigInt::Limbs remainder;
+    BigInt::DivideMagnitude(a.limbs_, b.limbs_, &quotient, &remainder);
+    return BigInt(std::move(quotient), a.negative_ != b.negative_);
+}
+
+int Compare(const BigInt& a, const BigInt& b) {
+    if (a.negative_ != b.negative_) {
+        return a.negative_ ? -1 : 1;
+    }
+    int magnitude = BigInt::CompareMagnitude(a.limbs_, b.limbs_);
+    return a.negative_ ? -magnitude : magnitude;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary-precision integer: a sign and a magnitude in base 2^32 limbs,
+// least significant first, without leading zero limbs (zero has none).
+// Division truncates towards zero, like C++ integer division.
+class BigInt {
+private:
+    using Limbs = std::vector<uint32_t>;
+
+    Limbs limbs_;
+    bool negative_ = false;
+
+    BigInt(Limbs limbs, bool negative);
+
+    static int CompareMagnitude(const Limbs& a, const Limbs& b);
+    static Limbs AddMagnitude(const Limbs& a, const Limbs& b);
+    static Limbs SubtractMagnitude(const Limbs& a, const Limbs& b);
+    static Limbs MultiplyMagnitude(const Limbs& a, const Limbs& b);
+    static void DivideMagnitude(const Limbs& a, const Limbs& b, Limbs* quotient, Limbs* remainder);
+public:
+    BigInt() = default;
+    explicit BigInt(int64_t value);
+
+    // Parses an optionally signed decimal literal.
+    static BigInt Parse(std::string_view text);
+
+    bool IsZero() const {
+        return limbs_.empty();
+    }
+    bool IsNegative() const {
+        return negative_;
+    }
+
+    // Stores the value in *value if it fits in 64 bits.
+    bool ToInt64(int64_t* value) const;
+
+    void AppendTo(std::string& out) const;
+    std::string ToString() const;
+
+    BigInt Negate() const;
+    BigInt Abs() const;
+
+    friend BigInt operator+(const BigInt& a, const BigInt& b);
+    friend BigInt operator-(const BigInt& a, const BigInt& b);
+    friend BigInt operator*(const BigInt& a, const BigInt& b);
+    // b must not be zero.
+    friend BigInt operator/(const BigInt& a, const BigInt& b);
+
+    // Negative, zero or positive as a is less than, equal to or greater than b.
+    friend int Compare(const BigInt& a, const BigInt& b);
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Object;
+struct Prototype;
+
+// Changes with the instructions and with the code the compiler emits, so that
+// compiled code saved by another version (image.h) isn't run.
+constexpr uint32_t kBytecodeVersion = 2;
+
+enum class OpCode : uint8_t {
+    kConstant,          // push constants[arg]
+    kGlobal,            // push the value bound to the symbol of globals[arg]
+    kDefine,            // bind symbol arg to the popped value, push ()
+    kSet,               // like kDefine, symbol arg must already be bound
+    kLocal,             // push frame slot arg
+    kLocalBoxed,        // push the contents of the box in frame slot arg
+    kSetLocal,          // store the top value in frame slot arg, replace it with ()
+    kSetLocalBoxed,     // like kSetLocal, storing into the box in slot arg
+    kCaptured,          // push captured value arg of the running closure
+    kCapturedBoxed,     // push the contents of captured box arg
+    kSetCapturedBoxed,  // store the top value into captured box arg, replace it with ()
+    kBox,               // wrap frame slot arg in a fresh box
+    kClosure,           // push a closure of prototypes[arg]
+    kPop,
+    kJump,              // continue at arg
+    kJumpIfFalse,       // pop, continue at arg if the value was #f
+    kJumpIfFalseOrPop,  // continue at arg keeping the value if it is #f, else pop
+    kJumpIfTrueOrPop,   // continue at arg keeping the value unless it is #f, else pop
+    kCall,              // call the procedure below the top arg values
+    kTailCall,          // like kCall, but a closure replaces the running frame; a kReturn follows
+    kReturn,
+    kFolded,            // if folds[arg] still holds, push its value and continue at its end
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t arg;
+};
+
+// A call of pure builtins on constants, computed by the compiler. The code
+// that makes the call follows kFolded and ends at end; while every operator
+// is still bound to the builtin the value was computed with, the value
+// replaces it.
+struct Fold {
+    struct Operator {
+        uint32_t symbol;
+        // Index of the builtin in constants.
+        uint32_t builtin;
+    };
+
+    uint32_t value;
+    uint32_t end;
+    std::vector<Operator> operators;
+    // The environment (Environment::Id, Version) the operators were last
+    // found to hold in: until it changes they aren't looked up again.
+    mutable uint64_t checked_environment = 0;
+    mutable uint64_t checked_version = 0;
+};
+
+// A global read by one kGlobal. The cell its value was found in is kept with
+// the environment's Layout at the time: until that changes, the value is read
+// from the cell without looking the symbol up.
+struct GlobalRead {
+    uint32_t symbol;
+    mutable uint64_t layout = 0;
+    mutable Object* const* cell = nullptr;
+};
+
+// Compiled form of one top-level expression or lambda body. Globals are
+// addressed by SymbolId, their key in the Environment; locals by their slot in
+// the procedure's frame.
+struct Chunk {
+    std::vector<Instruction> code;
+    std::vector<Object*> constants;
+    std::vector<std::shared_ptr<const Prototype>> prototypes;
+    std::vector<Fold> folds;
+    std::vector<GlobalRead> globals;
+
+    void Clear() {
+        code.clear();
+        constants.clear();
+        prototypes.clear();
+        folds.clear();
+        globals.clear();
+    }
+};
+
+// Where a closure takes captured value i from when it is created: a slot of
+// the creating frame, or a value the creating closure captured itself.
+struct Capture {
+    bool from_captured;
+    uint32_t index;
+};
+
+// A compiled lambda. Its frame holds the parameters (a rest parameter last)
+// followed by the locals introduced by internal defines.
+struct Prototype {
+    Chunk chunk;
+    // The name it was defined with, empty for an anonymous lambda.
+    std::string name;
+    uint32_t arity = 0;
+    bool has_rest = false;
+    uint32_t frame_size = 0;
+    std::vector<Capture> captures;
+};
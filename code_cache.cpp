@@ -0,0 +1,74 @@
+#include "code_cache.h"
+
+#include "error.h"
+
+// The body of a cache is a record per form: uint32 begin and end, uint32
+// count and that many assumptions (name, uint8 special, uint8 syntax), then
+// the chunk.
+
+namespace {
+
+std::string SourceKey(std::string_view source) {
+    uint64_t key[] = {source.size(), HashBytes(source)};
+    return std::string(reinterpret_cast<const char*>(key), sizeof(key));
+}
+
+}  // namespace
+
+CodeCacheWriter::CodeCacheWriter(const Builtins& builtins, Heap* heap) : heap_(heap), image_(builtins) {
+    heap_->AddRoots(this);
+}
+
+CodeCacheWriter::~CodeCacheWriter() {
+    heap_->RemoveRoots(this);
+}
+
+void CodeCacheWriter::MarkRoots(Marker& marker) {
+    image_.Mark(marker);
+}
+
+void CodeCacheWriter::Add(const CachedForm& form) {
+    image_.U32(form.begin);
+    image_.U32(form.end);
+    image_.U32(static_cast<uint32_t>(form.assumptions.size()));
+    for (const SyntaxAssumption& assumption : form.assumptions) {
+        image_.Name(assumption.symbol);
+        image_.U8(assumption.special);
+        image_.U8(static_cast<uint8_t>(assumption.syntax));
+    }
+    image_.WriteChunk(form.chunk);
+    image_.Flush();
+}
+
+std::string CodeCacheWriter::Finish(std::string_view source) {
+    return image_.Finish(SourceKey(source));
+}
+
+bool ReadCodeCache(std::string_view cache, std::string_view source, const Builtins& builtins,
+                   std::vector<CachedForm>* forms) {
+    ImageReader reader(cache, builtins);
+    if (reader.Key() != SourceKey(source)) {
+        return false;
+    }
+    reader.ReadObjects();
+    while (!reader.AtEnd()) {
+        CachedForm& form = forms->emplace_back();
+        form.begin = reader.U32();
+        form.end = reader.U32();
+        if (form.begin > form.end || form.end > source.size()) {
+            throw RuntimeError("invalid image");
+        }
+        uint32_t count = reader.Count(sizeof(uint32_t) + 2);
+        for (uint32_t i = 0; i < count; ++i) {
+            SymbolId symbol = reader.Name();
+            bool special = reader.U8() != 0;
+            uint8_t syntax = reader.U8();
+            if (syntax > static_cast<uint8_t>(Syntax::kLambda)) {
+                throw RuntimeError("invalid image");
+            }
+            form.assumptions.push_back(SyntaxAssumption{symbol, special, static_cast<Syntax>(syntax)});
+        }
+        reader.ReadChunk(form.chunk);
+    }
+    return true;
+}
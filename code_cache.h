@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bytecode.h"
+#include "compiler.h"
+#include "heap.h"
+#include "image.h"
+
+// A top-level form of a source file as it was compiled.
+struct CachedForm {
+    // Where its text is in the source.
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    std::vector<SyntaxAssumption> assumptions;
+    Chunk chunk;
+};
+
+// Builds the cache of the compiled forms of a source file, for
+// Interpreter::LoadCached: an image (image.h) keyed by the size and a hash of
+// the source. The image tells objects apart by address, so the objects of the
+// forms added so far are kept alive in heap until the writer is destroyed:
+// running a form may collect garbage that a later form would otherwise reuse
+// the address of.
+class CodeCacheWriter : private RootSet {
+private:
+    Heap* heap_;
+    ImageWriter image_;
+
+    void MarkRoots(Marker& marker) override;
+public:
+    CodeCacheWriter(const Builtins& builtins, Heap* heap);
+    CodeCacheWriter(const CodeCacheWriter&) = delete;
+    CodeCacheWriter& operator=(const CodeCacheWriter&) = delete;
+    ~CodeCacheWriter();
+
+    // Saves form as it is now, before running it can change its constants.
+    void Add(const CachedForm& form);
+
+    std::string Finish(std::string_view source);
+};
+
+// Reads the forms of a cache that was written for source into *forms, making
+// their constants in the current heap: nothing may collect the heap until
+// they are rooted. Returns false for a cache of other source; throws
+// RuntimeError for a malformed cache or one of another build.
+bool ReadCodeCache(std::string_view cache, std::string_view source, const Builtins& builtins,
+                   std::vector<CachedForm>* forms);
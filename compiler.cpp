@@ -0,0 +1,598 @@
+#include "compiler.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+
+// The frame layout of the lambda being compiled. Captures are added lazily,
+// the first time the body refers to a variable of an enclosing lambda.
+struct Scope {
+    Scope* parent;
+    Prototype* prototype;
+    std::vector<SymbolId> locals = {};
+    std::vector<bool> boxed_locals = {};
+    std::vector<SymbolId> captured = {};
+    std::vector<bool> boxed_captured = {};
+};
+
+enum class Where { kLocal, kCaptured, kGlobal };
+
+struct Variable {
+    Where where;
+    uint32_t index;
+    bool boxed;
+};
+
+Variable Resolve(Scope* scope, SymbolId id) {
+    if (scope == nullptr) {
+        return Variable{Where::kGlobal, id, false};
+    }
+    for (std::size_t i = 0; i < scope->locals.size(); ++i) {
+        if (scope->locals[i] == id) {
+            return Variable{Where::kLocal, static_cast<uint32_t>(i), scope->boxed_locals[i]};
+        }
+    }
+    for (std::size_t i = 0; i < scope->captured.size(); ++i) {
+        if (scope->captured[i] == id) {
+            return Variable{Where::kCaptured, static_cast<uint32_t>(i), scope->boxed_captured[i]};
+        }
+    }
+    Variable outer = Resolve(scope->parent, id);
+    if (outer.where == Where::kGlobal) {
+        return outer;
+    }
+    scope->prototype->captures.push_back(Capture{outer.where == Where::kCaptured, outer.index});
+    scope->captured.push_back(id);
+    scope->boxed_captured.push_back(outer.boxed);
+    return Variable{Where::kCaptured, static_cast<uint32_t>(scope->captured.size() - 1), outer.boxed};
+}
+
+// What a lambda body does with its variables, collected before any code is
+// emitted so that the frame layout and the boxed slots are known up front.
+struct Analysis {
+    std::vector<SymbolId> defined;
+    std::unordered_set<SymbolId> assigned;
+    std::unordered_set<SymbolId> used_by_nested;
+};
+
+class Compiler {
+private:
+    Environment& env_;
+    Chunk* chunk_;
+    Scope* scope_ = nullptr;
+    std::size_t depth_ = 0;
+    CompileOptions options_;
+    CompileStats* stats_;
+    // Off while compiling the code a fold stands for.
+    bool folding_ = true;
+    // Calls Evaluate gave up on, so that it doesn't retry their subcalls.
+    std::unordered_set<const Object*> not_constant_;
+    std::unordered_set<SymbolId> assumed_;
+
+    // Counts a form being compiled or analyzed while it is; nesting deeper
+    // than the limit would risk the native stack.
+    class Nesting {
+    private:
+        Compiler* compiler_;
+    public:
+        explicit Nesting(Compiler* compiler) : compiler_(compiler) {
+            if (compiler_->depth_ == std::min(compiler_->options_.max_depth, CompileOptions::kMaxDepth)) {
+                throw LimitError("depth limit exceeded");
+            }
+            ++compiler_->depth_;
+        }
+        Nesting(const Nesting&) = delete;
+        Nesting& operator=(const Nesting&) = delete;
+        ~Nesting() {
+            --compiler_->depth_;
+        }
+    };
+
+    void CompileCall(const Cell* form, bool tail);
+    bool CompileFolded(Object* form, bool tail);
+    bool Evaluate(Object* form, Object** value, std::vector<std::pair<SymbolId, Object*>>* operators);
+    void CompileIf(Object* operands, bool tail);
+    void CompileLogic(Object* operands, OpCode jump, Object* empty, bool tail);
+    void CompileDefine(Object* operands);
+    void EmitClosure(std::shared_ptr<Prototype> prototype);
+    void CompileSet(Object* operands);
+    void CompileBody(Object* body);
+    void Analyze(Object* form, bool nested, Analysis* analysis);
+
+    bool IsLocal(SymbolId id) const {
+        for (Scope* scope = scope_; scope != nullptr; scope = scope->parent) {
+            for (SymbolId local : scope->locals) {
+                if (local == id) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    const SpecialForm* FindSpecialForm(Object* head) {
+        if (!Is<Symbol>(head)) {
+            return nullptr;
+        }
+        SymbolId id = As<Symbol>(head)->GetId();
+        if (IsLocal(id)) {
+            return nullptr;
+        }
+        auto value = env_.Find(id);
+        const SpecialForm* special = value != nullptr && Is<SpecialForm>(*value) ? As<SpecialForm>(*value) : nullptr;
+        if (options_.assumptions != nullptr && assumed_.insert(id).second) {
+            options_.assumptions->push_back(
+                SyntaxAssumption{id, special != nullptr, special != nullptr ? special->GetSyntax() : Syntax::kQuote});
+        }
+        return special;
+    }
+
+    // A form whose value can't change: self-evaluating, or quoted.
+    bool IsLiteral(Object* form, Object** value) {
+        if (Is<Symbol>(form)) {
+            return false;
+        }
+        if (!Is<Cell>(form)) {
+            *value = form;
+            return true;
+        }
+        const SpecialForm* special = FindSpecialForm(As<Cell>(form)->GetFirst());
+        if (special == nullptr || special->GetSyntax() != Syntax::kQuote) {
+            return false;
+        }
+        *value = As<Cell>(form)->GetSecond();
+        return true;
+    }
+
+    std::size_t AddConstant(Object* value) {
+        chunk_->constants.push_back(value);
+        return chunk_->constants.size() - 1;
+    }
+
+    void EmitConstant(Object* value) {
+        Emit(OpCode::kConstant, AddConstant(value));
+    }
+
+    // Points the jump emitted at `from` to the next instruction.
+    void PatchJump(std::size_t from) {
+        chunk_->code[from].arg = static_cast<uint32_t>(chunk_->code.size());
+    }
+public:
+    Compiler(Environment& env, Chunk* chunk, const CompileOptions& options = {}, CompileStats* stats = nullptr)
+        : env_(env), chunk_(chunk), options_(options), stats_(stats) {
+    }
+
+    std::size_t Emit(OpCode op, std::size_t arg = 0) {
+        chunk_->code.push_back(Instruction{op, static_cast<uint32_t>(arg)});
+        return chunk_->code.size() - 1;
+    }
+
+    // A form in tail position is the last thing its procedure evaluates;
+    // calls there reuse the caller's frame.
+    void CompileExpr(Object* form, bool tail = false);
+    std::shared_ptr<Prototype> CompileLambda(Object* params, Object* body);
+};
+
+void Compiler::CompileExpr(Object* form, bool tail) {
+    if (Is<Symbol>(form)) {
+        Variable variable = Resolve(scope_, As<Symbol>(form)->GetId());
+        switch (variable.where) {
+            case Where::kLocal:
+                Emit(variable.boxed ? OpCode::kLocalBoxed : OpCode::kLocal, variable.index);
+                return;
+            case Where::kCaptured:
+                Emit(variable.boxed ? OpCode::kCapturedBoxed : OpCode::kCaptured, variable.index);
+                return;
+            case Where::kGlobal:
+                chunk_->globals.push_back(GlobalRead{variable.index});
+                Emit(OpCode::kGlobal, chunk_->globals.size() - 1);
+                return;
+        }
+    }
+    if (!Is<Cell>(form)) {
+        EmitConstant(form);
+        return;
+    }
+    Nesting nesting(this);
+    const Cell* cell = As<Cell>(form);
+    CallOnEmpty(cell->GetFirst());
+    const SpecialForm* special = FindSpecialForm(cell->GetFirst());
+    if (special == nullptr) {
+        if (!CompileFolded(form, tail)) {
+            CompileCall(cell, tail);
+        }
+        return;
+    }
+    Object* operands = cell->GetSecond();
+    switch (special->GetSyntax()) {
+        case Syntax::kQuote:
+            EmitConstant(operands);
+            return;
+        case Syntax::kIf:
+            CompileIf(operands, tail);
+            return;
+        case Syntax::kAnd:
+            CompileLogic(operands, OpCode::kJumpIfFalseOrPop, Boolean::True(), tail);
+            return;
+        case Syntax::kOr:
+            CompileLogic(operands, OpCode::kJumpIfTrueOrPop, Boolean::False(), tail);
+            return;
+        case Syntax::kDefine:
+            CompileDefine(operands);
+            return;
+        case Syntax::kSet:
+            CompileSet(operands);
+            return;
+        case Syntax::kLambda:
+            IsTypeSyntax<Cell>(operands);
+            EmitClosure(CompileLambda(As<Cell>(operands)->GetFirst(), As<Cell>(operands)->GetSecond()));
+            return;
+    }
+}
+
+void Compiler::CompileCall(const Cell* form, bool tail) {
+    CompileExpr(form->GetFirst());
+    std::size_t count = 0;
+    for (const Object* cur = form->GetSecond(); cur != nullptr; cur = As<Cell>(cur)->GetSecond()) {
+        CompileExpr(As<Cell>(cur)->GetFirst());
+        ++count;
+    }
+    Emit(tail ? OpCode::kTailCall : OpCode::kCall, count);
+}
+
+// Emits kFolded for a call Evaluate can compute, followed by the call for when
+// an operator has been rebound since.
+bool Compiler::CompileFolded(Object* form, bool tail) {
+    if (!folding_ || (scope_ == nullptr && !options_.fold_top_level)) {
+        return false;
+    }
+    Object* value;
+    std::vector<std::pair<SymbolId, Object*>> operators;
+    if (!Evaluate(form, &value, &operators)) {
+        return false;
+    }
+    Fold fold;
+    fold.value = static_cast<uint32_t>(AddConstant(value));
+    for (const auto& [symbol, builtin] : operators) {
+        bool seen = std::any_of(fold.operators.begin(), fold.operators.end(),
+                                [symbol = symbol](const Fold::Operator& other) { return other.symbol == symbol; });
+        if (!seen) {
+            fold.operators.push_back(Fold::Operator{symbol, static_cast<uint32_t>(AddConstant(builtin))});
+        }
+    }
+    std::size_t index = chunk_->folds.size();
+    chunk_->folds.push_back(std::move(fold));
+    Emit(OpCode::kFolded, index);
+    folding_ = false;
+    CompileCall(As<Cell>(form), tail);
+    folding_ = true;
+    chunk_->folds[index].end = static_cast<uint32_t>(chunk_->code.size());
+    if (stats_ != nullptr) {
+        stats_->folded += operators.size();
+        ++stats_->fold_sites;
+    }
+    return true;
+}
+
+// Computes the value of a literal, or of a call of a global pure builtin whose
+// arguments Evaluate can compute, if it is a number or a boolean. Errors are
+// left for run time. Adds the operator of every call it made to operators.
+bool Compiler::Evaluate(Object* form, Object** value, std::vector<std::pair<SymbolId, Object*>>* operators) {
+    if (IsLiteral(form, value)) {
+        return true;
+    }
+    if (!Is<Cell>(form) || not_constant_.count(form) > 0) {
+        return false;
+    }
+    Nesting nesting(this);
+    const Cell* cell = As<Cell>(form);
+    Object* head = cell->GetFirst();
+    Object* const* binding = nullptr;
+    if (Is<Symbol>(head) && !IsLocal(As<Symbol>(head)->GetId())) {
+        binding = env_.Find(As<Symbol>(head)->GetId());
+    }
+    if (binding == nullptr || !Is<Procedure>(*binding) || !As<Procedure>(*binding)->IsPure()) {
+        return false;
+    }
+    Procedure* builtin = As<Procedure>(*binding);
+    std::vector<Object*> args;
+    const Object* cur = cell->GetSecond();
+    for (; Is<Cell>(cur); cur = As<Cell>(cur)->GetSecond()) {
+        Object* arg;
+        if (!Evaluate(As<Cell>(cur)->GetFirst(), &arg, operators)) {
+            not_constant_.insert(form);
+            return false;
+        }
+        args.push_back(arg);
+    }
+    Object* result = nullptr;
+    if (cur == nullptr) {
+        try {
+            result = builtin->Call(args);
+        } catch (const std::runtime_error&) {
+        }
+    }
+    if (!Is<Numeric>(result) && !Is<Boolean>(result)) {
+        not_constant_.insert(form);
+        return false;
+    }
+    operators->emplace_back(As<Symbol>(head)->GetId(), builtin);
+    *value = result;
+    return true;
+}
+
+void Compiler::CompileIf(Object* operands, bool tail) {
+    int length = TreeLength(operands);
+    if (length < 1 || length > 3 || LastInTree(operands) != nullptr) {
+        throw SyntaxError("SyntaxError");
+    }
+    Object* test;
+    if (IsLiteral(PosInTree(operands, 0), &test)) {
+        // Only the branch the test selects can run.
+        int branch = IsFalse(test) ? 2 : 1;
+        if (length > branch) {
+            CompileExpr(PosInTree(operands, branch), tail);
+        } else {
+            EmitConstant(nullptr);
+        }
+        if (stats_ != nullptr) {
+            ++stats_->pruned;
+        }
+        return;
+    }
+    CompileExpr(PosInTree(operands, 0));
+    std::size_t to_else = Emit(OpCode::kJumpIfFalse);
+    if (length > 1) {
+        CompileExpr(PosInTree(operands, 1), tail);
+    } else {
+        EmitConstant(nullptr);
+    }
+    std::size_t to_end = Emit(OpCode::kJump);
+    PatchJump(to_else);
+    if (length > 2) {
+        CompileExpr(PosInTree(operands, 2), tail);
+    } else {
+        EmitConstant(nullptr);
+    }
+    PatchJump(to_end);
+}
+
+// and/or: every operand but the last jumps to the end when it decides the
+// result, leaving itself on the stack as the value. A literal operand either
+// decides it, and the operands after it are dropped, or is dropped itself.
+void Compiler::CompileLogic(Object* operands, OpCode jump, Object* empty, bool tail) {
+    if (operands == nullptr) {
+        EmitConstant(empty);
+        return;
+    }
+    if (LastInTree(operands) != nullptr) {
+        throw SyntaxError("SyntaxError");
+    }
+    bool decided_by_false = jump == OpCode::kJumpIfFalseOrPop;
+    bool pruned = false;
+    std::vector<std::size_t> to_end;
+    for (const Object* cur = operands; cur != nullptr; cur = As<Cell>(cur)->GetSecond()) {
+        bool last = As<Cell>(cur)->GetSecond() == nullptr;
+        Object* value;
+        if (!last && IsLiteral(As<Cell>(cur)->GetFirst(), &value)) {
+            pruned = true;
+            if (IsFalse(value) == decided_by_false) {
+                EmitConstant(value);
+                break;
+            }
+            continue;
+        }
+        CompileExpr(As<Cell>(cur)->GetFirst(), tail && last);
+        if (!last) {
+            to_end.push_back(Emit(jump));
+        }
+    }
+    for (std::size_t from : to_end) {
+        PatchJump(from);
+    }
+    if (pruned && stats_ != nullptr) {
+        ++stats_->pruned;
+    }
+}
+
+void Compiler::EmitClosure(std::shared_ptr<Prototype> prototype) {
+    chunk_->prototypes.push_back(std::move(prototype));
+    Emit(OpCode::kClosure, chunk_->prototypes.size() - 1);
+}
+
+// Inside a lambda, define assigns the local slot Analyze reserved for the
+// name; at top level it binds a global. Procedures defined either way are
+// named after the binding (for profiles).
+void Compiler::CompileDefine(Object* operands) {
+    SymbolId id;
+    if (Is<Cell>(operands) && Is<Cell>(As<Cell>(operands)->GetFirst())) {
+        // (define (name . params) body...)
+        const Cell* signature = As<Cell>(As<Cell>(operands)->GetFirst());
+        IsTypeSyntax<Symbol>(signature->GetFirst());
+        id = As<Symbol>(signature->GetFirst())->GetId();
+        auto prototype = CompileLambda(signature->GetSecond(), As<Cell>(operands)->GetSecond());
+        prototype->name = SymbolTable::Instance().Name(id);
+        EmitClosure(std::move(prototype));
+    } else {
+        id = BindingTarget(operands);
+        Object* value = PosInTree(operands, 1);
+        const SpecialForm* special = Is<Cell>(value) ? FindSpecialForm(As<Cell>(value)->GetFirst()) : nullptr;
+        if (special != nullptr && special->GetSyntax() == Syntax::kLambda && Is<Cell>(As<Cell>(value)->GetSecond())) {
+            // (define name (lambda params body...))
+            const Cell* lambda = As<Cell>(As<Cell>(value)->GetSecond());
+            auto prototype = CompileLambda(lambda->GetFirst(), lambda->GetSecond());
+            prototype->name = SymbolTable::Instance().Name(id);
+            EmitClosure(std::move(prototype));
+        } else {
+            CompileExpr(value);
+        }
+    }
+    Variable variable = Resolve(scope_, id);
+    if (variable.where == Where::kLocal) {
+        Emit(variable.boxed ? OpCode::kSetLocalBoxed : OpCode::kSetLocal, variable.index);
+    } else {
+        Emit(OpCode::kDefine, id);
+    }
+}
+
+void Compiler::CompileSet(Object* operands) {
+    SymbolId id = BindingTarget(operands);
+    CompileExpr(PosInTree(operands, 1));
+    Variable variable = Resolve(scope_, id);
+    switch (variable.where) {
+        case Where::kLocal:
+            Emit(variable.boxed ? OpCode::kSetLocalBoxed : OpCode::kSetLocal, variable.index);
+            return;
+        case Where::kCaptured:
+            // Analyze boxes every captured variable that is assigned.
+            Emit(OpCode::kSetCapturedBoxed, variable.index);
+            return;
+        case Where::kGlobal:
+            Emit(OpCode::kSet, id);
+            return;
+    }
+}
+
+void Compiler::CompileBody(Object* body) {
+    if (body == nullptr) {
+        throw SyntaxError("SyntaxError");
+    }
+    for (const Object* cur = body; cur != nullptr; cur = As<Cell>(cur)->GetSecond()) {
+        if (!Is<Cell>(cur)) {
+            throw SyntaxError("SyntaxError");
+        }
+        bool last = As<Cell>(cur)->GetSecond() == nullptr;
+        CompileExpr(As<Cell>(cur)->GetFirst(), last);
+        Emit(last ? OpCode::kReturn : OpCode::kPop);
+    }
+}
+
+// Records names defined directly in the body, names assigned anywhere in it
+// and names mentioned inside nested lambdas. Shadowing is ignored, which can
+// only box a variable that didn't need it.
+void Compiler::Analyze(Object* form, bool nested, Analysis* analysis) {
+    if (Is<Symbol>(form)) {
+        if (nested) {
+            analysis->used_by_nested.insert(As<Symbol>(form)->GetId());
+        }
+        return;
+    }
+    if (!Is<Cell>(form)) {
+        return;
+    }
+    Nesting nesting(this);
+    Object* operands = As<Cell>(form)->GetSecond();
+    if (const SpecialForm* special = FindSpecialForm(As<Cell>(form)->GetFirst())) {
+        Syntax syntax = special->GetSyntax();
+        if (syntax == Syntax::kQuote) {
+            return;
+        }
+        if (syntax == Syntax::kLambda) {
+            nested = true;
+        }
+        if ((syntax == Syntax::kDefine || syntax == Syntax::kSet) && Is<Cell>(operands)) {
+            auto target = As<Cell>(operands)->GetFirst();
+            bool procedure = Is<Cell>(target);
+            if (procedure) {
+                target = As<Cell>(target)->GetFirst();
+            }
+            if (Is<Symbol>(target)) {
+                SymbolId id = As<Symbol>(target)->GetId();
+                analysis->assigned.insert(id);
+                if (syntax == Syntax::kDefine && !nested) {
+                    analysis->defined.push_back(id);
+                }
+            }
+            if (syntax == Syntax::kDefine && procedure) {
+                // (define (name . params) body...): the body is a nested lambda.
+                for (const Object* cur = As<Cell>(operands)->GetSecond(); Is<Cell>(cur);
+                     cur = As<Cell>(cur)->GetSecond()) {
+                    Analyze(As<Cell>(cur)->GetFirst(), true, analysis);
+                }
+                return;
+            }
+        }
+    }
+    const Object* cur = form;
+    while (Is<Cell>(cur)) {
+        Analyze(As<Cell>(cur)->GetFirst(), nested, analysis);
+        cur = As<Cell>(cur)->GetSecond();
+    }
+    if (Is<Symbol>(cur) && nested) {
+        analysis->used_by_nested.insert(static_cast<const Symbol*>(cur)->GetId());
+    }
+}
+
+std::shared_ptr<Prototype> Compiler::CompileLambda(Object* params, Object* body) {
+    auto prototype = std::make_shared<Prototype>();
+    Scope scope{scope_, prototype.get()};
+    const Object* cur = params;
+    for (; Is<Cell>(cur); cur = As<Cell>(cur)->GetSecond()) {
+        IsTypeSyntax<Symbol>(As<Cell>(cur)->GetFirst());
+        scope.locals.push_back(As<Symbol>(As<Cell>(cur)->GetFirst())->GetId());
+    }
+    prototype->arity = static_cast<uint32_t>(scope.locals.size());
+    if (cur != nullptr) {
+        if (!Is<Symbol>(cur)) {
+            throw SyntaxError("SyntaxError");
+        }
+        scope.locals.push_back(static_cast<const Symbol*>(cur)->GetId());
+        prototype->has_rest = true;
+    }
+
+    Scope* enclosing = scope_;
+    scope_ = &scope;
+    Analysis analysis;
+    for (const Object* form = body; Is<Cell>(form); form = As<Cell>(form)->GetSecond()) {
+        Analyze(As<Cell>(form)->GetFirst(), false, &analysis);
+    }
+    for (SymbolId id : analysis.defined) {
+        if (std::find(scope.locals.begin(), scope.locals.end(), id) == scope.locals.end()) {
+            scope.locals.push_back(id);
+        }
+    }
+    prototype->frame_size = static_cast<uint32_t>(scope.locals.size());
+
+    Chunk* enclosing_chunk = chunk_;
+    chunk_ = &prototype->chunk;
+    struct Restore {
+        Compiler* compiler;
+        Scope* scope;
+        Chunk* chunk;
+        ~Restore() {
+            compiler->scope_ = scope;
+            compiler->chunk_ = chunk;
+        }
+    } restore{this, enclosing, enclosing_chunk};
+
+    for (SymbolId id : scope.locals) {
+        bool boxed = analysis.assigned.count(id) > 0 && analysis.used_by_nested.count(id) > 0;
+        scope.boxed_locals.push_back(boxed);
+        if (boxed) {
+            Emit(OpCode::kBox, scope.boxed_locals.size() - 1);
+        }
+    }
+    CompileBody(body);
+    return prototype;
+}
+
+}  // namespace
+
+bool AssumptionsHold(const std::vector<SyntaxAssumption>& assumptions, const Environment& env) {
+    for (const SyntaxAssumption& assumption : assumptions) {
+        auto value = env.Find(assumption.symbol);
+        bool special = value != nullptr && Is<SpecialForm>(*value);
+        if (special != assumption.special || (special && As<SpecialForm>(*value)->GetSyntax() != assumption.syntax)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Compile(Object* form, Environment& env, Chunk* chunk, const CompileOptions& options, CompileStats* stats) {
+    chunk->Clear();
+    Compiler compiler(env, chunk, options, stats);
+    compiler.CompileExpr(form);
+    compiler.Emit(OpCode::kReturn);
+}
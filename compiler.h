@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bytecode.h"
+#include "object.h"
+
+// What the compiler evaluated in advance.
+struct CompileStats {
+    // Calls of pure builtins on constants, computed while compiling.
+    std::size_t folded = 0;
+    // Places in the code those calls were replaced by their value: one per
+    // outermost folded call, however many calls it nests.
+    std::size_t fold_sites = 0;
+    // if/and/or forms with a literal test that lost code they can't reach.
+    std::size_t pruned = 0;
+};
+
+// A global the compiler looked up to tell special forms from calls, and what
+// it found. Code compiled in one environment is right in another as long as
+// each such symbol is bound to a special form of the same syntax there, or
+// isn't a special form in either.
+struct SyntaxAssumption {
+    SymbolId symbol;
+    bool special;
+    Syntax syntax;
+};
+
+bool AssumptionsHold(const std::vector<SyntaxAssumption>& assumptions, const Environment& env);
+
+struct CompileOptions {
+    // Compiling recurses with the nesting of forms: deeper than this always
+    // throws LimitError rather than overflow the native stack, whatever
+    // max_depth says.
+    static constexpr std::size_t kMaxDepth = 10000;
+
+    // Forms nested deeper throw LimitError.
+    std::size_t max_depth = kMaxDepth;
+    // Top-level code usually runs once, when folding only moves the work.
+    bool fold_top_level = false;
+    // Collects the assumptions the code makes, one per symbol, if given.
+    std::vector<SyntaxAssumption>* assumptions = nullptr;
+};
+
+// Replaces the contents of chunk with code that evaluates form. Operators
+// bound to special forms in env at compile time are compiled inline; every
+// other call evaluates its operator and arguments on the stack. Calls of pure
+// builtins on constants are folded into their value (Fold). Adds to *stats,
+// if given.
+void Compile(Object* form, Environment& env, Chunk* chunk, const CompileOptions& options = {},
+             CompileStats* stats = nullptr);
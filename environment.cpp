@@ -0,0 +1,66 @@
+#include "environment.h"
+
+#include "heap.h"
+
+Environment::Environment(Heap* heap)
+    : slots_(kMinCapacity), shift_(32 - 4), heap_(heap), id_(NextId()), layout_(NextId()) {
+    if (heap_ != nullptr) {
+        heap_->Charge(slots_.size() * sizeof(Slot));
+    }
+}
+
+Environment::~Environment() {
+    if (heap_ != nullptr) {
+        heap_->Uncharge(slots_.size() * sizeof(Slot) + cells_.size() * sizeof(Object*));
+    }
+}
+
+// A cell for a new binding: one Clear freed, or else a new one.
+Object** Environment::AddCell() {
+    if (count_ == cells_.size()) {
+        if (heap_ != nullptr) {
+            heap_->Charge(sizeof(Object*));
+        }
+        cells_.push_back(nullptr);
+    }
+    return &cells_[count_++];
+}
+
+void Environment::Reserve(std::size_t count) {
+    while (2 * (count_ + count) > slots_.size()) {
+        Grow();
+    }
+    if (count_ + count > cells_.size()) {
+        std::size_t more = count_ + count - cells_.size();
+        if (heap_ != nullptr) {
+            heap_->Charge(more * sizeof(Object*));
+        }
+        cells_.resize(cells_.size() + more);
+    }
+}
+
+void Environment::Grow() {
+    std::vector<Slot> old(slots_.size() * 2);
+    if (heap_ != nullptr) {
+        heap_->Charge(old.size() * sizeof(Slot));
+    }
+    old.swap(slots_);
+    --shift_;
+    for (const Slot& slot : old) {
+        if (slot.id != kEmpty) {
+            slots_[Probe(slot.id)] = slot;
+        }
+    }
+    if (heap_ != nullptr) {
+        heap_->Uncharge(old.size() * sizeof(Slot));
+    }
+}
+
+void Environment::Clear() {
+    for (Slot& slot : slots_) {
+        slot = Slot{};
+    }
+    count_ = 0;
+    ++version_;
+    layout_ = NextId();
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "symbol_table.h"
+
+class Heap;
+class Object;
+
+// Global bindings, in an open-addressing table keyed by SymbolId, so that an
+// environment takes room for the names it binds rather than for every symbol
+// of the process. Every change goes through Define or Set, which advance the
+// version: code that caches what it found in an environment stays valid while
+// Id and Version are the same.
+//
+// Each binding's value lives in a cell that stays where it is while the table
+// grows, so code may also keep the cell Find returned and read the current
+// value from it for as long as Layout is the same.
+class Environment {
+private:
+    static constexpr SymbolId kEmpty = UINT32_MAX;
+    static constexpr std::size_t kMinCapacity = 16;
+
+    struct Slot {
+        SymbolId id = kEmpty;
+        Object** cell = nullptr;
+    };
+    // A power of two in size, at most half full.
+    std::vector<Slot> slots_;
+    // The first count_ are in use, in the order their bindings were made.
+    std::deque<Object*> cells_;
+    std::size_t count_ = 0;
+    int shift_;
+    Heap* heap_;
+    uint64_t id_;
+    uint64_t version_ = 0;
+    uint64_t layout_;
+
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Where id is, or the empty slot it would go in.
+    std::size_t Probe(SymbolId id) const {
+        std::size_t mask = slots_.size() - 1;
+        std::size_t i = (id * uint32_t{0x9E3779B9}) >> shift_;
+        while (slots_[i].id != id && slots_[i].id != kEmpty) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    void Grow();
+    Object** AddCell();
+public:
+    // The table is counted in the size of heap, if given, and against its
+    // limit: Define throws LimitError when it can't grow.
+    explicit Environment(Heap* heap = nullptr);
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
+    ~Environment();
+
+    // Unique among the environments of the process, never 0.
+    uint64_t Id() const {
+        return id_;
+    }
+    uint64_t Version() const {
+        return version_;
+    }
+    // Unique among the environments of the process like Id, and renewed when
+    // a binding is added or removed: while it is the same, Find gives the
+    // same cells and the same nullptr for names that aren't bound.
+    uint64_t Layout() const {
+        return layout_;
+    }
+
+    Object* const* Find(SymbolId id) const {
+        const Slot& slot = slots_[Probe(id)];
+        return slot.id == id ? slot.cell : nullptr;
+    }
+
+    bool Contains(SymbolId id) const {
+        return slots_[Probe(id)].id == id;
+    }
+
+    void Define(SymbolId id, Object* value) {
+        std::size_t i = Probe(id);
+        if (slots_[i].id != id) {
+            if (2 * (count_ + 1) > slots_.size()) {
+                Grow();
+                i = Probe(id);
+            }
+            slots_[i].cell = AddCell();
+            slots_[i].id = id;
+            layout_ = NextId();
+        }
+        *slots_[i].cell = value;
+        ++version_;
+    }
+
+    // Makes room for count more bindings, so that defining that many new
+    // names doesn't throw. Throws LimitError, binding nothing, if the room
+    // can't be had.
+    void Reserve(std::size_t count);
+
+    // Rebinds id; false if it isn't bound.
+    bool Set(SymbolId id, Object* value) {
+        Slot& slot = slots_[Probe(id)];
+        if (slot.id != id) {
+            return false;
+        }
+        *slot.cell = value;
+        ++version_;
+        return true;
+    }
+
+    template <class F>
+    void ForEach(F&& f) const {
+        for (const Slot& slot : slots_) {
+            if (slot.id != kEmpty) {
+                f(*slot.cell);
+            }
+        }
+    }
+
+    // In no particular order.
+    template <class F>
+    void ForEachBinding(F&& f) const {
+        for (const Slot& slot : slots_) {
+            if (slot.id != kEmpty) {
+                f(slot.id, *slot.cell);
+            }
+        }
+    }
+
+    // Keeps the room the table and the cells took.
+    void Clear();
+};
@@ -12,4 +12,14 @@ struct RuntimeError : public std::runtime_error {
 
 struct NameError : public std::runtime_error {
     using std::runtime_error::runtime_error;
-};
\ No newline at end of file
+};
+
+// A resource limit (Interpreter::SetLimits) was exceeded.
+struct LimitError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// The evaluation was stopped by Interpreter::Cancel.
+struct CancelledError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,155 @@
+#include "heap.h"
+
+#include <algorithm>
+
+#include "error.h"
+#include "object.h"
+
+void Marker::Mark(Object* obj) {
+    if (obj != nullptr && !IsFixnum(obj) && !obj->IsMarked()) {
+        obj->SetMarked(true);
+        pending_.push_back(obj);
+    }
+}
+
+void Marker::Mark(const Chunk& chunk) {
+    for (Object* constant : chunk.constants) {
+        Mark(constant);
+    }
+    for (const auto& prototype : chunk.prototypes) {
+        Mark(*prototype);
+    }
+}
+
+void Marker::Mark(const Prototype& prototype) {
+    if (prototypes_.insert(&prototype).second) {
+        Mark(prototype.chunk);
+    }
+}
+
+void Marker::Mark(const Environment& env) {
+    env.ForEach([this](Object* value) { Mark(value); });
+}
+
+void Marker::Drain() {
+    while (!pending_.empty()) {
+        Object* obj = pending_.back();
+        pending_.pop_back();
+        obj->Trace(*this);
+    }
+}
+
+Heap*& Heap::CurrentSlot() {
+    thread_local Heap* current = nullptr;
+    return current;
+}
+
+Heap& Heap::Current() {
+    if (Heap* heap = CurrentSlot()) {
+        return *heap;
+    }
+    thread_local Heap default_heap;
+    return default_heap;
+}
+
+Heap::~Heap() {
+    while (objects_ != nullptr) {
+        Object* obj = objects_;
+        objects_ = obj->next_;
+        Destroy(obj);
+    }
+}
+
+void* Heap::AllocateSlow(std::size_t size) {
+    if (size > kMaxSmall) {
+        return ::operator new(size);
+    }
+    chunks_.push_back(std::unique_ptr<char[]>(new char[kChunkSize]));
+    ptr_ = chunks_.back().get();
+    end_ = ptr_ + kChunkSize;
+    char* memory = ptr_;
+    ptr_ += size;
+    return memory;
+}
+
+void Heap::Free(void* memory, std::size_t size) {
+    if (size > kMaxSmall) {
+        ::operator delete(memory);
+        return;
+    }
+    auto slot = static_cast<FreeSlot*>(memory);
+    slot->next = free_[size / kAlign - 1];
+    free_[size / kAlign - 1] = slot;
+}
+
+void Heap::Destroy(Object* obj) {
+    std::size_t size = obj->size_;
+    size_ -= size;
+    obj->~Object();
+    Free(obj, size);
+}
+
+void Heap::AddRoots(RootSet* roots) {
+    roots_.push_back(roots);
+}
+
+void Heap::RemoveRoots(RootSet* roots) {
+    roots_.erase(std::find(roots_.begin(), roots_.end(), roots));
+}
+
+void Heap::Collect() {
+    Marker marker;
+    for (RootSet* roots : roots_) {
+        roots->MarkRoots(marker);
+        marker.Drain();
+    }
+    Object** link = &objects_;
+    while (Object* obj = *link) {
+        if (obj->marked_) {
+            obj->marked_ = false;
+            link = &obj->next_;
+        } else {
+            *link = obj->next_;
+            Destroy(obj);
+        }
+    }
+    allocated_before_ += allocated_;
+    allocated_ = 0;
+    threshold_ = std::max(kMinThreshold, size_);
+    UpdateThreshold();
+    ++collections_;
+}
+
+// Under a limit, collects once half the remaining room has been allocated.
+void Heap::UpdateThreshold() {
+    if (limit_ != SIZE_MAX) {
+        threshold_ = std::min(threshold_, (limit_ - std::min(limit_, size_)) / 2);
+    }
+}
+
+void Heap::LimitExceeded() {
+    // The garbage of the failed allocation's computation goes at the next
+    // safepoint.
+    threshold_ = 0;
+    throw LimitError("heap limit exceeded");
+}
+
+void Heap::SetLimit(std::size_t bytes) {
+    limit_ = bytes;
+    threshold_ = std::max(kMinThreshold, size_);
+    UpdateThreshold();
+}
+
+void Heap::ForEachObject(const std::function<void(const Object&, std::size_t)>& f) const {
+    for (const Object* obj = objects_; obj != nullptr; obj = obj->next_) {
+        f(*obj, obj->size_);
+    }
+}
+
+HeapScope::HeapScope(Heap& heap) : previous_(Heap::CurrentSlot()) {
+    Heap::CurrentSlot() = &heap;
+}
+
+HeapScope::~HeapScope() {
+    Heap::CurrentSlot() = previous_;
+}
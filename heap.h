@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+#include "environment.h"
+
+class Object;
+
+// Collects the objects reachable from the roots of a collection. Objects are
+// marked when first reached and traced (Object::Trace) from an explicit
+// stack, so long lists don't recurse.
+class Marker {
+private:
+    std::vector<Object*> pending_;
+    std::unordered_set<const Prototype*> prototypes_;
+public:
+    void Mark(Object* obj);
+    void Mark(const Chunk& chunk);
+    void Mark(const Prototype& prototype);
+    void Mark(const Environment& env);
+    void Drain();
+};
+
+// Holds objects outside the heap; every collection starts from the registered
+// root sets.
+class RootSet {
+public:
+    virtual void MarkRoots(Marker& marker) = 0;
+protected:
+    ~RootSet() = default;
+};
+
+// Owns every object Make<T> creates while it is current. Objects are plain
+// pointers without reference counts; a precise mark-sweep collection frees
+// those not reachable from the root sets, cycles included. Memory comes from
+// 64 KiB chunks, with a free list per object size that the sweep refills.
+//
+// Collections only happen at safepoints (Safepoint, and calls in a VM that was
+// given the heap), where every live object must be reachable from a root set:
+// native code may hold plain pointers anywhere else. Objects made outside any
+// HeapScope go to the thread's default heap, which never collects and is freed
+// when the thread exits.
+class Heap {
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    static constexpr std::size_t kAlign = 8;
+    static constexpr std::size_t kMaxSmall = 256;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* ptr_ = nullptr;
+    char* end_ = nullptr;
+    FreeSlot* free_[kMaxSmall / kAlign] = {};
+    Object* objects_ = nullptr;
+    std::vector<RootSet*> roots_;
+    std::size_t size_ = 0;
+    std::size_t peak_ = 0;
+    std::size_t limit_ = SIZE_MAX;
+    std::size_t allocated_ = 0;
+    std::size_t allocated_before_ = 0;
+    std::size_t threshold_ = kMinThreshold;
+    std::size_t collections_ = 0;
+
+    friend class HeapScope;
+
+    static Heap*& CurrentSlot();
+
+    void* AllocateSlow(std::size_t size);
+    void Free(void* memory, std::size_t size);
+    void Destroy(Object* obj);
+    void UpdateThreshold();
+    [[noreturn]] void LimitExceeded();
+
+    void* Allocate(std::size_t size) {
+        if (size <= kMaxSmall) {
+            FreeSlot*& list = free_[size / kAlign - 1];
+            if (list != nullptr) {
+                FreeSlot* slot = list;
+                list = slot->next;
+                return slot;
+            }
+            if (static_cast<std::size_t>(end_ - ptr_) >= size) {
+                char* memory = ptr_;
+                ptr_ += size;
+                return memory;
+            }
+        }
+        return AllocateSlow(size);
+    }
+public:
+    // Bytes allocated between collections, at least.
+    static constexpr std::size_t kMinThreshold = 1 << 20;
+    static constexpr std::size_t kChunkSize = 64 * 1024;
+
+    Heap() = default;
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+    ~Heap();
+
+    // The heap Make<T> allocates from on this thread.
+    static Heap& Current();
+
+    template <class T, class... Args>
+    T* Make(Args&&... args) {
+        return MakeWithStorage<T>(0, std::forward<Args>(args)...);
+    }
+
+    // Like Make, followed by bytes of storage that belong to the object: it
+    // starts at the first aligned address after it and is counted and freed
+    // along with it.
+    template <class T, class... Args>
+    T* MakeWithStorage(std::size_t bytes, Args&&... args) {
+        static_assert(alignof(T) <= kAlign);
+        constexpr std::size_t header = (sizeof(T) + kAlign - 1) & ~(kAlign - 1);
+        if (bytes > UINT32_MAX - header - kAlign) {
+            throw std::bad_alloc();
+        }
+        std::size_t size = header + ((bytes + kAlign - 1) & ~(kAlign - 1));
+        if (size_ + size > limit_) {
+            LimitExceeded();
+        }
+        void* memory = Allocate(size);
+        T* obj;
+        try {
+            obj = new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Free(memory, size);
+            throw;
+        }
+        obj->size_ = static_cast<uint32_t>(size);
+        obj->next_ = objects_;
+        objects_ = obj;
+        size_ += size;
+        peak_ = std::max(peak_, size_);
+        allocated_ += size;
+        return obj;
+    }
+
+    // Memory its owner holds outside objects on the heap's behalf, counted in
+    // Size and against the limit like objects; Charge throws LimitError
+    // beyond it.
+    void Charge(std::size_t bytes) {
+        if (size_ + bytes > limit_) {
+            LimitExceeded();
+        }
+        size_ += bytes;
+        peak_ = std::max(peak_, size_);
+    }
+    void Uncharge(std::size_t bytes) {
+        size_ -= bytes;
+    }
+
+    void AddRoots(RootSet* roots);
+    void RemoveRoots(RootSet* roots);
+
+    bool ShouldCollect() const {
+        return allocated_ >= threshold_;
+    }
+
+    // Frees everything unreachable from the root sets.
+    void Collect();
+
+    // Collects once enough has been allocated since the last collection.
+    void Safepoint() {
+        if (ShouldCollect()) {
+            Collect();
+        }
+    }
+
+    // Bytes taken by objects, live or not yet collected.
+    std::size_t Size() const {
+        return size_;
+    }
+
+    // The largest Size since the heap was made or ResetPeak.
+    std::size_t Peak() const {
+        return peak_;
+    }
+    void ResetPeak() {
+        peak_ = size_;
+    }
+
+    // Caps Size: an allocation beyond it throws LimitError instead. Garbage
+    // counts until it is collected, so collections come sooner as the heap
+    // approaches the limit. SIZE_MAX for none.
+    void SetLimit(std::size_t bytes);
+    std::size_t Limit() const {
+        return limit_;
+    }
+
+    // Calls f with every object the heap holds, collected or not, and the
+    // bytes it takes.
+    void ForEachObject(const std::function<void(const Object&, std::size_t)>& f) const;
+
+    // Bytes allocated over the heap's lifetime.
+    std::size_t Allocated() const {
+        return allocated_before_ + allocated_;
+    }
+
+    std::size_t Collections() const {
+        return collections_;
+    }
+};
+
+// Makes a heap current on this thread for the lifetime of the scope.
+class HeapScope {
+private:
+    Heap* previous_;
+public:
+    explicit HeapScope(Heap& heap);
+    HeapScope(const HeapScope&) = delete;
+    HeapScope& operator=(const HeapScope&) = delete;
+    ~HeapScope();
+};
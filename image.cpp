@@ -0,0 +1,565 @@
+#include "image.h"
+
+#include <cstring>
+
+#include "error.h"
+#include "object.h"
+
+// An image is the magic, the format and bytecode versions, the key, the
+// symbol names it uses, the number of prototypes, the objects, the prototypes
+// and the body, then a HashBytes of all that. Objects are referred to by
+// index + 1, 0 being the empty list, prototypes and names by index. An object
+// record is its ObjectType followed by:
+//   symbol:     name
+//   number:     int64
+//   big number: decimal string
+//   boolean:    uint8
+//   cell:       first, second
+//   vector:     uint8 boxed, uint32 length, then int64s or objects
+//   box:        contents
+//   builtin:    the name the interpreter bound it to
+//   lambda:     prototype, uint32 count, captured objects
+// Globals in the bytecode (kDefine, kSet, global reads, fold operators) are
+// written as names as well.
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'C', 'M', 'I', 'M', 'A', 'G', 'E'};
+constexpr uint32_t kFormatVersion = 3;
+constexpr std::string_view kBindingsKey = "bindings";
+
+bool RefersToGlobal(OpCode op) {
+    return op == OpCode::kDefine || op == OpCode::kSet;
+}
+
+[[noreturn]] void Invalid() {
+    throw RuntimeError("invalid image");
+}
+
+void PutRaw(std::string& out, const void* data, std::size_t size) {
+    out.append(static_cast<const char*>(data), size);
+}
+
+void PutU8(std::string& out, uint8_t value) {
+    out.push_back(static_cast<char>(value));
+}
+
+void PutU32(std::string& out, uint32_t value) {
+    PutRaw(out, &value, sizeof(value));
+}
+
+void PutI64(std::string& out, int64_t value) {
+    PutRaw(out, &value, sizeof(value));
+}
+
+void PutString(std::string& out, std::string_view str) {
+    PutU32(out, static_cast<uint32_t>(str.size()));
+    out.append(str);
+}
+
+}  // namespace
+
+uint64_t HashBytes(std::string_view bytes) {
+    constexpr uint64_t kMultiplier = 0x9e3779b97f4a7c15;
+    uint64_t hash = bytes.size();
+    std::size_t i = 0;
+    for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + i, sizeof(word));
+        hash = (hash ^ word) * kMultiplier;
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+    hash = (hash ^ tail) * kMultiplier;
+    hash ^= hash >> 29;
+    hash *= kMultiplier;
+    return hash ^ (hash >> 32);
+}
+
+ImageWriter::ImageWriter(const Builtins& builtins) {
+    for (const auto& [id, builtin] : builtins) {
+        builtin_names_.emplace(builtin, id);
+    }
+}
+
+uint32_t ImageWriter::NameIndex(SymbolId id) {
+    auto [it, inserted] = name_index_.emplace(id, static_cast<uint32_t>(names_.size()));
+    if (inserted) {
+        names_.push_back(id);
+    }
+    return it->second;
+}
+
+// Objects and prototypes are numbered as they are reached and written in that
+// order.
+uint32_t ImageWriter::ObjectIndex(Object* obj) {
+    if (obj == nullptr) {
+        return 0;
+    }
+    auto [it, inserted] = object_index_.emplace(obj, static_cast<uint32_t>(objects_.size() + 1));
+    if (inserted) {
+        objects_.push_back(obj);
+    }
+    return it->second;
+}
+
+void ImageWriter::Mark(Marker& marker) const {
+    for (Object* obj : objects_) {
+        marker.Mark(obj);
+    }
+}
+
+uint32_t ImageWriter::PrototypeIndex(const Prototype* prototype) {
+    auto [it, inserted] = prototype_index_.emplace(prototype, static_cast<uint32_t>(prototypes_.size()));
+    if (inserted) {
+        prototypes_.push_back(prototype);
+    }
+    return it->second;
+}
+
+void ImageWriter::WriteObject(Object* obj) {
+    std::string& out = objects_out_;
+    PutU8(out, static_cast<uint8_t>(TypeOf(obj)));
+    switch (TypeOf(obj)) {
+        case ObjectType::kSymbol:
+            PutU32(out, NameIndex(As<Symbol>(obj)->GetId()));
+            break;
+        case ObjectType::kNumber:
+            PutI64(out, Number::ValueOf(obj));
+            break;
+        case ObjectType::kBigNumber:
+            PutString(out, As<BigNumber>(obj)->GetValue().ToString());
+            break;
+        case ObjectType::kBoolean:
+            PutU8(out, As<Boolean>(obj)->GetValue());
+            break;
+        case ObjectType::kCell:
+            PutU32(out, ObjectIndex(As<Cell>(obj)->GetFirst()));
+            PutU32(out, ObjectIndex(As<Cell>(obj)->GetSecond()));
+            break;
+        case ObjectType::kVector: {
+            const Vector* vector = As<Vector>(obj);
+            PutU8(out, vector->IsBoxed());
+            PutU32(out, static_cast<uint32_t>(vector->Length()));
+            if (!vector->IsBoxed()) {
+                PutRaw(out, vector->Fixnums(), vector->Length() * sizeof(int64_t));
+                break;
+            }
+            for (std::size_t i = 0; i < vector->Length(); ++i) {
+                PutU32(out, ObjectIndex(vector->Objects()[i]));
+            }
+            break;
+        }
+        case ObjectType::kBox:
+            PutU32(out, ObjectIndex(As<Box>(obj)->Get()));
+            break;
+        case ObjectType::kSpecialForm:
+        case ObjectType::kProcedure: {
+            auto it = builtin_names_.find(obj);
+            if (it == builtin_names_.end()) {
+                throw RuntimeError("image: builtin of another interpreter");
+            }
+            PutU32(out, NameIndex(it->second));
+            break;
+        }
+        case ObjectType::kLambda: {
+            const Lambda* lambda = As<Lambda>(obj);
+            PutU32(out, PrototypeIndex(lambda->GetPrototype().get()));
+            PutU32(out, static_cast<uint32_t>(lambda->GetCaptured().size()));
+            for (Object* value : lambda->GetCaptured()) {
+                PutU32(out, ObjectIndex(value));
+            }
+            break;
+        }
+    }
+}
+
+void ImageWriter::WritePrototype(const Prototype& prototype) {
+    std::string& out = prototypes_out_;
+    PutString(out, prototype.name);
+    PutU32(out, prototype.arity);
+    PutU8(out, prototype.has_rest);
+    PutU32(out, prototype.frame_size);
+    PutU32(out, static_cast<uint32_t>(prototype.captures.size()));
+    for (const Capture& capture : prototype.captures) {
+        PutU8(out, capture.from_captured);
+        PutU32(out, capture.index);
+    }
+    WriteChunkTo(prototype.chunk, out);
+}
+
+void ImageWriter::WriteChunkTo(const Chunk& chunk, std::string& out) {
+    PutU32(out, static_cast<uint32_t>(chunk.code.size()));
+    for (const Instruction& instruction : chunk.code) {
+        PutU8(out, static_cast<uint8_t>(instruction.op));
+        PutU32(out, RefersToGlobal(instruction.op) ? NameIndex(instruction.arg) : instruction.arg);
+    }
+    PutU32(out, static_cast<uint32_t>(chunk.constants.size()));
+    for (Object* constant : chunk.constants) {
+        PutU32(out, ObjectIndex(constant));
+    }
+    PutU32(out, static_cast<uint32_t>(chunk.prototypes.size()));
+    for (const auto& prototype : chunk.prototypes) {
+        PutU32(out, PrototypeIndex(prototype.get()));
+    }
+    PutU32(out, static_cast<uint32_t>(chunk.folds.size()));
+    for (const Fold& fold : chunk.folds) {
+        PutU32(out, fold.value);
+        PutU32(out, fold.end);
+        PutU32(out, static_cast<uint32_t>(fold.operators.size()));
+        for (const Fold::Operator& op : fold.operators) {
+            PutU32(out, NameIndex(op.symbol));
+            PutU32(out, op.builtin);
+        }
+    }
+    PutU32(out, static_cast<uint32_t>(chunk.globals.size()));
+    for (const GlobalRead& global : chunk.globals) {
+        PutU32(out, NameIndex(global.symbol));
+    }
+}
+
+void ImageWriter::U8(uint8_t value) {
+    PutU8(body_, value);
+}
+
+void ImageWriter::U32(uint32_t value) {
+    PutU32(body_, value);
+}
+
+void ImageWriter::Name(SymbolId id) {
+    PutU32(body_, NameIndex(id));
+}
+
+void ImageWriter::Ref(Object* obj) {
+    PutU32(body_, ObjectIndex(obj));
+}
+
+void ImageWriter::WriteChunk(const Chunk& chunk) {
+    WriteChunkTo(chunk, body_);
+}
+
+void ImageWriter::Flush() {
+    // Writing an object or a prototype may reach more of them.
+    while (objects_written_ < objects_.size() || prototypes_written_ < prototypes_.size()) {
+        if (objects_written_ < objects_.size()) {
+            WriteObject(objects_[objects_written_++]);
+        } else {
+            WritePrototype(*prototypes_[prototypes_written_++]);
+        }
+    }
+}
+
+std::string ImageWriter::Finish(std::string_view key) {
+    Flush();
+    std::string image;
+    PutRaw(image, kMagic, sizeof(kMagic));
+    PutU32(image, kFormatVersion);
+    PutU32(image, kBytecodeVersion);
+    PutString(image, key);
+    PutU32(image, static_cast<uint32_t>(names_.size()));
+    for (SymbolId id : names_) {
+        PutString(image, SymbolTable::Instance().Name(id));
+    }
+    PutU32(image, static_cast<uint32_t>(prototypes_.size()));
+    PutU32(image, static_cast<uint32_t>(objects_.size()));
+    image += objects_out_;
+    image += prototypes_out_;
+    image += body_;
+    uint64_t checksum = HashBytes(image);
+    PutRaw(image, &checksum, sizeof(checksum));
+    return image;
+}
+
+ImageReader::ImageReader(std::string_view image, const Builtins& builtins) {
+    uint64_t checksum;
+    if (image.size() < sizeof(checksum)) {
+        Invalid();
+    }
+    data_ = image.substr(0, image.size() - sizeof(checksum));
+    std::memcpy(&checksum, image.data() + data_.size(), sizeof(checksum));
+    if (HashBytes(data_) != checksum) {
+        Invalid();
+    }
+    if (Bytes(sizeof(kMagic)) != std::string_view(kMagic, sizeof(kMagic)) || U32() != kFormatVersion ||
+        U32() != kBytecodeVersion) {
+        throw RuntimeError("not an image of this build");
+    }
+    key_ = String();
+    for (const auto& [id, builtin] : builtins) {
+        builtins_.emplace(id, builtin);
+    }
+}
+
+std::string_view ImageReader::Bytes(std::size_t size) {
+    if (size > data_.size() - pos_) {
+        Invalid();
+    }
+    std::string_view bytes = data_.substr(pos_, size);
+    pos_ += size;
+    return bytes;
+}
+
+uint8_t ImageReader::U8() {
+    return static_cast<uint8_t>(Bytes(1)[0]);
+}
+
+uint32_t ImageReader::U32() {
+    uint32_t value;
+    std::memcpy(&value, Bytes(sizeof(value)).data(), sizeof(value));
+    return value;
+}
+
+int64_t ImageReader::I64() {
+    int64_t value;
+    std::memcpy(&value, Bytes(sizeof(value)).data(), sizeof(value));
+    return value;
+}
+
+std::string_view ImageReader::String() {
+    return Bytes(U32());
+}
+
+uint32_t ImageReader::Count(std::size_t item_size) {
+    uint32_t count = U32();
+    if (count > (data_.size() - pos_) / item_size) {
+        Invalid();
+    }
+    return count;
+}
+
+SymbolId ImageReader::Name() {
+    uint32_t index = U32();
+    if (index >= names_.size()) {
+        Invalid();
+    }
+    return names_[index];
+}
+
+Object* ImageReader::Ref() {
+    uint32_t index = U32();
+    if (index > objects_.size()) {
+        Invalid();
+    }
+    return index == 0 ? nullptr : objects_[index - 1];
+}
+
+std::shared_ptr<Prototype> ImageReader::PrototypeRef() {
+    uint32_t index = U32();
+    if (index >= prototypes_.size()) {
+        Invalid();
+    }
+    return prototypes_[index];
+}
+
+// Makes an object without its references, which may be to objects further on.
+Object* ImageReader::MakeObject() {
+    auto type = static_cast<ObjectType>(U8());
+    switch (type) {
+        case ObjectType::kSymbol:
+            return Make<Symbol>(Name());
+        case ObjectType::kNumber:
+            return Number::Make(I64());
+        case ObjectType::kBigNumber:
+            return MakeInteger(BigInt::Parse(String()));
+        case ObjectType::kBoolean:
+            return Boolean::From(U8() != 0);
+        case ObjectType::kCell:
+            Bytes(2 * sizeof(uint32_t));
+            return Make<Cell>();
+        case ObjectType::kVector: {
+            bool boxed = U8() != 0;
+            uint32_t length = Count(boxed ? sizeof(uint32_t) : sizeof(int64_t));
+            if (boxed) {
+                Bytes(length * sizeof(uint32_t));
+                return Vector::Make(length, nullptr);
+            }
+            return Vector::MakeFixnums(Bytes(length * sizeof(int64_t)).data(), length);
+        }
+        case ObjectType::kBox:
+            U32();
+            return Make<Box>(nullptr);
+        case ObjectType::kSpecialForm:
+        case ObjectType::kProcedure: {
+            auto it = builtins_.find(Name());
+            if (it == builtins_.end() || it->second->GetType() != type) {
+                Invalid();
+            }
+            return it->second;
+        }
+        case ObjectType::kLambda: {
+            auto prototype = PrototypeRef();
+            uint32_t count = Count(sizeof(uint32_t));
+            Bytes(count * sizeof(uint32_t));
+            return Make<Lambda>(std::move(prototype), std::vector<Object*>(count));
+        }
+    }
+    Invalid();
+}
+
+// Reads the record of obj again, filling in its references.
+void ImageReader::FillObject(Object* obj) {
+    U8();
+    switch (TypeOf(obj)) {
+        case ObjectType::kSymbol:
+        case ObjectType::kSpecialForm:
+        case ObjectType::kProcedure:
+            U32();
+            break;
+        case ObjectType::kNumber:
+            I64();
+            break;
+        case ObjectType::kBigNumber:
+            String();
+            break;
+        case ObjectType::kBoolean:
+            U8();
+            break;
+        case ObjectType::kCell: {
+            Cell* cell = As<Cell>(obj);
+            cell->SetFirst(Ref());
+            cell->SetSecond(Ref());
+            break;
+        }
+        case ObjectType::kVector: {
+            Vector* vector = As<Vector>(obj);
+            U8();
+            U32();
+            if (!vector->IsBoxed()) {
+                Bytes(vector->Length() * sizeof(int64_t));
+                break;
+            }
+            for (std::size_t i = 0; i < vector->Length(); ++i) {
+                vector->Set(i, Ref());
+            }
+            break;
+        }
+        case ObjectType::kBox:
+            As<Box>(obj)->Set(Ref());
+            break;
+        case ObjectType::kLambda: {
+            Lambda* lambda = As<Lambda>(obj);
+            U32();
+            U32();
+            for (std::size_t i = 0; i < lambda->GetCaptured().size(); ++i) {
+                lambda->SetCaptured(i, Ref());
+            }
+            break;
+        }
+    }
+}
+
+void ImageReader::ReadPrototype(Prototype& prototype) {
+    prototype.name = std::string(String());
+    prototype.arity = U32();
+    prototype.has_rest = U8() != 0;
+    prototype.frame_size = U32();
+    uint32_t captures = Count(1 + sizeof(uint32_t));
+    for (uint32_t i = 0; i < captures; ++i) {
+        bool from_captured = U8() != 0;
+        prototype.captures.push_back(Capture{from_captured, U32()});
+    }
+    ReadChunk(prototype.chunk);
+}
+
+void ImageReader::ReadChunk(Chunk& chunk) {
+    uint32_t code = Count(1 + sizeof(uint32_t));
+    chunk.code.reserve(code);
+    for (uint32_t i = 0; i < code; ++i) {
+        uint8_t op = U8();
+        if (op > static_cast<uint8_t>(OpCode::kFolded)) {
+            Invalid();
+        }
+        auto opcode = static_cast<OpCode>(op);
+        chunk.code.push_back(Instruction{opcode, RefersToGlobal(opcode) ? Name() : U32()});
+    }
+    uint32_t constants = Count(sizeof(uint32_t));
+    chunk.constants.reserve(constants);
+    for (uint32_t i = 0; i < constants; ++i) {
+        chunk.constants.push_back(Ref());
+    }
+    uint32_t prototypes = Count(sizeof(uint32_t));
+    for (uint32_t i = 0; i < prototypes; ++i) {
+        chunk.prototypes.push_back(PrototypeRef());
+    }
+    uint32_t folds = Count(3 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < folds; ++i) {
+        Fold fold;
+        fold.value = U32();
+        fold.end = U32();
+        uint32_t operators = Count(2 * sizeof(uint32_t));
+        for (uint32_t j = 0; j < operators; ++j) {
+            SymbolId symbol = Name();
+            fold.operators.push_back(Fold::Operator{symbol, U32()});
+            if (fold.operators.back().builtin >= constants) {
+                Invalid();
+            }
+        }
+        if (fold.value >= constants || fold.end > code) {
+            Invalid();
+        }
+        chunk.folds.push_back(std::move(fold));
+    }
+    uint32_t globals = Count(sizeof(uint32_t));
+    chunk.globals.reserve(globals);
+    for (uint32_t i = 0; i < globals; ++i) {
+        chunk.globals.push_back(GlobalRead{Name()});
+    }
+    for (const Instruction& instruction : chunk.code) {
+        if (instruction.op == OpCode::kGlobal && instruction.arg >= globals) {
+            Invalid();
+        }
+    }
+}
+
+void ImageReader::ReadObjects() {
+    uint32_t names = Count(sizeof(uint32_t));
+    names_.reserve(names);
+    for (uint32_t i = 0; i < names; ++i) {
+        names_.push_back(Intern(String()));
+    }
+    uint32_t prototypes = Count(1);
+    for (uint32_t i = 0; i < prototypes; ++i) {
+        prototypes_.push_back(std::make_shared<Prototype>());
+    }
+    uint32_t objects = Count(2);
+    std::size_t start = pos_;
+    objects_.reserve(objects);
+    for (uint32_t i = 0; i < objects; ++i) {
+        objects_.push_back(MakeObject());
+    }
+    pos_ = start;
+    for (Object* obj : objects_) {
+        FillObject(obj);
+    }
+    for (const auto& prototype : prototypes_) {
+        ReadPrototype(*prototype);
+    }
+}
+
+std::string WriteImage(const Environment& env, const Builtins& builtins) {
+    ImageWriter image(builtins);
+    env.ForEachBinding([&](SymbolId id, Object* value) {
+        image.Name(id);
+        image.Ref(value);
+    });
+    return image.Finish(kBindingsKey);
+}
+
+void ReadImage(std::string_view image, Environment& env, const Builtins& builtins) {
+    ImageReader reader(image, builtins);
+    if (reader.Key() != kBindingsKey) {
+        Invalid();
+    }
+    reader.ReadObjects();
+    std::vector<std::pair<SymbolId, Object*>> bindings;
+    while (!reader.AtEnd()) {
+        SymbolId id = reader.Name();
+        bindings.emplace_back(id, reader.Ref());
+    }
+    // All of them or none.
+    env.Reserve(bindings.size());
+    for (const auto& [id, value] : bindings) {
+        env.Define(id, value);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+#include "environment.h"
+
+class Marker;
+class Object;
+
+// The builtin objects of an interpreter with the names it bound them to.
+// Images refer to builtins by those names, since they are made anew by every
+// interpreter.
+using Builtins = std::vector<std::pair<SymbolId, Object*>>;
+
+// Binary images of objects and compiled code: data, closures and the bytecode
+// of their prototypes. Objects are written once each, referred to by index,
+// so sharing and cycles survive; symbols and the globals in bytecode go by
+// name. An image starts with a key saying what it was made from and ends with
+// a body of records whose layout is up to the writer, referring to the
+// objects, and a checksum. Integers are in the byte order of the machine and
+// bytecode is of one kBytecodeVersion, so an image is for the build that
+// wrote it.
+class ImageWriter {
+private:
+    std::unordered_map<const Object*, SymbolId> builtin_names_;
+    std::vector<SymbolId> names_;
+    std::unordered_map<SymbolId, uint32_t> name_index_;
+    std::vector<Object*> objects_;
+    std::unordered_map<const Object*, uint32_t> object_index_;
+    std::vector<const Prototype*> prototypes_;
+    std::unordered_map<const Prototype*, uint32_t> prototype_index_;
+    std::size_t objects_written_ = 0;
+    std::size_t prototypes_written_ = 0;
+    std::string objects_out_;
+    std::string prototypes_out_;
+    std::string body_;
+
+    uint32_t NameIndex(SymbolId id);
+    uint32_t ObjectIndex(Object* obj);
+    uint32_t PrototypeIndex(const Prototype* prototype);
+    void WriteObject(Object* obj);
+    void WritePrototype(const Prototype& prototype);
+    void WriteChunkTo(const Chunk& chunk, std::string& out);
+public:
+    explicit ImageWriter(const Builtins& builtins);
+
+    // Append to the body.
+    void U8(uint8_t value);
+    void U32(uint32_t value);
+    void Name(SymbolId id);
+    void Ref(Object* obj);
+    void WriteChunk(const Chunk& chunk);
+
+    // Writes the objects and code referred to so far as they are now: later
+    // changes to them aren't saved.
+    void Flush();
+
+    std::string Finish(std::string_view key);
+
+    // Marks the objects referred to so far.
+    void Mark(Marker& marker) const;
+};
+
+class ImageReader {
+private:
+    std::string_view data_;
+    std::size_t pos_ = 0;
+    std::string_view key_;
+    std::unordered_map<SymbolId, Object*> builtins_;
+    std::vector<SymbolId> names_;
+    std::vector<std::shared_ptr<Prototype>> prototypes_;
+    std::vector<Object*> objects_;
+
+    std::string_view Bytes(std::size_t size);
+    int64_t I64();
+    std::string_view String();
+    std::shared_ptr<Prototype> PrototypeRef();
+    Object* MakeObject();
+    void FillObject(Object* obj);
+    void ReadPrototype(Prototype& prototype);
+public:
+    // Checks the checksum and reads the header. Throws RuntimeError if image
+    // isn't an intact image of this build, and whenever it turns out malformed
+    // later on.
+    ImageReader(std::string_view image, const Builtins& builtins);
+
+    std::string_view Key() const {
+        return key_;
+    }
+
+    // Makes the objects of the image in the current heap. Until what the body
+    // refers to is rooted, nothing may collect the heap. Only the layout of
+    // the image is checked, not the bytecode in it.
+    void ReadObjects();
+
+    // Read the body, after ReadObjects.
+    bool AtEnd() const {
+        return pos_ == data_.size();
+    }
+    uint8_t U8();
+    uint32_t U32();
+    // A count of items that take at least item_size bytes each, so that a
+    // malformed count can't make the reader allocate more than the image.
+    uint32_t Count(std::size_t item_size);
+    SymbolId Name();
+    Object* Ref();
+    void ReadChunk(Chunk& chunk);
+};
+
+// A 64-bit hash, eight bytes at a time; only meant to notice changes.
+uint64_t HashBytes(std::string_view bytes);
+
+// Returns the image of every binding in env.
+std::string WriteImage(const Environment& env, const Builtins& builtins);
+
+// Makes the objects of an image that WriteImage returned in the current heap
+// and binds its globals in env, replacing bindings of the same names. Nothing
+// is bound if the image turns out malformed or the heap limit is reached.
+void ReadImage(std::string_view image, Environment& env, const Builtins& builtins);
@@ -0,0 +1,86 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// 128 bits: the SIMD width every x86-64 and AArch64 target has.
+constexpr std::size_t kLanes = 2;
+
+using Lanes = uint64_t __attribute__((vector_size(kLanes * sizeof(uint64_t))));
+
+// Keeps one independent maximum (or minimum) per lane rather than a vector
+// select: 64-bit vector compares are missing from baseline x86-64, where the
+// selects get emulated one element at a time, while the optimizer turns these
+// lanes into packed compares wherever the target has them.
+template <bool kMax>
+int64_t Extreme(const int64_t* values, std::size_t count) {
+    constexpr std::size_t kAccumulators = 2 * kLanes;
+    int64_t best[kAccumulators];
+    std::fill_n(best, kAccumulators, values[0]);
+    std::size_t i = 0;
+    for (; i + kAccumulators <= count; i += kAccumulators) {
+        for (std::size_t lane = 0; lane < kAccumulators; ++lane) {
+            best[lane] = kMax ? std::max(best[lane], values[i + lane]) : std::min(best[lane], values[i + lane]);
+        }
+    }
+    int64_t result = best[0];
+    for (int64_t value : best) {
+        result = kMax ? std::max(result, value) : std::min(result, value);
+    }
+    for (; i < count; ++i) {
+        result = kMax ? std::max(result, values[i]) : std::min(result, values[i]);
+    }
+    return result;
+}
+
+}  // namespace
+
+// Adding 2^63 to every value makes it unsigned. The high and low 32-bit
+// halves are summed in separate 64-bit lanes, which can't overflow for fewer
+// than 2^32 values, so the exact sum is high * 2^32 + low - count * 2^63 and
+// no per-element overflow check is needed.
+bool SumFixnums(const int64_t* values, std::size_t count, int64_t* sum, BigInt* big) {
+    constexpr uint64_t kBias = uint64_t{1} << 63;
+    constexpr uint64_t kLowMask = 0xffffffff;
+    Lanes high_lanes = {};
+    Lanes low_lanes = {};
+    std::size_t i = 0;
+    for (; i + kLanes <= count; i += kLanes) {
+        Lanes lanes;
+        std::memcpy(&lanes, values + i, sizeof(lanes));
+        lanes ^= kBias;
+        high_lanes += lanes >> 32;
+        low_lanes += lanes & kLowMask;
+    }
+    uint64_t high = 0;
+    uint64_t low = 0;
+    for (std::size_t lane = 0; lane < kLanes; ++lane) {
+        high += high_lanes[lane];
+        low += low_lanes[lane];
+    }
+    for (; i < count; ++i) {
+        uint64_t value = static_cast<uint64_t>(values[i]) ^ kBias;
+        high += value >> 32;
+        low += value & kLowMask;
+    }
+    high += low >> 32;
+    low &= kLowMask;
+    // The sum is top * 2^32 + low with 0 <= low < 2^32.
+    auto top = static_cast<int64_t>(high - (static_cast<uint64_t>(count) << 31));
+    if (top >= INT32_MIN && top <= INT32_MAX) {
+        *sum = static_cast<int64_t>((static_cast<uint64_t>(top) << 32) | low);
+        return true;
+    }
+    *big = BigInt(top) * BigInt(int64_t{1} << 32) + BigInt(static_cast<int64_t>(low));
+    return false;
+}
+
+int64_t MaxFixnum(const int64_t* values, std::size_t count) {
+    return Extreme<true>(values, count);
+}
+
+int64_t MinFixnum(const int64_t* values, std::size_t count) {
+    return Extreme<false>(values, count);
+}
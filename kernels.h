@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bignum.h"
+
+// Bulk operations over unboxed fixnum arrays (the storage of Vector), written
+// to run several values per instruction: with the compiler's portable vector
+// types, or as independent lanes the optimizer vectorizes. Every count must be
+// below 2^32.
+
+// Sums values exactly. Returns true with the result in *sum if it fits in 64
+// bits, false with it in *big otherwise.
+bool SumFixnums(const int64_t* values, std::size_t count, int64_t* sum, BigInt* big);
+
+// The largest and the smallest of count > 0 values.
+int64_t MaxFixnum(const int64_t* values, std::size_t count);
+int64_t MinFixnum(const int64_t* values, std::size_t count);
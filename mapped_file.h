@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file, for tokenizing large scripts
+// without copying them. Throws RuntimeError if the file cannot be opened.
+class MappedFile {
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    std::string_view View() const {
+        return std::string_view(data_, size_);
+    }
+};
@@ -1,192 +1,356 @@
 #include "object.h"
 
-std::string StringFromCell(std::shared_ptr<Object> obj) {
-    if (obj == nullptr) {
-        return "( ";
-    }
-    std::string s;
-    if (As<Cell>(obj)->GetFirst() != nullptr) {
-        if (!Is<Cell>(As<Cell>(obj)->GetFirst())) {
-            s += As<Symbol>(MakeSymbol(As<Cell>(obj)->GetFirst()))->GetName();
-        } else {
-            s += "(";
-            s += StringFromCell(As<Cell>(obj)->GetFirst());
-            s[s.size() - 1] = ')';
-        }
-        s += " ";
-    } else {
-        s += "() ";
-    }
-    if (As<Cell>(obj)->GetSecond() != nullptr) {
-        if (!Is<Cell>(As<Cell>(obj)->GetSecond())) {
-            s += ". ";
-            s += As<Symbol>(MakeSymbol(As<Cell>(obj)->GetSecond()))->GetName();
-            s += " ";
-        } else {
-            s += StringFromCell(As<Cell>(obj)->GetSecond());
-        }
+#include <algorithm>
+#include <cstring>
 
-    }
-    return s;
+#include "kernels.h"
+
+namespace {
+
+// Immortal objects stay marked, so collections never trace or free them.
+Object* Immortal(Object* obj) {
+    obj->SetMarked(true);
+    return obj;
 }
 
-std::shared_ptr<Object> MakeSymbol(std::shared_ptr<Object> obj) {
-    if (Is<Number>(obj)) {
-        return std::shared_ptr<Symbol>(new Symbol(std::to_string(As<Number>(obj)->GetValue())));
+}  // namespace
+
+const char* TypeName(ObjectType type) {
+    switch (type) {
+        case ObjectType::kSymbol:
+            return "symbol";
+        case ObjectType::kNumber:
+            return "number";
+        case ObjectType::kBigNumber:
+            return "bignum";
+        case ObjectType::kBoolean:
+            return "boolean";
+        case ObjectType::kCell:
+            return "cell";
+        case ObjectType::kVector:
+            return "vector";
+        case ObjectType::kBox:
+            return "box";
+        case ObjectType::kSpecialForm:
+            return "special-form";
+        case ObjectType::kProcedure:
+            return "procedure";
+        case ObjectType::kLambda:
+            return "lambda";
     }
-    if (Is<Boolean>(obj)) {
-        return std::shared_ptr<Symbol>(
-            new Symbol(As<Boolean>(obj)->GetValue()));
+    return "object";
+}
+
+Object* Boolean::True() {
+    static Object* const value = Immortal(new Boolean(true));
+    return value;
+}
+
+Object* Boolean::False() {
+    static Object* const value = Immortal(new Boolean(false));
+    return value;
+}
+
+Object* MakeInteger(const BigInt& value) {
+    int64_t fixnum;
+    if (value.ToInt64(&fixnum)) {
+        return Number::Make(fixnum);
     }
-    return obj;
+    return Make<BigNumber>(value);
 }
 
-std::shared_ptr<Object> MakeCell(std::shared_ptr<Object> first, std::shared_ptr<Object> second) {
-    return std::shared_ptr<Cell>(new Cell(first, second));
+BigInt ToBigInt(const Object* number) {
+    if (Is<Number>(number)) {
+        return BigInt(Number::ValueOf(number));
+    }
+    return As<BigNumber>(number)->GetValue();
 }
 
-void CallOnEmpty(std::shared_ptr<Object> obj) {
-    if (obj == nullptr) {
-        throw RuntimeError("RuntimeError");
+Object* BigSum(Args args) {
+    AreTypesCorrect<Numeric>(args);
+    BigInt res;
+    for (Object* arg : args) {
+        res = res + ToBigInt(arg);
     }
+    return MakeInteger(res);
 }
 
-int TreeLength(std::shared_ptr<Object> obj) {
-    if (!Is<Cell>(obj) || obj == nullptr) {
-        return (obj == nullptr) ? 0 : 1;
+Object* BigProduct(Args args) {
+    AreTypesCorrect<Numeric>(args);
+    BigInt res(1);
+    for (Object* arg : args) {
+        res = res * ToBigInt(arg);
     }
-    return 1 + TreeLength(As<Cell>(obj)->GetSecond());
+    return MakeInteger(res);
 }
 
-std::shared_ptr<Object> LastInTree(std::shared_ptr<Object> obj) {
-    if (!Is<Cell>(obj) || obj == nullptr) {
-        return obj;
+Object* BigDifference(Args args) {
+    AreTypesCorrect<Numeric>(args);
+    BigInt res = ToBigInt(args[0]);
+    for (std::size_t i = 1; i < args.size(); ++i) {
+        res = res - ToBigInt(args[i]);
     }
-    return LastInTree(As<Cell>(obj)->GetSecond());
+    return MakeInteger(res);
 }
 
-std::shared_ptr<Object> LastInTreeNonNull(std::shared_ptr<Object> obj) {
-    if (Is<Cell>(obj) && As<Cell>(obj)->GetSecond() == nullptr) {
-        return As<Cell>(obj)->GetFirst();
+Object* BigQuotient(Args args) {
+    AreTypesCorrect<Numeric>(args);
+    BigInt res = ToBigInt(args[0]);
+    for (std::size_t i = 1; i < args.size(); ++i) {
+        BigInt divisor = ToBigInt(args[i]);
+        if (divisor.IsZero()) {
+            throw RuntimeError("RuntimeError");
+        }
+        res = res / divisor;
     }
-    return LastInTreeNonNull(As<Cell>(obj)->GetSecond());
+    return MakeInteger(res);
 }
 
-std::shared_ptr<Object> PosInTree(std::shared_ptr<Object> obj, int pos) {
-    if (pos >= 0 && obj == nullptr) {
+Vector* Vector::Make(std::size_t length, Object* fill) {
+    if (length > kMaxLength) {
         throw RuntimeError("RuntimeError");
     }
-    if (pos == 0) {
-        return As<Cell>(obj)->GetFirst();
+    Vector* vector = Heap::Current().MakeWithStorage<Vector>(length * sizeof(int64_t), length);
+    if (Is<Number>(fill)) {
+        std::fill_n(vector->MutableFixnums(), length, Number::ValueOf(fill));
+    } else {
+        vector->boxed_ = true;
+        std::fill_n(vector->MutableObjects(), length, fill);
     }
-    return PosInTree(As<Cell>(obj)->GetSecond(), pos - 1);
+    return vector;
 }
 
-std::shared_ptr<Object> AfterPosInTree(std::shared_ptr<Object> obj, int pos) {
-    if (pos == 0) {
-        return obj;
+Vector* Vector::Make(Args elements) {
+    if (elements.size() > kMaxLength) {
+        throw RuntimeError("RuntimeError");
+    }
+    Vector* vector = Heap::Current().MakeWithStorage<Vector>(elements.size() * sizeof(int64_t), elements.size());
+    vector->boxed_ = !std::all_of(elements.begin(), elements.end(), Is<Number>);
+    if (vector->boxed_) {
+        std::copy(elements.begin(), elements.end(), vector->MutableObjects());
+        return vector;
     }
-    if (pos > 0 && obj == nullptr) {
+    for (std::size_t i = 0; i < elements.size(); ++i) {
+        vector->MutableFixnums()[i] = Number::ValueOf(elements[i]);
+    }
+    return vector;
+}
+
+Vector* Vector::MakeFixnums(const void* values, std::size_t length) {
+    if (length > kMaxLength) {
         throw RuntimeError("RuntimeError");
     }
-    return AfterPosInTree(As<Cell>(obj)->GetSecond(), pos - 1);
+    Vector* vector = Heap::Current().MakeWithStorage<Vector>(length * sizeof(int64_t), length);
+    std::memcpy(vector->MutableFixnums(), values, length * sizeof(int64_t));
+    return vector;
 }
 
-std::shared_ptr<Object> UnbindFunc(std::shared_ptr<Object> obj) {
-    if (Is<Symbol>(obj)) {
-        if (m.find(As<Symbol>(obj)->GetName()) != m.end()) {
-            return m[As<Symbol>(obj)->GetName()];
+void Vector::BoxElements() {
+    for (std::size_t i = 0; i < length_; ++i) {
+        MutableObjects()[i] = Number::Make(MutableFixnums()[i]);
+    }
+    boxed_ = true;
+}
+
+void Vector::Set(std::size_t index, Object* value) {
+    if (!boxed_) {
+        if (Is<Number>(value)) {
+            MutableFixnums()[index] = Number::ValueOf(value);
+            return;
         }
-        throw NameError("NameError");
+        BoxElements();
     }
-    if (!Is<Cell>(obj)) {
-        return obj;
+    MutableObjects()[index] = value;
+}
+
+std::size_t VectorIndex(const Vector* vector, const Object* index) {
+    IsType<Number>(index);
+    int64_t value = Number::ValueOf(index);
+    if (value < 0 || static_cast<uint64_t>(value) >= vector->Length()) {
+        throw RuntimeError("RuntimeError");
     }
-    IsType<Cell>(obj);
-    CallOnEmpty(As<Cell>(obj)->GetFirst());
-    auto func = As<Cell>(obj)->GetFirst()->Eval();
-    IsType<Function>(func);
-    return As<Function>(func)->Apply(As<Cell>(obj)->GetSecond());
+    return value;
 }
 
-void UnbindList(std::vector<std::shared_ptr<Object>>& objects,
-                std::shared_ptr<Object> obj) {
-    if (obj == nullptr) {
-        return;
+Object* VectorSum::Call(Args args) {
+    CompareSzEq(1, args.size());
+    const Vector* vector = As<Vector>(args[0]);
+    if (vector->IsBoxed()) {
+        return BigSum(Args(vector->Objects(), vector->Length()));
     }
-    if (!Is<Cell>(obj)) {
-        objects.push_back(obj);
-        return;
+    int64_t sum;
+    BigInt big;
+    if (SumFixnums(vector->Fixnums(), vector->Length(), &sum, &big)) {
+        return Number::Make(sum);
     }
-    if (!Is<Cell>(As<Cell>(obj)->GetFirst())) {
-        std::cout << 3000 << std::endl;
-        objects.push_back(As<Cell>(obj)->GetFirst());
-    } else {
-        std::cout << 2000 << std::endl;
-        auto func = As<Cell>(As<Cell>(obj)->GetFirst())->GetFirst()->Eval();
-        if (Is<Function>(func)) {
-            std::cout << 1000 << std::endl;
-            objects.push_back(UnbindFunc(As<Cell>(obj)->GetFirst()));
-        } else {
-            UnbindList(objects, As<Cell>(obj)->GetFirst());
+    return MakeInteger(big);
+}
+
+namespace {
+
+// Max or min of a non-empty vector; sign is 1 for max and -1 for min.
+Object* VectorExtreme(Args args, int sign) {
+    CompareSzEq(1, args.size());
+    const Vector* vector = As<Vector>(args[0]);
+    CompareSzNeq(0, vector->Length());
+    if (!vector->IsBoxed()) {
+        const int64_t* values = vector->Fixnums();
+        return Number::Make(sign > 0 ? MaxFixnum(values, vector->Length()) : MinFixnum(values, vector->Length()));
+    }
+    Args elements(vector->Objects(), vector->Length());
+    AreTypesCorrect<Numeric>(elements);
+    Object* res = elements[0];
+    for (Object* element : elements) {
+        if (CompareNumbers(element, res) * sign > 0) {
+            res = element;
         }
     }
-    UnbindList(objects, As<Cell>(obj)->GetSecond());
+    return res;
+}
+
+}  // namespace
+
+Object* VectorMax::Call(Args args) {
+    return VectorExtreme(args, 1);
+}
+
+Object* VectorMin::Call(Args args) {
+    return VectorExtreme(args, -1);
 }
 
-std::shared_ptr<Object> UnbindForBoolean(std::shared_ptr<Object> obj, std::shared_ptr<Boolean> value) {
-    auto first = (Is<Cell>(As<Cell>(obj)->GetFirst())) ? UnbindFunc(As<Cell>(obj)->GetFirst()) : As<Cell>(obj)->GetFirst();
-    if (Is<Boolean>(first) && As<Boolean>(first)->GetValue() == value->GetValue()) {
-        return std::shared_ptr<Boolean>(new Boolean(value->GetValue()));
+namespace {
+
+// What vector-map and vector-fold hold across their calls, which may collect
+// (CallWithRoots).
+struct BulkRoots : private RootSet {
+    Object* procedure;
+    Object* vector;
+    Object* result;
+
+    BulkRoots(Object* procedure, Object* vector, Object* result)
+        : procedure(procedure), vector(vector), result(result) {
+        Heap::Current().AddRoots(this);
     }
-    if (As<Cell>(obj)->GetSecond() == nullptr) {
-        return first;
+    BulkRoots(const BulkRoots&) = delete;
+    BulkRoots& operator=(const BulkRoots&) = delete;
+    ~BulkRoots() {
+        Heap::Current().RemoveRoots(this);
     }
-    if (!Is<Cell>(As<Cell>(obj)->GetSecond())) {
-        return As<Cell>(obj)->GetSecond();
+    void MarkRoots(Marker& marker) override {
+        marker.Mark(procedure);
+        marker.Mark(vector);
+        marker.Mark(result);
     }
-    if (Is<Function>(As<Cell>(As<Cell>(obj)->GetSecond())->GetFirst())) {
-        return UnbindFunc(As<Cell>(obj));
+};
+
+}  // namespace
+
+// Calling a lambda may grow the VM stack that args points into, so neither
+// reads args after the first call.
+Object* VectorMap::Call(Args args) {
+    CompareSzEq(2, args.size());
+    IsType<Procedure>(args[0]);
+    const Vector* vector = As<Vector>(args[1]);
+    Vector* result = Vector::Make(vector->Length(), Number::Make(0));
+    BulkRoots roots(args[0], args[1], result);
+    for (std::size_t i = 0; i < vector->Length(); ++i) {
+        Object* element = vector->Get(i);
+        result->Set(i, CallWithRoots(roots.procedure, Args(&element, 1)));
     }
-    return UnbindForBoolean(As<Cell>(obj)->GetSecond(), value);
+    return result;
 }
 
-void CompareSzEq(std::size_t true_sz, std::size_t given_sz) {
-    if (true_sz != given_sz) {
-        throw RuntimeError("RuntimeError");
+Object* VectorFold::Call(Args args) {
+    CompareSzEq(3, args.size());
+    IsType<Procedure>(args[0]);
+    const Vector* vector = As<Vector>(args[2]);
+    BulkRoots roots(args[0], args[2], args[1]);
+    for (std::size_t i = 0; i < vector->Length(); ++i) {
+        Object* call[] = {roots.result, vector->Get(i)};
+        roots.result = CallWithRoots(roots.procedure, Args(call, 2));
     }
+    return roots.result;
 }
 
-void CompareSzNeq(std::size_t true_sz, std::size_t given_sz) {
-    if (true_sz == given_sz) {
+Object* MakeCell(Object* first, Object* second) {
+    return Make<Cell>(first, second);
+}
+
+void CallOnEmpty(Object* obj) {
+    if (obj == nullptr) {
         throw RuntimeError("RuntimeError");
     }
 }
-/*
-void AddValuesToParams(std::map<std::string, std::shared_ptr<Object>>& vars, std::vector<std::string>& names,
-                       std::vector<std::shared_ptr<Object>>& objects) {
-    CompareSzEq(names.size(), objects.size());
-    AreTypesCorrect<Number>(objects);
-    for (size_t i = 0; i < objects.size(); ++i) {
-        vars[names[i]] = std::shared_ptr<Number>(new Number(As<Number>(objects[i])->GetValue()));
+
+int TreeLength(Object* obj) {
+    int length = 0;
+    const Object* cur = obj;
+    while (Is<Cell>(cur)) {
+        ++length;
+        cur = As<Cell>(cur)->GetSecond();
     }
+    return (cur == nullptr) ? length : length + 1;
 }
 
-std::shared_ptr<Object> SearchInAncestors(std::string s, std::shared_ptr<Object> env) {
+Object* LastInTree(Object* obj) {
+    Object* cur = obj;
+    while (Is<Cell>(cur)) {
+        cur = As<Cell>(cur)->GetSecond();
+    }
+    return cur;
+}
 
+Object* LastInTreeNonNull(Object* obj) {
+    Object* cur = obj;
+    while (!Is<Cell>(cur) || As<Cell>(cur)->GetSecond() != nullptr) {
+        cur = As<Cell>(cur)->GetSecond();
+    }
+    return As<Cell>(cur)->GetFirst();
 }
 
-void SetParams(std::shared_ptr<Object> env, std::shared_ptr<Object> obj) {
-    if (obj == nullptr) {
-        return;
+Object* PosInTree(Object* obj, int64_t pos) {
+    Object* cur = obj;
+    while (true) {
+        if (pos >= 0 && cur == nullptr) {
+            throw RuntimeError("RuntimeError");
+        }
+        if (pos == 0) {
+            return As<Cell>(cur)->GetFirst();
+        }
+        cur = As<Cell>(cur)->GetSecond();
+        --pos;
+    }
+}
+
+Object* AfterPosInTree(Object* obj, int64_t pos) {
+    Object* cur = obj;
+    while (pos != 0) {
+        if (pos > 0 && cur == nullptr) {
+            throw RuntimeError("RuntimeError");
+        }
+        cur = As<Cell>(cur)->GetSecond();
+        --pos;
     }
-    IsType<Cell>(obj);
-    auto cur_param = As<Cell>(obj)->GetFirst();
-    if (Is<Cell>(cur_param)) {
-        IsType<Symbol>(As<Cell>(cur_param)->GetFirst());
-        auto func = SearchInAncestors(As<Symbol>(obj)->GetName(), As<Lambda>(obj)->parent);
-        IsType<Function>(func);
-        As<Function>(func)->Apply()
+    return cur;
+}
+
+SymbolId BindingTarget(Object* obj) {
+    if (TreeLength(obj) != 2 || LastInTree(obj) != nullptr) {
+        throw SyntaxError("SyntaxError");
+    }
+    Object* name = As<Cell>(obj)->GetFirst();
+    IsTypeSyntax<Symbol>(name);
+    return As<Symbol>(name)->GetId();
+}
+
+void CompareSzEq(std::size_t true_sz, std::size_t given_sz) {
+    if (true_sz != given_sz) {
+        throw RuntimeError("RuntimeError");
     }
-};*/
+}
 
+void CompareSzNeq(std::size_t true_sz, std::size_t given_sz) {
+    if (true_sz == given_sz) {
+        throw RuntimeError("RuntimeError");
+    }
+}
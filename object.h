@@ -2,645 +2,914 @@
 
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
+#include "bignum.h"
 #include "error.h"
 #include "tokenizer.h"
-#include <map>
-#include <iostream>
-#include <sstream>
+#include "environment.h"
+#include "heap.h"
+#include "bytecode.h"
+
+enum class ObjectType : uint8_t {
+    kSymbol,
+    kNumber,
+    kBigNumber,
+    kBoolean,
+    kCell,
+    kVector,
+    kBox,
+    kSpecialForm,
+    kProcedure,
+    kLambda,
+};
+
+// How a type is named in reports, e.g. "cell".
+const char* TypeName(ObjectType type);
+
+// Objects live in a Heap (heap.h) and are passed around as plain pointers.
+class Object {
+private:
+    Object* next_ = nullptr;
+    uint32_t size_ = 0;
+    ObjectType type_;
+    bool marked_ = false;
 
-class Object : public std::enable_shared_from_this<Object> {
+    friend class Heap;
 public:
-    virtual std::shared_ptr<Object> Eval() = 0;
+    explicit Object(ObjectType type) : type_(type) {
+    }
+    ObjectType GetType() const {
+        return type_;
+    }
+    bool IsMarked() const {
+        return marked_;
+    }
+    void SetMarked(bool marked) {
+        marked_ = marked;
+    }
+    // Marks the objects this one refers to.
+    virtual void Trace(Marker&) {
+    }
     virtual ~Object() = default;
 };
 
-extern std::map<std::string, std::shared_ptr<Object>> m;
+// Allocates in the current heap.
+template <class T, class... Args>
+T* Make(Args&&... args) {
+    return Heap::Current().Make<T>(std::forward<Args>(args)...);
+}
 
-std::string StringFromCell(std::shared_ptr<Object> obj);
-std::shared_ptr<Object> MakeSymbol(std::shared_ptr<Object> obj);
-std::shared_ptr<Object> MakeCell(std::shared_ptr<Object> first, std::shared_ptr<Object> second);
-void CallOnEmpty(std::shared_ptr<Object> obj);
-int TreeLength(std::shared_ptr<Object> obj);
-std::shared_ptr<Object> LastInTree(std::shared_ptr<Object> obj);
-std::shared_ptr<Object> LastInTreeNonNull(std::shared_ptr<Object> obj);
-std::shared_ptr<Object> PosInTree(std::shared_ptr<Object> obj, int pos);
-std::shared_ptr<Object> AfterPosInTree(std::shared_ptr<Object> obj, int pos);
-std::shared_ptr<Object> UnbindFunc(std::shared_ptr<Object> obj);
-void UnbindList(std::vector<std::shared_ptr<Object>>& objects, std::shared_ptr<Object> obj);
+Object* MakeCell(Object* first, Object* second);
+void CallOnEmpty(Object* obj);
+int TreeLength(Object* obj);
+Object* LastInTree(Object* obj);
+Object* LastInTreeNonNull(Object* obj);
+Object* PosInTree(Object* obj, int64_t pos);
+Object* AfterPosInTree(Object* obj, int64_t pos);
 void CompareSzEq(std::size_t true_sz, std::size_t given_sz);
 void CompareSzNeq(std::size_t true_sz, std::size_t given_sz);
 
+class Number;
+
+// Integers that fit in 63 bits are not allocated: the pointer holds the value
+// shifted left by one with the low bit set, which heap objects, being 8-byte
+// aligned, never have. TypeOf is the type of any value, fixnums included.
+inline bool IsFixnum(const Object* obj) {
+    return (reinterpret_cast<uintptr_t>(obj) & 1) != 0;
+}
+
+inline ObjectType TypeOf(const Object* obj) {
+    return IsFixnum(obj) ? ObjectType::kNumber : obj->GetType();
+}
+
 template <class T>
-std::shared_ptr<T> As(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj);
+bool Is(const Object* obj) {
+    return obj != nullptr && T::Matches(TypeOf(obj));
 }
 
+// Not for Number, which may not be an object at all: use Number::ValueOf.
 template <class T>
-bool Is(const std::shared_ptr<Object>& obj) {
-    return dynamic_cast<T*>(obj.get()) != nullptr;
+const T* As(const Object* obj) {
+    static_assert(!std::is_same_v<T, Number>);
+    if (!Is<T>(obj)) {
+        throw RuntimeError("RuntimeError");
+    }
+    return static_cast<const T*>(obj);
 }
 
 template <class T>
-void IsType(const std::shared_ptr<Object>& obj) {
+T* As(Object* obj) {
+    static_assert(!std::is_same_v<T, Number>);
     if (!Is<T>(obj)) {
         throw RuntimeError("RuntimeError");
     }
+    return static_cast<T*>(obj);
 }
 
 template <class T>
-void IsTypeSyntax(const std::shared_ptr<Object>& obj) {
+void IsType(const Object* obj) {
+    if (!Is<T>(obj)) {
+        throw RuntimeError("RuntimeError");
+    }
+}
+
+template <class T>
+void IsTypeSyntax(const Object* obj) {
     if (!Is<T>(obj)) {
         throw SyntaxError("SyntaxError");
     }
 }
 
 template <class T>
-void IsNoType(const std::shared_ptr<Object>& obj) {
+void IsNoType(const Object* obj) {
     if (Is<T>(obj)) {
         throw RuntimeError("RuntimeError");
     }
 }
 
+// Evaluated arguments of a procedure call: a range of the VM stack, or a
+// vector native code collected them in.
+class Args {
+private:
+    Object* const* data_;
+    std::size_t size_;
+public:
+    Args(Object* const* data, std::size_t size) : data_(data), size_(size) {
+    }
+    Args(const std::vector<Object*>& objects) : data_(objects.data()), size_(objects.size()) {
+    }
+    std::size_t size() const {
+        return size_;
+    }
+    Object* operator[](std::size_t i) const {
+        return data_[i];
+    }
+    Object* const* begin() const {
+        return data_;
+    }
+    Object* const* end() const {
+        return data_ + size_;
+    }
+};
+
 template <class T>
-void AreTypesCorrect(std::vector<std::shared_ptr<Object>>& objects) {
-    for (std::size_t i = 0; i < objects.size(); ++i) {
-        if (objects[i] == nullptr || (!Is<T>(objects[i]) && !Is<T>(objects[i]->Eval()))) {
-            throw RuntimeError("RuntimeError");
-        }
-        if (Is<T>(objects[i]->Eval())) {
-            objects[i] = objects[i]->Eval();
-        }
+void AreTypesCorrect(Args args) {
+    for (Object* arg : args) {
+        IsType<T>(arg);
     }
 }
 
 class Symbol : public Object {
 private:
-    std::string name_;
+    SymbolId id_;
+    const std::string* name_;
 public:
-    std::shared_ptr<Object> Eval() override {
-        if (m.find(name_) == m.end()) {
-            return std::shared_ptr<Symbol>(new Symbol(name_));
-        }
-        return m[name_];
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kSymbol;
+    }
+    Symbol(SymbolId id) : Object(ObjectType::kSymbol), id_(id), name_(&SymbolTable::Instance().Name(id)) {
     }
-    Symbol(std::string str) : name_(str) {
+    Symbol(std::string_view str) : Symbol(Intern(str)) {
+    }
+    SymbolId GetId() const {
+        return id_;
     }
     const std::string& GetName() const {
-        return name_;
+        return *name_;
     }
 };
 
+// An integer in the 64-bit range. Those in [kMinFixnum, kMaxFixnum] are
+// fixnums (IsFixnum) and never allocate; only the others are Number objects.
 class Number : public Object {
-    int value_;
+    int64_t value_;
+public:
+    static constexpr int64_t kMinFixnum = INT64_MIN / 2;
+    static constexpr int64_t kMaxFixnum = INT64_MAX / 2;
+
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kNumber;
+    }
+    static Object* Make(int64_t num) {
+        if (num >= kMinFixnum && num <= kMaxFixnum) {
+            return reinterpret_cast<Object*>(static_cast<uintptr_t>(num) << 1 | 1);
+        }
+        return ::Make<Number>(num);
+    }
+    // Throws RuntimeError if obj is not a Number.
+    static int64_t ValueOf(const Object* obj) {
+        if (IsFixnum(obj)) {
+            return static_cast<int64_t>(reinterpret_cast<uintptr_t>(obj)) >> 1;
+        }
+        IsType<Number>(obj);
+        return static_cast<const Number*>(obj)->value_;
+    }
+    Number(int64_t num) : Object(ObjectType::kNumber), value_(num) {
+    }
+};
+
+// An integer outside the 64-bit range. Arithmetic normalizes its results
+// (MakeInteger), so a value that fits in a Number is never a BigNumber.
+class BigNumber : public Object {
+    BigInt value_;
 public:
-    std::shared_ptr<Object> Eval() override {
-        return std::shared_ptr<Symbol>(new Symbol(std::to_string(value_)));
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kBigNumber;
     }
-    Number(int num) : value_(num) {
+    explicit BigNumber(BigInt value) : Object(ObjectType::kBigNumber), value_(std::move(value)) {
     }
-    int GetValue() const {
+    const BigInt& GetValue() const {
         return value_;
     }
 };
 
+// Either kind of integer.
+struct Numeric {
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kNumber || type == ObjectType::kBigNumber;
+    }
+};
+
+Object* MakeInteger(const BigInt& value);
+BigInt ToBigInt(const Object* number);
+
+// Compares two integers; negative, zero or positive like Compare.
+inline int CompareNumbers(const Object* a, const Object* b) {
+    if (Is<Number>(a) && Is<Number>(b)) {
+        int64_t x = Number::ValueOf(a);
+        int64_t y = Number::ValueOf(b);
+        return (x > y) - (x < y);
+    }
+    return Compare(ToBigInt(a), ToBigInt(b));
+}
+
+// Slow paths of the arithmetic procedures, for when an argument is a
+// BigNumber or the 64-bit result would overflow.
+Object* BigSum(Args args);
+Object* BigProduct(Args args);
+Object* BigDifference(Args args);
+Object* BigQuotient(Args args);
+
+// Only two Booleans exist, True() and False(). They are allocated once per
+// process outside any heap and are never collected.
 class Boolean : public Object {
-    std::string name_;
+    bool value_;
+
+    explicit Boolean(bool value) : Object(ObjectType::kBoolean), value_(value) {
+    }
 public:
-    std::shared_ptr<Object> Eval() override {
-        return std::shared_ptr<Symbol>(new Symbol(name_));
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kBoolean;
     }
-    Boolean(std::string str) : name_(str) {
+    static Object* True();
+    static Object* False();
+    static Object* From(bool value) {
+        return value ? True() : False();
     }
-    std::string GetValue() const {
-        return name_;
+    bool GetValue() const {
+        return value_;
     }
 };
 
+inline bool IsFalse(Object* obj) {
+    return obj == Boolean::False();
+}
+
 class Cell : public Object {
 private:
-    std::shared_ptr<Object> first_;
-    std::shared_ptr<Object> second_;
+    Object* first_;
+    Object* second_;
 public:
-    std::shared_ptr<Object> Eval() override {
-        std::string ans = "(";
-        ans += StringFromCell(std::shared_ptr<Cell>(new Cell(first_, second_)));
-        ans[ans.size() - 1] = ')';
-        return std::shared_ptr<Symbol>(new Symbol(ans));
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kCell;
     }
-    Cell() : first_(nullptr), second_(nullptr) {
+    Cell() : Object(ObjectType::kCell), first_(nullptr), second_(nullptr) {
     }
-    Cell(std::shared_ptr<Object> first, std::shared_ptr<Object> second) : first_(first), second_(second) {
+    Cell(Object* first, Object* second) : Object(ObjectType::kCell), first_(first), second_(second) {
     }
-    std::shared_ptr<Object> GetFirst() const {
+    void Trace(Marker& marker) override {
+        marker.Mark(first_);
+        marker.Mark(second_);
+    }
+    Object* GetFirst() const {
         return first_;
     }
-    std::shared_ptr<Object> GetSecond() const {
+    Object* GetSecond() const {
         return second_;
     }
+    void SetFirst(Object* first) {
+        first_ = first;
+    }
+    void SetSecond(Object* second) {
+        second_ = second;
+    }
+};
+
+// A fixed-length vector, with its elements stored right after it in the heap
+// (Heap::MakeWithStorage). While every element is a fixnum they are kept
+// unboxed, as one contiguous int64_t array that the vector-* procedures scan
+// with the kernels in kernels.h; storing anything else boxes them all, once,
+// into an array of objects.
+class Vector : public Object {
+private:
+    std::size_t length_;
+    bool boxed_ = false;
+
+    static_assert(sizeof(int64_t) == sizeof(Object*));
+
+    int64_t* MutableFixnums() {
+        return reinterpret_cast<int64_t*>(this + 1);
+    }
+    Object** MutableObjects() {
+        return reinterpret_cast<Object**>(this + 1);
+    }
+    void BoxElements();
+public:
+    static constexpr std::size_t kMaxLength = std::size_t{1} << 28;
+
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kVector;
+    }
+    // Only for Make, which allocates the elements along with the vector.
+    explicit Vector(std::size_t length) : Object(ObjectType::kVector), length_(length) {
+    }
+    static Vector* Make(std::size_t length, Object* fill);
+    static Vector* Make(Args elements);
+    // An unboxed vector of a copy of length values, which need not be
+    // aligned.
+    static Vector* MakeFixnums(const void* values, std::size_t length);
+
+    std::size_t Length() const {
+        return length_;
+    }
+    bool IsBoxed() const {
+        return boxed_;
+    }
+    // The elements, while the vector is unboxed.
+    const int64_t* Fixnums() const {
+        return reinterpret_cast<const int64_t*>(this + 1);
+    }
+    // The elements, once the vector is boxed.
+    Object* const* Objects() const {
+        return reinterpret_cast<Object* const*>(this + 1);
+    }
+    Object* Get(std::size_t index) const {
+        return boxed_ ? Objects()[index] : Number::Make(Fixnums()[index]);
+    }
+    void Set(std::size_t index, Object* value);
+    void Trace(Marker& marker) override {
+        if (boxed_) {
+            for (std::size_t i = 0; i < length_; ++i) {
+                marker.Mark(Objects()[i]);
+            }
+        }
+    }
+};
+
+// Checks that index is a position in vector and returns it.
+std::size_t VectorIndex(const Vector* vector, const Object* index);
+
+// A local variable that closures capture and that is also assigned (set!,
+// internal define), so every closure sees the same binding.
+class Box : public Object {
+private:
+    Object* value_;
+public:
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kBox;
+    }
+    explicit Box(Object* value) : Object(ObjectType::kBox), value_(value) {
+    }
+    void Trace(Marker& marker) override {
+        marker.Mark(value_);
+    }
+    Object* Get() const {
+        return value_;
+    }
+    void Set(Object* value) {
+        value_ = value;
+    }
 };
 
 class Function : public Object {
 public:
-    std::shared_ptr<Object> Eval() final { throw RuntimeError("RuntimeError"); }
-    virtual std::shared_ptr<Object> Apply(std::shared_ptr<Object>) = 0;
+    static bool Matches(ObjectType type) {
+        return type >= ObjectType::kSpecialForm;
+    }
+    explicit Function(ObjectType type) : Object(type) {
+    }
+};
+
+enum class Syntax : uint8_t {
+    kQuote,
+    kIf,
+    kAnd,
+    kOr,
+    kDefine,
+    kSet,
+    kLambda,
+};
+
+// Special forms receive their operands unevaluated. The compiler recognizes
+// them by Syntax and emits code for them directly.
+class SpecialForm : public Function {
+private:
+    Syntax syntax_;
+public:
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kSpecialForm;
+    }
+    explicit SpecialForm(Syntax syntax) : Function(ObjectType::kSpecialForm), syntax_(syntax) {
+    }
+    Syntax GetSyntax() const {
+        return syntax_;
+    }
 };
 
-class Quote : public Function {
+// Procedures receive evaluated arguments.
+class Procedure : public Function {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        return obj;
+    static bool Matches(ObjectType type) {
+        return type >= ObjectType::kProcedure;
+    }
+    Procedure() : Function(ObjectType::kProcedure) {
+    }
+    explicit Procedure(ObjectType type) : Function(type) {
+    }
+    virtual Object* Call(Args args) = 0;
+    // True if Call only computes a value from its arguments, so that the
+    // compiler may call it early on constants.
+    virtual bool IsPure() const {
+        return false;
     }
 };
 
-class CheckForNumber : public Function {
+class CheckForNumber : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        if (!Is<Number>(objects[0])) {
-            return std::shared_ptr<Boolean>(new Boolean("#f"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        if (!Is<Numeric>(args[0])) {
+            return Boolean::False();
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class Equal : public Function {
+class Equal : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        AreTypesCorrect<Number>(objects);
-        for (size_t i = 1; i < objects.size(); ++i) {
-            if (As<Number>(objects[i])->GetValue() != As<Number>(objects[i - 1])->GetValue()) {
-                return std::shared_ptr<Boolean>(new Boolean("#f"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        AreTypesCorrect<Numeric>(args);
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (CompareNumbers(args[i - 1], args[i]) != 0) {
+                return Boolean::False();
             }
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class Greater : public Function {
+class Greater : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        AreTypesCorrect<Number>(objects);
-        for (size_t i = 1; i < objects.size(); ++i) {
-            if (As<Number>(objects[i])->GetValue() >= As<Number>(objects[i - 1])->GetValue()) {
-                return std::shared_ptr<Boolean>(new Boolean("#f"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        AreTypesCorrect<Numeric>(args);
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (CompareNumbers(args[i - 1], args[i]) <= 0) {
+                return Boolean::False();
             }
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class Less : public Function {
+class Less : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        AreTypesCorrect<Number>(objects);
-        for (size_t i = 1; i < objects.size(); ++i) {
-            if (As<Number>(objects[i])->GetValue() <= As<Number>(objects[i - 1])->GetValue()) {
-                return std::shared_ptr<Boolean>(new Boolean("#f"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        AreTypesCorrect<Numeric>(args);
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (CompareNumbers(args[i - 1], args[i]) >= 0) {
+                return Boolean::False();
             }
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class GreaterOrEqual : public Function {
+class GreaterOrEqual : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        AreTypesCorrect<Number>(objects);
-        for (size_t i = 1; i < objects.size(); ++i) {
-            if (As<Number>(objects[i])->GetValue() > As<Number>(objects[i - 1])->GetValue()) {
-                return std::shared_ptr<Boolean>(new Boolean("#f"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        AreTypesCorrect<Numeric>(args);
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (CompareNumbers(args[i - 1], args[i]) < 0) {
+                return Boolean::False();
             }
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class LessOrEqual : public Function {
+class LessOrEqual : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        AreTypesCorrect<Number>(objects);
-        for (size_t i = 1; i < objects.size(); ++i) {
-            if (As<Number>(objects[i])->GetValue() < As<Number>(objects[i - 1])->GetValue()) {
-                return std::shared_ptr<Boolean>(new Boolean("#f"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        AreTypesCorrect<Numeric>(args);
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (CompareNumbers(args[i - 1], args[i]) > 0) {
+                return Boolean::False();
             }
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class Sum : public Function {
+// The arithmetic procedures work on 64-bit values while every argument is a
+// Number and nothing overflows, and start over on BigInts otherwise.
+class Sum : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        AreTypesCorrect<Number>(objects);
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
         int64_t res = 0;
-        for (auto object : objects) {
-            res += As<Number>(object)->GetValue();
+        for (Object* arg : args) {
+            if (!Is<Number>(arg) || __builtin_add_overflow(res, Number::ValueOf(arg), &res)) {
+                return BigSum(args);
+            }
         }
-        return std::shared_ptr<Number>(new Number(res));
+        return Number::Make(res);
     }
 };
 
-class Multiplication : public Function {
+class Multiplication : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        AreTypesCorrect<Number>(objects);
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
         int64_t res = 1;
-        for (auto object : objects) {
-            res *= As<Number>(object)->GetValue();
+        for (Object* arg : args) {
+            if (!Is<Number>(arg) || __builtin_mul_overflow(res, Number::ValueOf(arg), &res)) {
+                return BigProduct(args);
+            }
         }
-        return std::shared_ptr<Number>(new Number(res));
+        return Number::Make(res);
     }
 };
 
-class Subtraction : public Function {
+class Subtraction : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzNeq(0, objects.size());
-        AreTypesCorrect<Number>(objects);
-        int64_t res = As<Number>(objects[0])->GetValue();
-        for (size_t i = 1; i < objects.size(); ++i) {
-            res -= As<Number>(objects[i])->GetValue();
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzNeq(0, args.size());
+        if (!Is<Number>(args[0])) {
+            return BigDifference(args);
+        }
+        int64_t res = Number::ValueOf(args[0]);
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (!Is<Number>(args[i]) || __builtin_sub_overflow(res, Number::ValueOf(args[i]), &res)) {
+                return BigDifference(args);
+            }
         }
-        return std::shared_ptr<Number>(new Number(res));
+        return Number::Make(res);
     }
 };
 
-class Division : public Function {
+class Division : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzNeq(0, objects.size());
-        AreTypesCorrect<Number>(objects);
-        int64_t res = As<Number>(objects[0])->GetValue();
-        for (size_t i = 1; i < objects.size(); ++i) {
-            res /= As<Number>(objects[i])->GetValue();
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzNeq(0, args.size());
+        if (!Is<Number>(args[0])) {
+            return BigQuotient(args);
+        }
+        int64_t res = Number::ValueOf(args[0]);
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (!Is<Number>(args[i])) {
+                return BigQuotient(args);
+            }
+            int64_t divisor = Number::ValueOf(args[i]);
+            if (divisor == 0) {
+                throw RuntimeError("RuntimeError");
+            }
+            if (divisor == -1 && res == INT64_MIN) {
+                return BigQuotient(args);
+            }
+            res /= divisor;
         }
-        return std::shared_ptr<Number>(new Number(res));
+        return Number::Make(res);
     }
 };
 
-class Max : public Function {
+class Max : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzNeq(0, objects.size());
-        AreTypesCorrect<Number>(objects);
-        int res = As<Number>(objects[0])->GetValue();
-        for (size_t i = 1; i < objects.size(); ++i) {
-            res = std::max(res, As<Number>(objects[i])->GetValue());
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzNeq(0, args.size());
+        AreTypesCorrect<Numeric>(args);
+        Object* res = args[0];
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (CompareNumbers(args[i], res) > 0) {
+                res = args[i];
+            }
         }
-        return std::shared_ptr<Number>(new Number(res));
+        return res;
     }
 };
 
-class Min : public Function {
+class Min : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzNeq(0, objects.size());
-        AreTypesCorrect<Number>(objects);
-        int res = As<Number>(objects[0])->GetValue();
-        for (size_t i = 1; i < objects.size(); ++i) {
-            res = std::min(res, As<Number>(objects[i])->GetValue());
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzNeq(0, args.size());
+        AreTypesCorrect<Numeric>(args);
+        Object* res = args[0];
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (CompareNumbers(args[i], res) < 0) {
+                res = args[i];
+            }
         }
-        return std::shared_ptr<Number>(new Number(res));
+        return res;
     }
 };
 
-class Abs : public Function {
+class Abs : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        AreTypesCorrect<Number>(objects);
-        return std::shared_ptr<Number>(new Number(abs(As<Number>(objects[0])->GetValue())));
+    bool IsPure() const override {
+        return true;
     }
-};
-
-class CheckForBoolean : public Function {
-public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        if (Is<Boolean>(objects[0])) {
-            return std::shared_ptr<Boolean>(new Boolean("#t"));
-        } else {
-            return std::shared_ptr<Boolean>(new Boolean("#f"));
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        AreTypesCorrect<Numeric>(args);
+        if (Is<Number>(args[0]) && Number::ValueOf(args[0]) != INT64_MIN) {
+            return Number::Make(std::abs(Number::ValueOf(args[0])));
         }
+        return MakeInteger(ToBigInt(args[0]).Abs());
     }
 };
 
-class Not : public Function {
+class CheckForBoolean : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        if (Is<Boolean>(objects[0]) && As<Boolean>(objects[0])->GetValue() == "#f") {
-            return std::shared_ptr<Boolean>(new Boolean("#t"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        if (Is<Boolean>(args[0])) {
+            return Boolean::True();
         } else {
-            return std::shared_ptr<Boolean>(new Boolean("#f"));
+            return Boolean::False();
         }
     }
 };
 
-std::shared_ptr<Object> UnbindForBoolean(std::shared_ptr<Object> obj, std::shared_ptr<Boolean> value);
-
-class And : public Function {
+class Not : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        if (obj == nullptr) {
-            return std::shared_ptr<Boolean>(new Boolean("#t"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        if (IsFalse(args[0])) {
+            return Boolean::True();
+        } else {
+            return Boolean::False();
         }
-        return UnbindForBoolean(obj, std::shared_ptr<Boolean>(new Boolean("#f")));
     }
 };
 
-class Or : public Function {
-public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        if (obj == nullptr) {
-            return std::shared_ptr<Boolean>(new Boolean("#f"));
+class Pair : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        if (TreeLength(args[0]) != 2) {
+            return Boolean::False();
         }
-        return UnbindForBoolean(obj, std::shared_ptr<Boolean>(new Boolean("#t")));
+        return Boolean::True();
     }
 };
 
-class Pair : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        std::cout << objects.size() << std::endl;
-        CompareSzEq(1, objects.size());
-        if (TreeLength(objects[0]) != 2) {
-            return std::shared_ptr<Boolean>(new Boolean("#f"));
+class Null : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        if (args[0] != nullptr) {
+            return Boolean::False();
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class Null : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        if (objects[0] != nullptr) {
-            return std::shared_ptr<Boolean>(new Boolean("#f"));
+class List : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        if (LastInTree(args[0]) != nullptr) {
+            return Boolean::False();
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return Boolean::True();
     }
 };
 
-class List : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        if (LastInTree(objects[0]) != nullptr) {
-            return std::shared_ptr<Boolean>(new Boolean("#f"));
+class MakeList : public Procedure {
+    Object* Call(Args args) override {
+        Object* list = nullptr;
+        for (std::size_t i = args.size(); i > 0; --i) {
+            list = Make<Cell>(args[i - 1], list);
         }
-        return std::shared_ptr<Boolean>(new Boolean("#t"));
+        return list;
     }
 };
 
-class Car : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        CallOnEmpty(objects[0]);
-        IsType<Cell>(objects[0]);
-        return As<Cell>(objects[0])->GetFirst();
+class Car : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        CallOnEmpty(args[0]);
+        IsType<Cell>(args[0]);
+        return As<Cell>(args[0])->GetFirst();
     }
 };
 
-class Cdr : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        CallOnEmpty(objects[0]);
-        IsType<Cell>(objects[0]);
-        return As<Cell>(objects[0])->GetSecond();
+class Cdr : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        CallOnEmpty(args[0]);
+        IsType<Cell>(args[0]);
+        return As<Cell>(args[0])->GetSecond();
     }
 };
 
-class Cons : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(2, objects.size());
-        return std::shared_ptr<Cell>(new Cell(objects[0], objects[1]));
+class Cons : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(2, args.size());
+        return Make<Cell>(args[0], args[1]);
     }
 };
 
-class ListRef : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(2, objects.size());
-        IsType<Number>(objects[1]);
-        return PosInTree(objects[0], As<Number>(objects[1])->GetValue());
+class ListRef : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(2, args.size());
+        IsType<Number>(args[1]);
+        return PosInTree(args[0], Number::ValueOf(args[1]));
     }
 };
 
-class ListTail : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(2, objects.size());
-        IsType<Number>(objects[1]);
-        return AfterPosInTree(objects[0], As<Number>(objects[1])->GetValue());
+class ListTail : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(2, args.size());
+        IsType<Number>(args[1]);
+        return AfterPosInTree(args[0], Number::ValueOf(args[1]));
     }
 };
 
-class If : public Function {
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        if (TreeLength(obj) < 1 || TreeLength(obj) > 3) {
-            throw SyntaxError("SynyaxError");
-        }
-        auto st = Is<Cell>(As<Cell>(obj)->GetFirst()) ? UnbindFunc(As<Cell>(obj)->GetFirst()) : As<Cell>(obj)->GetFirst();
-        if (Is<Boolean>(st) && As<Boolean>(st)->GetValue() == "#f") {
-            if (TreeLength(obj) == 2) {
-                return UnbindFunc(nullptr);
-            }
-            return UnbindFunc(LastInTreeNonNull(obj));
+class MakeVector : public Procedure {
+    Object* Call(Args args) override {
+        if (args.size() != 1 && args.size() != 2) {
+            throw RuntimeError("RuntimeError");
         }
-        if (TreeLength(obj) == 1) {
-            return UnbindFunc(nullptr);
+        IsType<Number>(args[0]);
+        int64_t length = Number::ValueOf(args[0]);
+        if (length < 0) {
+            throw RuntimeError("RuntimeError");
         }
-        return UnbindFunc(As<Cell>(As<Cell>(obj)->GetSecond())->GetFirst());
+        return Vector::Make(length, args.size() == 2 ? args[1] : Number::Make(0));
     }
 };
 
-void AddValuesToParams(std::map<std::string, std::shared_ptr<Object>>& vars, std::vector<std::string>& names,
-                          std::vector<std::shared_ptr<Object>>& objects);
-std::shared_ptr<Object> SearchInAncestors(std::string s, std::shared_ptr<Object> env);
-
-void SetParams(std::shared_ptr<Object> env, std::shared_ptr<Object> obj);
-
-class Lambda : public Function {
-public:
-    std::shared_ptr<Object> parent;
-    std::map<std::string, std::shared_ptr<Object>> names;
-    std::vector<std::shared_ptr<Object>> params;
-    std::shared_ptr<Object> body;
-
-    Lambda(std::vector<std::shared_ptr<Object>>& new_params, std::shared_ptr<Object> new_body) :
-          body(new_body) {
-        params = new_params;
-        for (auto param : new_params) {
-            names[As<Symbol>(param)->GetName()] = nullptr;
-        }
-    };
+class VectorOf : public Procedure {
+    Object* Call(Args args) override {
+        return Vector::Make(args);
+    }
+};
 
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        return nullptr;
+class VectorLength : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        return Number::Make(As<Vector>(args[0])->Length());
     }
 };
 
-class MakeLambda : public Function {
-public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        IsType<Cell>(obj);
-        IsType<Cell>(As<Cell>(obj)->GetFirst());
-        IsType<Cell>(As<Cell>(obj)->GetSecond());
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, As<Cell>(obj)->GetFirst());
-        AreTypesCorrect<Symbol>(objects);
-        auto new_lambda = std::shared_ptr<Lambda>(new Lambda(objects, As<Cell>(obj)->GetSecond()));
-        As<Lambda>(new_lambda)->parent = nullptr;
-        return new_lambda;
+class VectorRef : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(2, args.size());
+        const Vector* vector = As<Vector>(args[0]);
+        return vector->Get(VectorIndex(vector, args[1]));
     }
 };
 
-class Define : public Function {
-public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        IsTypeSyntax<Cell>(obj);
-        auto first = As<Cell>(obj)->GetFirst();
-        auto second = As<Cell>(obj)->GetSecond();
-        IsTypeSyntax<Cell>(second);
-        if (As<Cell>(second)->GetSecond() != nullptr) {
-            throw SyntaxError("SyntaxError");
-        }
-        if (Is<Symbol>(first)) {
-            if (!Is<Cell>(As<Cell>(second)->GetFirst())) {
-                if (Is<Number>(As<Cell>(second)->GetFirst())) {
-                    m[As<Symbol>(first)->GetName()] = As<Cell>(second)->GetFirst();
-                }
-                if (Is<Symbol>(As<Cell>(second)->GetFirst())) {
-                    if (m.find(As<Symbol>(As<Cell>(second)->GetFirst())->GetName()) == m.end()) {
-                        throw NameError("NameError");
-                    }
-                    m[As<Symbol>(first)->GetName()] = std::shared_ptr<Number>(new Number(
-                        As<Number>(m[As<Symbol>(As<Cell>(second)->GetFirst())->GetName()])->GetValue()));
-                }
-            } else {
-                auto s_f = As<Cell>(second)->GetFirst();
-                auto func = As<Cell>(s_f)->GetFirst()->Eval();
-                IsTypeSyntax<Function>(func);
-                if (!Is<Lambda>(func) && !Is<Define>(func)) {
-                    m[As<Symbol>(first)->GetName()] = As<Function>(func)->Apply(As<Cell>(s_f)->GetSecond());
-                }
-            }
-        }
+class VectorSet : public Procedure {
+    Object* Call(Args args) override {
+        CompareSzEq(3, args.size());
+        Vector* vector = As<Vector>(args[0]);
+        vector->Set(VectorIndex(vector, args[1]), args[2]);
         return nullptr;
     }
 };
 
-class Set : public Function {
+// Bulk operations over a whole vector. Sum, max and min run SIMD kernels
+// over unboxed vectors; map and fold call a procedure for every element.
+class VectorSum : public Procedure {
+    Object* Call(Args args) override;
+};
+
+class VectorMax : public Procedure {
+    Object* Call(Args args) override;
+};
+
+class VectorMin : public Procedure {
+    Object* Call(Args args) override;
+};
+
+// (vector-map proc vector)
+class VectorMap : public Procedure {
+    Object* Call(Args args) override;
+};
+
+// (vector-fold proc init vector) calls (proc acc element) from left to right.
+class VectorFold : public Procedure {
+    Object* Call(Args args) override;
+};
+
+// A user procedure: a compiled lambda plus the values of its free local
+// variables, copied in when the closure is created.
+class Lambda : public Procedure {
+private:
+    std::shared_ptr<const Prototype> prototype_;
+    std::vector<Object*> captured_;
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        IsTypeSyntax<Cell>(obj);
-        auto first = As<Cell>(obj)->GetFirst();
-        auto second = As<Cell>(obj)->GetSecond();
-        IsTypeSyntax<Symbol>(first);
-        IsTypeSyntax<Cell>(second);
-        if (As<Cell>(second)->GetSecond() != nullptr) {
-            throw SyntaxError("SyntaxError");
-        }
-        if (m.find(As<Symbol>(first)->GetName()) == m.end()) {
-            throw NameError("NameError");
-        }
-        if (!Is<Cell>(As<Cell>(second)->GetFirst())) {
-            m[As<Symbol>(first)->GetName()] = As<Cell>(second)->GetFirst();
-        } else {
-            auto s_f = As<Cell>(second)->GetFirst();
-            auto func = As<Cell>(s_f)->GetFirst()->Eval();
-            IsTypeSyntax<Function>(func);
-            if (!Is<Lambda>(func) && !Is<Define>(func)) {
-                m[As<Symbol>(first)->GetName()] = As<Function>(func)->Apply(As<Cell>(s_f)->GetSecond());
-            }
+    static bool Matches(ObjectType type) {
+        return type == ObjectType::kLambda;
+    }
+    Lambda(std::shared_ptr<const Prototype> prototype, std::vector<Object*> captured)
+        : Procedure(ObjectType::kLambda), prototype_(std::move(prototype)), captured_(std::move(captured)) {
+    }
+    const std::shared_ptr<const Prototype>& GetPrototype() const {
+        return prototype_;
+    }
+    const std::vector<Object*>& GetCaptured() const {
+        return captured_;
+    }
+    void SetCaptured(std::size_t index, Object* value) {
+        captured_[index] = value;
+    }
+    void Trace(Marker& marker) override {
+        for (Object* value : captured_) {
+            marker.Mark(value);
         }
-        return nullptr;
+        marker.Mark(*prototype_);
     }
+    Object* Call(Args args) override;
 };
 
-class IsSymbol : public Function {
+// Calls a procedure from native code like Procedure::Call, but lets the
+// active VM collect its heap meanwhile: everything the caller still uses must
+// be reachable from a root set. Defined in vm.cpp.
+Object* CallWithRoots(Object* procedure, Args args);
+
+// Checks the shape of (define name expr) / (set! name expr) and returns name.
+SymbolId BindingTarget(Object* obj);
+
+class IsSymbol : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        IsType<Cell>(obj);
-        std::vector<std::shared_ptr<Object>> objects;
-        UnbindList(objects, obj);
-        CompareSzEq(1, objects.size());
-        if (Is<Symbol>(objects[0])) {
-            return std::shared_ptr<Boolean>(new Boolean("#t"));
+    bool IsPure() const override {
+        return true;
+    }
+    Object* Call(Args args) override {
+        CompareSzEq(1, args.size());
+        if (Is<Symbol>(args[0])) {
+            return Boolean::True();
         }
-        return std::shared_ptr<Boolean>(new Boolean("#f"));
+        return Boolean::False();
     }
 };
 
-class SetCar : public Function {
+class SetCar : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Object> obj) override {
-        std::cout << 10000 << std::endl;
-        IsType<Cell>(obj);
-        auto first = As<Cell>(obj)->GetFirst();
-        auto second = As<Cell>(obj)->GetSecond();
-        std::cout << 1000 << std::endl;
-        IsType<Cell>(second);
-        std::cout << 2000 << std::endl;
-        IsType<Symbol>(first);
-        std::cout << 3000 << std::endl;
-        auto pair = m[As<Symbol>(first)->GetName()];
-        std::cout << m[As<Symbol>(first)->GetName()] << std::endl;
-        auto ispair = As<Function>(m["pair?"])->Apply(std::shared_ptr<Cell>(new Cell(std::shared_ptr<Cell>(
-            new Cell(std::shared_ptr<Symbol>(new Symbol("quote")), pair)), nullptr)));
-        std::cout << 4000 << std::endl;
-        if (As<Boolean>(ispair)->GetValue() == "#f") {
-            throw RuntimeError("RuntimeError");
-        }
-        m[As<Symbol>(first)->GetName()] = std::shared_ptr<Cell>(new Cell(As<Cell>(second)->GetFirst(), As<Cell>(pair)->GetSecond()));
-        std::swap(As<Cell>(pair)->GetFirst(), As<Cell>(second)->GetFirst());
-        std::cout << As<Number>(As<Cell>(second)->GetFirst())->GetValue() << std::endl;
-        std::cout << As<Number>(As<Cell>(pair)->GetFirst())->GetValue() << std::endl;
+    Object* Call(Args args) override {
+        CompareSzEq(2, args.size());
+        IsType<Cell>(args[0]);
+        As<Cell>(args[0])->SetFirst(args[1]);
         return nullptr;
     }
-};
\ No newline at end of file
+};
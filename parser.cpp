@@ -1,73 +1,177 @@
 #include "parser.h"
-#include <iostream>
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
-    if (tokenizer->IsEnd() || tokenizer->GetToken() == Token{BracketToken::CLOSE}
-        || tokenizer->GetToken() == Token{DotToken()}) {
+static const SymbolId kQuoteId = Intern("quote");
+
+namespace {
+
+enum class FrameKind { kList, kVector, kQuote, kQuoteForm };
+
+// A datum that is still being read: a list or a vector collecting elements,
+// or a quote waiting for the datum it applies to.
+struct Frame {
+    FrameKind kind;
+    Object* head = nullptr;
+    Cell* tail = nullptr;
+    bool after_dot = false;
+    std::vector<Object*> elements = {};
+};
+
+bool IsToken(Tokenizer* tokenizer, BracketToken bracket) {
+    auto token = std::get_if<BracketToken>(&tokenizer->GetToken());
+    return token != nullptr && *token == bracket;
+}
+
+bool IsDot(Tokenizer* tokenizer) {
+    return std::holds_alternative<DotToken>(tokenizer->GetToken());
+}
+
+bool IsVectorOpen(Tokenizer* tokenizer) {
+    return std::holds_alternative<VectorToken>(tokenizer->GetToken());
+}
+
+void ExpectClose(Tokenizer* tokenizer) {
+    if (tokenizer->IsEnd() || !IsToken(tokenizer, BracketToken::CLOSE)) {
         throw SyntaxError("SyntaxError");
     }
-    if (tokenizer->GetToken() == Token{BracketToken::OPEN}) {
-        tokenizer->Next();
-        if (tokenizer->GetToken() == Token{SymbolToken{"quote"}}) {
-            std::shared_ptr<Symbol> first(new Symbol("quote"));
-            if (tokenizer->IsEnd()) {
+    tokenizer->Next();
+}
+
+Object* MakeQuote(Object* datum) {
+    return Make<Cell>(Make<Symbol>(kQuoteId), datum);
+}
+
+// Reads one datum with an explicit stack instead of recursion, so the native
+// stack stays bounded for any nesting depth and list length. With in_list set
+// the opening bracket has already been consumed (ReadList).
+Object* ReadDatum(Tokenizer* tokenizer, bool in_list) {
+    std::vector<Frame> stack;
+    Object* value = nullptr;
+    FrameKind opened = FrameKind::kList;
+    while (true) {
+        bool complete = false;
+        if (in_list) {
+            in_list = false;
+            if (tokenizer->IsEnd() || IsDot(tokenizer)) {
                 throw SyntaxError("SyntaxError");
             }
+            if (IsToken(tokenizer, BracketToken::CLOSE)) {
+                tokenizer->Next();
+                value = opened == FrameKind::kVector ? Vector::Make(Args(nullptr, 0)) : nullptr;
+                complete = true;
+            } else {
+                stack.push_back(Frame{opened});
+                continue;
+            }
+        } else {
+            if (tokenizer->IsEnd() || IsToken(tokenizer, BracketToken::CLOSE) || IsDot(tokenizer)) {
+                throw SyntaxError("SyntaxError");
+            }
+            const Token& token = tokenizer->GetToken();
+            if (IsToken(tokenizer, BracketToken::OPEN)) {
+                tokenizer->Next();
+                auto symbol = std::get_if<SymbolToken>(&tokenizer->GetToken());
+                if (!tokenizer->IsEnd() && symbol != nullptr && symbol->name == "quote") {
+                    tokenizer->Next();
+                    stack.push_back(Frame{FrameKind::kQuoteForm});
+                } else {
+                    in_list = true;
+                    opened = FrameKind::kList;
+                }
+                continue;
+            }
+            if (IsVectorOpen(tokenizer)) {
+                tokenizer->Next();
+                in_list = true;
+                opened = FrameKind::kVector;
+                continue;
+            }
+            if (std::holds_alternative<QuoteToken>(token)) {
+                tokenizer->Next();
+                stack.push_back(Frame{FrameKind::kQuote});
+                continue;
+            }
+            if (auto symbol = std::get_if<SymbolToken>(&token)) {
+                if (symbol->name == "#f" || symbol->name == "#t") {
+                    value = Boolean::From(symbol->name == "#t");
+                } else {
+                    value = Make<Symbol>(symbol->name);
+                }
+            } else {
+                const auto& constant = std::get<ConstantToken>(token);
+                value = constant.big.empty() ? Number::Make(constant.value) : MakeInteger(BigInt::Parse(constant.big));
+            }
             tokenizer->Next();
-            auto second = Read(tokenizer);
-            tokenizer->Next();
-            return std::shared_ptr<Cell>(new Cell(first, second));
-        }
-        return ReadList(tokenizer);
-    }
-    if (tokenizer->GetToken() == Token{QuoteToken()}) {
-        std::shared_ptr<Symbol> first(new Symbol("quote"));
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError("SyntaxError");
+            complete = true;
         }
-        tokenizer->Next();
-        auto second = Read(tokenizer);
-        return std::shared_ptr<Cell>(new Cell(first, second));
-    }
-    if (std::holds_alternative<SymbolToken>(tokenizer->GetToken())) {
-        SymbolToken real_token = std::get<SymbolToken>(tokenizer->GetToken());
-        tokenizer->Next();
-        if (real_token.name == "#f" || real_token.name == "#t") {
-            return std::shared_ptr<Boolean>(new Boolean(real_token.name));
-        } else {
-            return std::shared_ptr<Symbol>(new Symbol(real_token.name));
+
+        while (complete) {
+            if (stack.empty()) {
+                return value;
+            }
+            Frame& frame = stack.back();
+            if (frame.kind == FrameKind::kQuote) {
+                value = MakeQuote(value);
+                stack.pop_back();
+                continue;
+            }
+            if (frame.kind == FrameKind::kQuoteForm) {
+                ExpectClose(tokenizer);
+                value = MakeQuote(value);
+                stack.pop_back();
+                continue;
+            }
+            if (frame.kind == FrameKind::kVector) {
+                frame.elements.push_back(value);
+                if (tokenizer->IsEnd() || IsDot(tokenizer)) {
+                    throw SyntaxError("SyntaxError");
+                }
+                if (IsToken(tokenizer, BracketToken::CLOSE)) {
+                    tokenizer->Next();
+                    value = Vector::Make(frame.elements);
+                    stack.pop_back();
+                    continue;
+                }
+                complete = false;
+                continue;
+            }
+            if (frame.after_dot) {
+                ExpectClose(tokenizer);
+                frame.tail->SetSecond(value);
+                value = frame.head;
+                stack.pop_back();
+                continue;
+            }
+            Cell* cell = Make<Cell>(value, nullptr);
+            if (frame.tail == nullptr) {
+                frame.head = cell;
+            } else {
+                frame.tail->SetSecond(cell);
+            }
+            frame.tail = cell;
+            if (tokenizer->IsEnd()) {
+                throw SyntaxError("SyntaxError");
+            }
+            if (IsToken(tokenizer, BracketToken::CLOSE)) {
+                tokenizer->Next();
+                value = frame.head;
+                stack.pop_back();
+                continue;
+            }
+            if (IsDot(tokenizer)) {
+                tokenizer->Next();
+                frame.after_dot = true;
+            }
+            complete = false;
         }
     }
-    ConstantToken real_token = std::get<ConstantToken>(tokenizer->GetToken());
-    std::shared_ptr<Number> num(new Number(real_token.value));
-    tokenizer->Next();
-    return num;
 }
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    if (tokenizer->IsEnd() || tokenizer->GetToken() == Token{DotToken()}) {
-        throw SyntaxError("SyntaxError");
-    }
-    if (tokenizer->GetToken() == Token{BracketToken::CLOSE}) {
-        tokenizer->Next();
-        return nullptr;
-    }
-    auto first = Read(tokenizer);
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError("SyntaxError");
-    }
-    if (tokenizer->GetToken() == Token{BracketToken::CLOSE}) {
-        tokenizer->Next();
-        return std::shared_ptr<Cell>(new Cell(first, nullptr));
-    }
-    if (tokenizer->GetToken() == Token{DotToken{}}) {
-        tokenizer->Next();
-        auto second = Read(tokenizer);
-        if (tokenizer->IsEnd() || !(tokenizer->GetToken() == Token{BracketToken::CLOSE})) {
-            throw SyntaxError("SyntaxError");
-        }
-        tokenizer->Next();
-        return std::shared_ptr<Cell>(new Cell(first, second));
-    }
-    return std::shared_ptr<Cell>(new Cell(first, ReadList(tokenizer)));
+}  // namespace
+
+Object* Read(Tokenizer* tokenizer) {
+    return ReadDatum(tokenizer, false);
+}
+
+Object* ReadList(Tokenizer* tokenizer) {
+    return ReadDatum(tokenizer, true);
 }
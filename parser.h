@@ -4,6 +4,6 @@
 
 #include "object.h"
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer);
+Object* Read(Tokenizer* tokenizer);
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer);
\ No newline at end of file
+Object* ReadList(Tokenizer* tokenizer);
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "printer.h"
+
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+void AppendFixnum(int64_t value, std::string& out) {
+    char digits[24];
+    auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    out.append(digits, end);
+}
+
+}  // namespace
+
+// Cells and boxed vectors can contain themselves; nothing else is traversed.
+bool Printer::IsCompound(Object* obj) {
+    return Is<Cell>(obj) || (Is<Vector>(obj) && As<Vector>(obj)->IsBoxed());
+}
+
+void Printer::PrintAtom(Object* obj, std::string& out) {
+    if (obj == nullptr) {
+        out += "()";
+        return;
+    }
+    switch (TypeOf(obj)) {
+        case ObjectType::kNumber:
+            AppendFixnum(Number::ValueOf(obj), out);
+            return;
+        case ObjectType::kVector: {
+            const Vector* vector = As<Vector>(obj);
+            out += "#(";
+            for (std::size_t i = 0; i < vector->Length(); ++i) {
+                if (i > 0) {
+                    out += ' ';
+                }
+                AppendFixnum(vector->Fixnums()[i], out);
+            }
+            out += ')';
+            return;
+        }
+        case ObjectType::kBigNumber:
+            As<BigNumber>(obj)->GetValue().AppendTo(out);
+            return;
+        case ObjectType::kBoolean:
+            out += As<Boolean>(obj)->GetValue() ? "#t" : "#f";
+            return;
+        case ObjectType::kSymbol:
+            out += As<Symbol>(obj)->GetName();
+            return;
+        default:
+            throw RuntimeError("RuntimeError");
+    }
+}
+
+void Printer::PrintElement(Object* obj, std::string& out) {
+    if (!Is<Cell>(obj) && !IsCompound(obj)) {
+        PrintAtom(obj, out);
+    } else if (obj->IsMarked()) {
+        BackReference(obj, out);
+    } else {
+        Enter(obj, true, out);
+    }
+}
+
+void Printer::Enter(Object* node, bool opens_list, std::string& out) {
+    path_.push_back(PathEntry{node, out.size(), opens_list});
+    node->SetMarked(true);
+    if (Is<Vector>(node)) {
+        out += "#(";
+        Frame frame{nullptr, path_.size() - 1};
+        frame.vector = As<Vector>(node);
+        frames_.push_back(frame);
+    } else if (opens_list) {
+        out += '(';
+        frames_.push_back(Frame{As<Cell>(node), path_.size() - 1});
+    }
+}
+
+void Printer::Close(std::string& out) {
+    Frame& frame = frames_.back();
+    out.append(1 + frame.extra_closers, ')');
+    for (std::size_t i = frame.path_begin; i < path_.size(); ++i) {
+        path_[i].node->SetMarked(false);
+    }
+    path_.resize(frame.path_begin);
+    frames_.pop_back();
+}
+
+void Printer::BackReference(Object* node, std::string& out) {
+    std::size_t index = path_.size();
+    while (path_[--index].node != node) {
+    }
+    PathEntry& entry = path_[index];
+    if (entry.label < 0) {
+        entry.label = next_label_++;
+        labels_.push_back(Label{entry.offset, entry.label, entry.opens_list});
+        if (!entry.opens_list) {
+            // The cycle enters the middle of a list: (1 2 3) becomes
+            // (1 . #0=(2 3 ...)), which needs one more closing bracket.
+            std::size_t frame = frames_.size();
+            while (frames_[--frame].path_begin > index) {
+            }
+            ++frames_[frame].extra_closers;
+        }
+    }
+    out += '#';
+    AppendFixnum(entry.label, out);
+    out += '#';
+}
+
+void Printer::InsertLabels(std::string& out) {
+    std::sort(labels_.begin(), labels_.end(),
+              [](const Label& a, const Label& b) { return a.offset < b.offset; });
+    std::size_t begin = labels_.front().offset;
+    tail_.assign(out, begin);
+    out.resize(begin);
+    for (std::size_t i = 0; i < labels_.size(); ++i) {
+        const Label& label = labels_[i];
+        out += label.opens_list ? "#" : ". #";
+        AppendFixnum(label.label, out);
+        out += label.opens_list ? "=" : "=(";
+        std::size_t end = i + 1 < labels_.size() ? labels_[i + 1].offset : begin + tail_.size();
+        out.append(tail_, label.offset - begin, end - label.offset);
+    }
+}
+
+void Printer::Reset() {
+    for (auto& entry : path_) {
+        entry.node->SetMarked(false);
+    }
+    path_.clear();
+    frames_.clear();
+    labels_.clear();
+    next_label_ = 0;
+}
+
+void Printer::Print(Object* obj, std::string& out) {
+    if (!IsCompound(obj)) {
+        PrintAtom(obj, out);
+        return;
+    }
+    struct ResetGuard {
+        Printer* printer;
+        ~ResetGuard() {
+            printer->Reset();
+        }
+    } guard{this};
+
+    Enter(obj, true, out);
+    while (!frames_.empty()) {
+        Frame& frame = frames_.back();
+        Cell* cell = frame.cell;
+        if (cell == nullptr) {
+            if (frame.index == frame.vector->Length()) {
+                Close(out);
+                continue;
+            }
+            if (frame.index > 0) {
+                out += ' ';
+            }
+            PrintElement(frame.vector->Objects()[frame.index++], out);
+            continue;
+        }
+        if (!frame.first_done) {
+            frame.first_done = true;
+            PrintElement(cell->GetFirst(), out);
+            continue;
+        }
+        if (frame.rest_done) {
+            Close(out);
+            continue;
+        }
+        Object* second = cell->GetSecond();
+        if (second == nullptr) {
+            Close(out);
+        } else if (!Is<Cell>(second)) {
+            // A boxed vector in the tail opens a frame of its own; the list
+            // closes after it.
+            out += " . ";
+            frame.rest_done = true;
+            PrintElement(second, out);
+        } else if (second->IsMarked()) {
+            out += " . ";
+            BackReference(second, out);
+            Close(out);
+        } else {
+            out += ' ';
+            frame.cell = As<Cell>(second);
+            frame.first_done = false;
+            Enter(frame.cell, false, out);
+        }
+    }
+    if (!labels_.empty()) {
+        InsertLabels(out);
+    }
+}
+
+void Printer::Print(Object* obj, std::ostream& out) {
+    buffer_.clear();
+    Print(obj, buffer_);
+    out.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+}
+
+std::string ToString(Object* obj) {
+    Printer printer;
+    std::string out;
+    printer.Print(obj, out);
+    return out;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "object.h"
+
+// Writes the external representation of a value in one pass, without
+// recursion or per-atom temporaries. Cells and boxed vectors on the current
+// path are marked while they are printed; reaching a marked one again means
+// the structure is cyclic (set-car!, vector-set!), and the cycle is written
+// with datum labels, e.g. #0=(#0# 2 3). A node only turns out to need a
+// label after it was written, so labels are collected and spliced into the
+// output in one pass at the end.
+class Printer {
+private:
+    struct PathEntry {
+        Object* node;
+        std::size_t offset;
+        bool opens_list;
+        int label = -1;
+    };
+
+    // An open list, or a vector (cell is null) with index the next element
+    // to print.
+    struct Frame {
+        Cell* cell;
+        std::size_t path_begin;
+        int extra_closers = 0;
+        bool first_done = false;
+        bool rest_done = false;
+        Vector* vector = nullptr;
+        std::size_t index = 0;
+    };
+
+    // A label to insert at offset in the output once it is complete.
+    struct Label {
+        std::size_t offset;
+        int label;
+        bool opens_list;
+    };
+
+    std::vector<PathEntry> path_;
+    std::vector<Frame> frames_;
+    std::vector<Label> labels_;
+    std::string buffer_;
+    // The output from the first label on, while labels are inserted.
+    std::string tail_;
+    int next_label_ = 0;
+
+    static bool IsCompound(Object* obj);
+
+    void PrintAtom(Object* obj, std::string& out);
+    void PrintElement(Object* obj, std::string& out);
+    void Enter(Object* node, bool opens_list, std::string& out);
+    void Close(std::string& out);
+    void BackReference(Object* node, std::string& out);
+    void InsertLabels(std::string& out);
+    void Reset();
+public:
+    // Appends the representation of obj to out.
+    void Print(Object* obj, std::string& out);
+
+    void Print(Object* obj, std::ostream& out);
+};
+
+std::string ToString(Object* obj);
@@ -0,0 +1,154 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#include "heap.h"
+#include "object.h"
+
+namespace {
+
+uint64_t Nanoseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+}  // namespace
+
+Profiler::Profiler(const Heap* heap) : heap_(heap) {
+    nodes_.push_back(Node{0, 0});
+}
+
+std::size_t Profiler::FindRecord(Object* procedure) {
+    const void* key = procedure;
+    if (Is<Lambda>(procedure)) {
+        key = As<Lambda>(procedure)->GetPrototype().get();
+    }
+    auto [it, inserted] = record_index_.emplace(key, records_.size());
+    if (inserted) {
+        Record record;
+        if (Is<Lambda>(procedure)) {
+            record.prototype = As<Lambda>(procedure)->GetPrototype();
+            record.entry.name = record.prototype->name.empty() ? "lambda" : record.prototype->name;
+        } else {
+            record.native = procedure;
+        }
+        records_.push_back(std::move(record));
+    }
+    return it->second;
+}
+
+std::size_t Profiler::Allocated() const {
+    return heap_ != nullptr ? heap_->Allocated() : 0;
+}
+
+void Profiler::Enter(Object* procedure) {
+    std::size_t record = FindRecord(procedure);
+    ++records_[record].entry.calls;
+    ++records_[record].active;
+    std::size_t parent = calls_.empty() ? 0 : calls_.back().node;
+    auto [it, inserted] = children_.emplace((uint64_t{parent} << 32) | record, nodes_.size());
+    if (inserted) {
+        nodes_.push_back(Node{record, parent});
+    }
+    calls_.push_back(Call{it->second, Clock::now(), Allocated()});
+}
+
+void Profiler::Exit() {
+    if (calls_.empty()) {
+        // The call began before profiling was enabled.
+        return;
+    }
+    Call call = calls_.back();
+    calls_.pop_back();
+    uint64_t elapsed = Nanoseconds(Clock::now() - call.start);
+    std::size_t allocated = Allocated() - call.allocated;
+    Node& node = nodes_[call.node];
+    ProfileEntry& entry = records_[node.record].entry;
+    uint64_t exclusive = elapsed - std::min(call.callee_ns, elapsed);
+    node.exclusive_ns += exclusive;
+    entry.exclusive_ns += exclusive;
+    entry.allocated_bytes += allocated - call.callee_allocated;
+    if (--records_[node.record].active == 0) {
+        entry.inclusive_ns += elapsed;
+    }
+    if (!calls_.empty()) {
+        calls_.back().callee_ns += elapsed;
+        calls_.back().callee_allocated += allocated;
+    }
+}
+
+void Profiler::Unwind(std::size_t depth) {
+    while (calls_.size() > depth) {
+        Exit();
+    }
+}
+
+void Profiler::MarkRoots(Marker& marker) const {
+    for (const Record& record : records_) {
+        marker.Mark(record.native);
+    }
+}
+
+std::vector<std::string> Profiler::Names(const Environment& env) const {
+    std::unordered_map<const Object*, SymbolId> bindings;
+    env.ForEachBinding([&bindings](SymbolId id, Object* value) { bindings.emplace(value, id); });
+    std::vector<std::string> names;
+    for (const Record& record : records_) {
+        if (record.native == nullptr) {
+            names.push_back(record.entry.name);
+            continue;
+        }
+        auto binding = bindings.find(record.native);
+        names.push_back(binding != bindings.end() ? SymbolTable::Instance().Name(binding->second) : "#<procedure>");
+    }
+    return names;
+}
+
+std::vector<ProfileEntry> Profiler::Entries(const Environment& env) const {
+    std::vector<std::string> names = Names(env);
+    std::vector<ProfileEntry> entries;
+    for (std::size_t i = 0; i < records_.size(); ++i) {
+        entries.push_back(records_[i].entry);
+        entries.back().name = names[i];
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const ProfileEntry& a, const ProfileEntry& b) {
+        return a.exclusive_ns > b.exclusive_ns;
+    });
+    return entries;
+}
+
+void Profiler::WriteReport(std::ostream& out, const Environment& env) const {
+    out << std::left << std::setw(24) << "procedure" << std::right << std::setw(12) << "calls" << std::setw(16)
+        << "inclusive_us" << std::setw(16) << "exclusive_us" << std::setw(16) << "alloc_bytes" << '\n';
+    for (const ProfileEntry& entry : Entries(env)) {
+        out << std::left << std::setw(24) << entry.name << std::right << std::setw(12) << entry.calls
+            << std::setw(16) << entry.inclusive_ns / 1000 << std::setw(16) << entry.exclusive_ns / 1000
+            << std::setw(16) << entry.allocated_bytes << '\n';
+    }
+}
+
+void Profiler::WriteCollapsed(std::ostream& out, const Environment& env) const {
+    std::vector<std::string> names = Names(env);
+    std::vector<std::size_t> path;
+    for (std::size_t i = 1; i < nodes_.size(); ++i) {
+        if (nodes_[i].exclusive_ns == 0) {
+            continue;
+        }
+        path.clear();
+        for (std::size_t node = i; node != 0; node = nodes_[node].parent) {
+            path.push_back(node);
+        }
+        for (auto node = path.rbegin(); node != path.rend(); ++node) {
+            out << (node == path.rbegin() ? "" : ";") << names[nodes_[*node].record];
+        }
+        out << ' ' << nodes_[i].exclusive_ns << '\n';
+    }
+}
+
+void Profiler::Clear() {
+    records_.clear();
+    record_index_.clear();
+    nodes_.resize(1);
+    children_.clear();
+    calls_.clear();
+}
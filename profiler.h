@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bytecode.h"
+#include "environment.h"
+
+class Heap;
+class Marker;
+
+// Per-procedure statistics of a profile.
+struct ProfileEntry {
+    std::string name;
+    uint64_t calls = 0;
+    // Time until the outermost active call returns, so recursion is counted
+    // once.
+    uint64_t inclusive_ns = 0;
+    // Time not spent in procedures called from it.
+    uint64_t exclusive_ns = 0;
+    // Heap bytes allocated while it ran itself, not counting callees.
+    uint64_t allocated_bytes = 0;
+};
+
+// Records the procedure calls a VM makes (VM::SetProfiler): builtins are told
+// apart by object, user procedures by their compiled lambda. Besides the flat
+// statistics it keeps the call tree, for collapsed-stack output.
+class Profiler {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Record {
+        ProfileEntry entry;
+        // A builtin, named after its global binding when reported.
+        Object* native = nullptr;
+        // Kept so that its address isn't reused by another lambda.
+        std::shared_ptr<const Prototype> prototype;
+        std::size_t active = 0;
+    };
+
+    // A distinct call path; node 0 is the top level.
+    struct Node {
+        std::size_t record;
+        std::size_t parent;
+        uint64_t exclusive_ns = 0;
+    };
+
+    struct Call {
+        std::size_t node;
+        Clock::time_point start;
+        std::size_t allocated;
+        uint64_t callee_ns = 0;
+        std::size_t callee_allocated = 0;
+    };
+
+    const Heap* heap_;
+    std::vector<Record> records_;
+    std::unordered_map<const void*, std::size_t> record_index_;
+    std::vector<Node> nodes_;
+    std::unordered_map<uint64_t, std::size_t> children_;
+    std::vector<Call> calls_;
+
+    std::size_t FindRecord(Object* procedure);
+    std::size_t Allocated() const;
+    std::vector<std::string> Names(const Environment& env) const;
+public:
+    // Allocations are measured on heap, if given.
+    explicit Profiler(const Heap* heap = nullptr);
+
+    void Enter(Object* procedure);
+    void Exit();
+
+    // Calls in progress; Unwind exits those above depth, after an error.
+    std::size_t Depth() const {
+        return calls_.size();
+    }
+    void Unwind(std::size_t depth);
+
+    // Keeps the builtins it has seen alive, so their addresses stay theirs.
+    void MarkRoots(Marker& marker) const;
+
+    // Builtins are named after their bindings in env. Sorted by exclusive
+    // time, largest first.
+    std::vector<ProfileEntry> Entries(const Environment& env) const;
+
+    // A table of the entries.
+    void WriteReport(std::ostream& out, const Environment& env) const;
+
+    // One "outer;...;inner nanoseconds" line per call path with exclusive
+    // time, the input format of flame graph tools.
+    void WriteCollapsed(std::ostream& out, const Environment& env) const;
+
+    void Clear();
+};
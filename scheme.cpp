@@ -1,57 +1,441 @@
 #include "parser.h"
 #include "scheme.h"
-#include <iostream>
-
-std::map<std::string, std::shared_ptr<Object>> m;
-
-Interpreter::Interpreter() {
-    m.clear();
-    m["quote"] = std::shared_ptr<Quote>(new Quote());
-    m["number?"] = std::shared_ptr<CheckForNumber>(new CheckForNumber());
-    m["="] = std::shared_ptr<Equal>(new Equal());
-    m[">"] = std::shared_ptr<Greater>(new Greater());
-    m["<"] = std::shared_ptr<Less>(new Less());
-    m[">="] = std::shared_ptr<GreaterOrEqual>(new GreaterOrEqual());
-    m["<="] = std::shared_ptr<LessOrEqual>(new LessOrEqual());
-    m["+"] = std::shared_ptr<Sum>(new Sum());
-    m["-"] = std::shared_ptr<Subtraction>(new Subtraction());
-    m["*"] = std::shared_ptr<Multiplication>(new Multiplication());
-    m["/"] = std::shared_ptr<Division>(new Division());
-    m["max"] = std::shared_ptr<Max>(new Max());
-    m["min"] = std::shared_ptr<Min>(new Min());
-    m["abs"] = std::shared_ptr<Abs>(new Abs());
-    m["boolean?"] = std::shared_ptr<CheckForBoolean>(new CheckForBoolean());
-    m["not"] = std::shared_ptr<Not>(new Not());
-    m["and"] = std::shared_ptr<And>(new And());
-    m["or"] = std::shared_ptr<Or>(new Or());
-    m["pair?"] = std::shared_ptr<Pair>(new Pair());
-    m["null?"] = std::shared_ptr<Null>(new Null());
-    m["list?"] = std::shared_ptr<List>(new List());
-    m["cdr"] = std::shared_ptr<Cdr>(new Cdr());
-    m["car"] = std::shared_ptr<Car>(new Car());
-    m["cons"] = std::shared_ptr<Cons>(new Cons());
-    m["list"] = std::shared_ptr<Quote>(new Quote());
-    m["list-ref"] = std::shared_ptr<ListRef>(new ListRef());
-    m["list-tail"] = std::shared_ptr<ListTail>(new ListTail());
-    m["if"] = std::shared_ptr<If>(new If());
-    m["define"] = std::shared_ptr<Define>(new Define());
-    m["symbol?"] = std::shared_ptr<IsSymbol>(new IsSymbol());
-    m["set!"] = std::shared_ptr<Set>(new Set());
-    m["set-car!"] = std::shared_ptr<SetCar>(new SetCar());
-}
-
-std::string Interpreter::Run(std::string str) {
-    std::stringstream ss{str};
-    Tokenizer tokenizer{&ss};
+#include "code_cache.h"
+#include "mapped_file.h"
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+
+Interpreter::Interpreter() : env_(&heap_), vm_(&heap_) {
+    heap_.AddRoots(this);
+    HeapScope scope(heap_);
+    env_.Define(Intern("quote"), Make<SpecialForm>(Syntax::kQuote));
+    env_.Define(Intern("number?"), Make<CheckForNumber>());
+    env_.Define(Intern("="), Make<Equal>());
+    env_.Define(Intern(">"), Make<Greater>());
+    env_.Define(Intern("<"), Make<Less>());
+    env_.Define(Intern(">="), Make<GreaterOrEqual>());
+    env_.Define(Intern("<="), Make<LessOrEqual>());
+    env_.Define(Intern("+"), Make<Sum>());
+    env_.Define(Intern("-"), Make<Subtraction>());
+    env_.Define(Intern("*"), Make<Multiplication>());
+    env_.Define(Intern("/"), Make<Division>());
+    env_.Define(Intern("max"), Make<Max>());
+    env_.Define(Intern("min"), Make<Min>());
+    env_.Define(Intern("abs"), Make<Abs>());
+    env_.Define(Intern("boolean?"), Make<CheckForBoolean>());
+    env_.Define(Intern("not"), Make<Not>());
+    env_.Define(Intern("and"), Make<SpecialForm>(Syntax::kAnd));
+    env_.Define(Intern("or"), Make<SpecialForm>(Syntax::kOr));
+    env_.Define(Intern("pair?"), Make<Pair>());
+    env_.Define(Intern("null?"), Make<Null>());
+    env_.Define(Intern("list?"), Make<List>());
+    env_.Define(Intern("cdr"), Make<Cdr>());
+    env_.Define(Intern("car"), Make<Car>());
+    env_.Define(Intern("cons"), Make<Cons>());
+    env_.Define(Intern("list"), Make<MakeList>());
+    env_.Define(Intern("list-ref"), Make<ListRef>());
+    env_.Define(Intern("list-tail"), Make<ListTail>());
+    env_.Define(Intern("make-vector"), Make<MakeVector>());
+    env_.Define(Intern("vector"), Make<VectorOf>());
+    env_.Define(Intern("vector-length"), Make<VectorLength>());
+    env_.Define(Intern("vector-ref"), Make<VectorRef>());
+    env_.Define(Intern("vector-set!"), Make<VectorSet>());
+    env_.Define(Intern("vector-sum"), Make<VectorSum>());
+    env_.Define(Intern("vector-max"), Make<VectorMax>());
+    env_.Define(Intern("vector-min"), Make<VectorMin>());
+    env_.Define(Intern("vector-map"), Make<VectorMap>());
+    env_.Define(Intern("vector-fold"), Make<VectorFold>());
+    env_.Define(Intern("if"), Make<SpecialForm>(Syntax::kIf));
+    env_.Define(Intern("define"), Make<SpecialForm>(Syntax::kDefine));
+    env_.Define(Intern("symbol?"), Make<IsSymbol>());
+    env_.Define(Intern("set!"), Make<SpecialForm>(Syntax::kSet));
+    env_.Define(Intern("set-car!"), Make<SetCar>());
+    env_.Define(Intern("lambda"), Make<SpecialForm>(Syntax::kLambda));
+    env_.ForEachBinding([this](SymbolId id, Object* builtin) { builtins_.emplace_back(id, builtin); });
+}
+
+Interpreter::~Interpreter() {
+    heap_.RemoveRoots(this);
+}
+
+void Interpreter::MarkRoots(Marker& marker) {
+    marker.Mark(env_);
+    // Also once rebound, so that images never mistake another object at the
+    // same address for one.
+    for (const auto& [id, builtin] : builtins_) {
+        marker.Mark(builtin);
+    }
+    if (profiler_ != nullptr) {
+        profiler_->MarkRoots(marker);
+    }
+}
+
+Program::Program(Heap* heap) : heap_(heap) {
+    heap_->AddRoots(this);
+}
+
+Program::~Program() {
+    heap_->RemoveRoots(this);
+}
+
+void Program::MarkRoots(Marker& marker) {
+    marker.Mark(form_);
+    marker.Mark(chunk_);
+}
+
+Evaluation::Evaluation(Heap* heap) : heap_(heap) {
+    heap_->AddRoots(this);
+}
+
+Evaluation::~Evaluation() {
+    heap_->RemoveRoots(this);
+}
+
+void Evaluation::MarkRoots(Marker& marker) {
+    marker.Mark(chunk_);
+    paused_.Mark(marker);
+}
+
+// Compiles and runs one parsed form and prints its value into output_.
+const std::string& Interpreter::EvalPrint(Object* form) {
+    struct ChunkGuard {
+        Chunk& chunk;
+        ~ChunkGuard() {
+            // Constants point into the form, which becomes garbage.
+            chunk.constants.clear();
+        }
+    } guard{chunk_};
+    CompileForm(form, &chunk_);
+    return ExecutePrint(chunk_);
+}
+
+void Interpreter::CompileForm(Object* form, Chunk* chunk, std::vector<SyntaxAssumption>* assumptions) {
+    if (form == nullptr) {
+        throw RuntimeError("RuntimeError");
+    }
+    CompileOptions options;
+    options.max_depth = limits_.depth != 0 ? limits_.depth : CompileOptions::kMaxDepth;
+    options.assumptions = assumptions;
+    Compile(form, env_, chunk, options, &compile_stats_);
+}
+
+const std::string& Interpreter::ExecutePrint(const Chunk& chunk) {
+    auto result = vm_.Execute(chunk, env_);
+    output_.clear();
+    printer_.Print(result, output_);
+    heap_.Safepoint();
+    return output_;
+}
+
+const std::string& Interpreter::EvalForm(Tokenizer* tokenizer) {
+    HeapScope scope(heap_);
+    return EvalPrint(Read(tokenizer));
+}
+
+// Called before a Run reads anything, when no object is held outside the
+// roots.
+void Interpreter::BeginRun() {
+    // Garbage left behind by a Run that failed, maybe at the heap limit.
+    heap_.Safepoint();
+    heap_.ResetPeak();
+    run_start_allocated_ = heap_.Allocated();
+    vm_.ResetSteps();
+    vm_.ClearCancel();
+}
+
+std::string Interpreter::Run(std::string_view str) {
+    BeginRun();
+    Tokenizer tokenizer{str};
+    HeapScope scope(heap_);
+    auto obj = Read(&tokenizer);
+    if (!tokenizer.IsEnd()) { throw SyntaxError("SyntaxError"); }
+    return EvalPrint(obj);
+}
+
+std::unique_ptr<Program> Interpreter::Prepare(std::string_view str) {
+    heap_.Safepoint();
+    Tokenizer tokenizer{str};
+    HeapScope scope(heap_);
+    std::unique_ptr<Program> program(new Program(&heap_));
     auto obj = Read(&tokenizer);
     if (!tokenizer.IsEnd()) { throw SyntaxError("SyntaxError"); }
     if (obj == nullptr) {
         throw RuntimeError("RuntimeError");
     }
+    program->form_ = obj;
+    CompileProgram(program.get());
+    return program;
+}
+
+void Interpreter::CompileProgram(Program* program) {
+    CompileOptions options;
+    options.max_depth = limits_.depth != 0 ? limits_.depth : CompileOptions::kMaxDepth;
+    // Unlike a Run, a program is meant to be executed many times.
+    options.fold_top_level = true;
+    // Into the side first, so a program that fails to compile again is left
+    // as it was.
+    Chunk chunk;
+    std::vector<SyntaxAssumption> assumptions;
+    options.assumptions = &assumptions;
+    Compile(program->form_, env_, &chunk, options, &compile_stats_);
+    program->chunk_ = std::move(chunk);
+    program->assumptions_ = std::move(assumptions);
+    program->version_ = env_.Version();
+}
+
+std::string Interpreter::Execute(Program& program) {
+    if (program.heap_ != &heap_) {
+        throw RuntimeError("RuntimeError");
+    }
+    BeginRun();
+    HeapScope scope(heap_);
+    if (program.version_ != env_.Version()) {
+        if (AssumptionsHold(program.assumptions_, env_)) {
+            program.version_ = env_.Version();
+        } else {
+            CompileProgram(&program);
+        }
+    }
+    return ExecutePrint(program.chunk_);
+}
+
+std::unique_ptr<Evaluation> Interpreter::Start(std::string_view str, uint64_t fuel) {
+    BeginRun();
+    Tokenizer tokenizer{str};
+    HeapScope scope(heap_);
+    std::unique_ptr<Evaluation> evaluation(new Evaluation(&heap_));
+    auto obj = Read(&tokenizer);
+    if (!tokenizer.IsEnd()) { throw SyntaxError("SyntaxError"); }
+    CompileForm(obj, &evaluation->chunk_);
+    FinishSlice(*evaluation, vm_.Execute(evaluation->chunk_, env_, fuel, &evaluation->paused_));
+    return evaluation;
+}
+
+bool Interpreter::Resume(Evaluation& evaluation, uint64_t fuel) {
+    if (evaluation.heap_ != &heap_ || evaluation.Done()) {
+        throw RuntimeError("RuntimeError");
+    }
+    heap_.Safepoint();
+    vm_.ClearCancel();
+    HeapScope scope(heap_);
+    return FinishSlice(evaluation, vm_.Resume(&evaluation.paused_, env_, fuel));
+}
+
+// Prints the result of a slice that finished the evaluation.
+bool Interpreter::FinishSlice(Evaluation& evaluation, Object* result) {
+    if (!evaluation.Done()) {
+        heap_.Safepoint();
+        return false;
+    }
+    printer_.Print(result, evaluation.result_);
+    heap_.Safepoint();
+    return true;
+}
+
+void Interpreter::Cancel() {
+    vm_.Cancel();
+}
+
+void Interpreter::RunAll(std::string_view source, const ResultCallback& callback) {
+    BeginRun();
+    Tokenizer tokenizer{source};
+    while (!tokenizer.IsEnd()) {
+        const auto& result = EvalForm(&tokenizer);
+        if (callback) {
+            callback(result);
+        }
+    }
+}
+
+void Interpreter::RunAll(std::istream& in, std::ostream& out) {
+    BeginRun();
+    Tokenizer tokenizer{&in};
+    while (!tokenizer.IsEnd()) {
+        out << EvalForm(&tokenizer) << '\n';
+    }
+}
+
+void Interpreter::Load(const std::string& path, const ResultCallback& callback) {
+    MappedFile file(path);
+    RunAll(file.View(), callback);
+}
+
+namespace {
+
+// The forms of a LoadCached, whose code refers to objects nothing else keeps.
+class CachedForms : private RootSet {
+private:
+    Heap* heap_;
+public:
+    std::vector<CachedForm> forms;
+
+    explicit CachedForms(Heap* heap) : heap_(heap) {
+        heap_->AddRoots(this);
+    }
+    CachedForms(const CachedForms&) = delete;
+    CachedForms& operator=(const CachedForms&) = delete;
+    ~CachedForms() {
+        heap_->RemoveRoots(this);
+    }
+    void MarkRoots(Marker& marker) override {
+        for (const CachedForm& form : forms) {
+            marker.Mark(form.chunk);
+        }
+    }
+};
+
+// Writes a file under another name and renames it, so that loads running at
+// the same time never map a partial cache. Gives up quietly: the cache only
+// saves time.
+void WriteCacheFile(const std::string& path, const std::string& contents) {
+    static std::atomic<uint64_t> counter{0};
+    std::string temp = path + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        if (!out.flush()) {
+            out.close();
+            std::remove(temp.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+    }
+}
+
+}  // namespace
+
+void Interpreter::LoadCached(const std::string& path, const std::string& cache_path,
+                             const ResultCallback& callback) {
+    MappedFile file(path);
+    std::string_view source = file.View();
+    BeginRun();
+    CachedForms cached(&heap_);
+    bool hit = false;
+    try {
+        MappedFile cache(cache_path);
+        HeapScope scope(heap_);
+        hit = ReadCodeCache(cache.View(), source, builtins_, &cached.forms);
+    } catch (const RuntimeError&) {
+        // Missing, damaged or of another build.
+    }
+    if (hit) {
+        for (const CachedForm& form : cached.forms) {
+            HeapScope scope(heap_);
+            const std::string* result;
+            if (AssumptionsHold(form.assumptions, env_)) {
+                result = &ExecutePrint(form.chunk);
+            } else {
+                Tokenizer tokenizer{source.substr(form.begin, form.end - form.begin)};
+                result = &EvalPrint(Read(&tokenizer));
+            }
+            if (callback) {
+                callback(*result);
+            }
+        }
+        return;
+    }
+    cached.forms.clear();
+    CodeCacheWriter writer(builtins_, &heap_);
+    Tokenizer tokenizer{source};
+    while (!tokenizer.IsEnd()) {
+        HeapScope scope(heap_);
+        CachedForm& form = cached.forms.emplace_back();
+        form.begin = static_cast<uint32_t>(tokenizer.Position());
+        Object* parsed = Read(&tokenizer);
+        form.end = static_cast<uint32_t>(tokenizer.Position());
+        CompileForm(parsed, &form.chunk, &form.assumptions);
+        writer.Add(form);
+        const auto& result = ExecutePrint(form.chunk);
+        if (callback) {
+            callback(result);
+        }
+    }
+    // Forms are located by 32-bit offsets.
+    if (source.size() <= UINT32_MAX) {
+        WriteCacheFile(cache_path, writer.Finish(source));
+    }
+}
+
+void Interpreter::SaveImage(const std::string& path) const {
+    std::string image = WriteImage(env_, builtins_);
+    std::ofstream out(path, std::ios::binary);
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!out.flush()) {
+        throw RuntimeError("cannot write " + path);
+    }
+}
+
+void Interpreter::LoadImage(const std::string& path) {
+    MappedFile file(path);
+    heap_.Safepoint();
+    HeapScope scope(heap_);
+    ReadImage(file.View(), env_, builtins_);
+}
+
+void Interpreter::SetLimits(const Limits& limits) {
+    limits_ = limits;
+    heap_.SetLimit(limits.heap_bytes != 0 ? limits.heap_bytes : SIZE_MAX);
+    vm_.SetLimits(limits.depth != 0 ? limits.depth : SIZE_MAX, limits.steps != 0 ? limits.steps : UINT64_MAX);
+}
+
+MemoryUsage Interpreter::GetMemoryUsage() {
+    heap_.Collect();
+    MemoryUsage usage;
+    usage.live_bytes = heap_.Size();
+    usage.peak_bytes = heap_.Peak();
+    usage.allocated_bytes = heap_.Allocated() - run_start_allocated_;
+    usage.steps = vm_.Steps();
+    usage.collections = heap_.Collections();
+    std::vector<ObjectUsage> by_type;
+    heap_.ForEachObject([&by_type](const Object& obj, std::size_t bytes) {
+        auto index = static_cast<std::size_t>(obj.GetType());
+        while (by_type.size() <= index) {
+            by_type.push_back(ObjectUsage{static_cast<ObjectType>(by_type.size())});
+        }
+        ++by_type[index].count;
+        by_type[index].bytes += bytes;
+    });
+    for (const ObjectUsage& objects : by_type) {
+        if (objects.count != 0) {
+            usage.objects.push_back(objects);
+        }
+    }
+    return usage;
+}
+
+void Interpreter::EnableProfiling(bool enabled) {
+    if (enabled && profiler_ == nullptr) {
+        profiler_ = std::make_unique<Profiler>(&heap_);
+    }
+    vm_.SetProfiler(enabled ? profiler_.get() : nullptr);
+}
+
+bool Interpreter::IsProfiling() const {
+    return profiler_ != nullptr && vm_.GetProfiler() == profiler_.get();
+}
+
+void Interpreter::ClearProfile() {
+    if (profiler_ != nullptr) {
+        profiler_->Clear();
+    }
+}
+
+std::vector<ProfileEntry> Interpreter::Profile() const {
+    return profiler_ != nullptr ? profiler_->Entries(env_) : std::vector<ProfileEntry>();
+}
+
+void Interpreter::WriteProfile(std::ostream& out) const {
+    if (profiler_ != nullptr) {
+        profiler_->WriteReport(out, env_);
+    }
+}
 
-    auto cur = UnbindFunc(obj);
-    if (cur == nullptr) {
-        return "()";
+void Interpreter::WriteCollapsedStacks(std::ostream& out) const {
+    if (profiler_ != nullptr) {
+        profiler_->WriteCollapsed(out, env_);
     }
-    return As<Symbol>(cur->Eval())->GetName();
 }
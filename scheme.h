@@ -1,16 +1,214 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <ostream>
 #include <string>
-#include <sstream>
+#include <string_view>
+#include "compiler.h"
+#include "image.h"
 #include "object.h"
+#include "printer.h"
+#include "profiler.h"
+#include "vm.h"
 
-std::shared_ptr<Object> UnbindFunc(std::shared_ptr<Object> obj);
+using ResultCallback = std::function<void(const std::string&)>;
 
-void UnbindList(std::vector<std::shared_ptr<Object>>& objects,
-                                                std::shared_ptr<Object> cell);
+// What a Run may use before it fails with LimitError; 0 for no limit.
+struct Limits {
+    // Bytes taken by heap objects, garbage not yet collected included.
+    std::size_t heap_bytes = 0;
+    // Procedure calls in progress at once, and nesting of expressions.
+    std::size_t depth = 0;
+    // Procedure calls per Run.
+    uint64_t steps = 0;
+};
 
-class Interpreter {
+// Live heap objects of one type.
+struct ObjectUsage {
+    ObjectType type;
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+};
+
+struct MemoryUsage {
+    // Bytes taken by live objects.
+    std::size_t live_bytes = 0;
+    // The most the heap took during the last Run, garbage included.
+    std::size_t peak_bytes = 0;
+    // Bytes the last Run allocated.
+    std::size_t allocated_bytes = 0;
+    // Procedure calls the last Run made.
+    uint64_t steps = 0;
+    std::size_t collections = 0;
+    // By type, for the types with any.
+    std::vector<ObjectUsage> objects;
+};
+
+// An expression parsed and compiled once by Interpreter::Prepare, to be run
+// any number of times by Interpreter::Execute. Keeps the objects its code
+// refers to alive, so it must not outlive the interpreter. Its code is compiled
+// again when a special form it relies on was rebound since.
+class Program : private RootSet {
+private:
+    Heap* heap_;
+    Object* form_ = nullptr;
+    Chunk chunk_;
+    std::vector<SyntaxAssumption> assumptions_;
+    // Environment::Version when assumptions_ were last checked.
+    uint64_t version_ = 0;
+
+    friend class Interpreter;
+
+    explicit Program(Heap* heap);
+    void MarkRoots(Marker& marker) override;
+public:
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+    ~Program();
+};
+
+// An expression started by Interpreter::Start and evaluated a slice at a time:
+// it pauses once its fuel of procedure calls is spent, to be continued by
+// Interpreter::Resume. Keeps the objects its paused frames refer to alive, so
+// it must not outlive the interpreter; dropping it abandons the evaluation.
+class Evaluation : private RootSet {
+private:
+    Heap* heap_;
+    Chunk chunk_;
+    VM::Paused paused_;
+    std::string result_;
+
+    friend class Interpreter;
+
+    explicit Evaluation(Heap* heap);
+    void MarkRoots(Marker& marker) override;
+public:
+    Evaluation(const Evaluation&) = delete;
+    Evaluation& operator=(const Evaluation&) = delete;
+    ~Evaluation();
+
+    // Whether it has finished, with a value or an error.
+    bool Done() const {
+        return paused_.Empty();
+    }
+    // The printed value, once done without an error.
+    const std::string& Result() const {
+        return result_;
+    }
+};
+
+// Everything an interpreter creates lives in its heap, which is collected
+// between top-level forms and at calls.
+class Interpreter : private RootSet {
+private:
+    Heap heap_;
+    Environment env_;
+    Chunk chunk_;
+    VM vm_;
+    std::unique_ptr<Profiler> profiler_;
+    Printer printer_;
+    std::string output_;
+    Limits limits_;
+    CompileStats compile_stats_;
+    Builtins builtins_;
+    // Heap::Allocated when the last Run started.
+    std::size_t run_start_allocated_ = 0;
+
+    const std::string& EvalPrint(Object* form);
+    void CompileForm(Object* form, Chunk* chunk, std::vector<SyntaxAssumption>* assumptions = nullptr);
+    void CompileProgram(Program* program);
+    const std::string& ExecutePrint(const Chunk& chunk);
+    bool FinishSlice(Evaluation& evaluation, Object* result);
+    const std::string& EvalForm(Tokenizer* tokenizer);
+    void BeginRun();
+    void MarkRoots(Marker& marker) override;
 public:
     Interpreter();
-    std::string Run(std::string str);
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
+    ~Interpreter();
+
+    // Evaluates exactly one expression.
+    std::string Run(std::string_view str);
+
+    // Evaluates every top-level form in order with a single tokenizer, passing
+    // each printed result to the callback (or writing it as a line to out).
+    // Stops at the first error and rethrows it.
+    void RunAll(std::string_view source, const ResultCallback& callback);
+    void RunAll(std::istream& in, std::ostream& out);
+
+    // Parses and compiles exactly one expression, like Run without running it.
+    std::unique_ptr<Program> Prepare(std::string_view str);
+    // Evaluates a program prepared by this interpreter against the current
+    // bindings; the same as Run of its source. Recompiles it first if special
+    // forms were rebound since it was compiled.
+    std::string Execute(Program& program);
+
+    // Parses and compiles exactly one expression like Run, then evaluates it
+    // until it is done or, at a procedure call, fuel calls have been made (at
+    // least one is). Every loop is a call, so a slice takes bounded time,
+    // except that procedures called by builtins such as vector-map run to the
+    // end before it pauses.
+    std::unique_ptr<Evaluation> Start(std::string_view str, uint64_t fuel);
+    // Evaluates a paused evaluation of this interpreter for another slice of
+    // fuel calls; true once it is done. Errors are thrown as by Run, and end
+    // the evaluation. Runs in between slices see the globals it has defined
+    // so far. The limits apply to the evaluation as a whole.
+    bool Resume(Evaluation& evaluation, uint64_t fuel);
+
+    // May be called from any thread: the Run, RunAll, Load, Execute or slice
+    // (Start or Resume) in progress throws CancelledError at its next
+    // procedure call and leaves the interpreter usable. A cancelled slice
+    // ends its Evaluation only; other paused evaluations resume as usual.
+    // Every run and slice starts uncancelled, so a Cancel made while none is
+    // in progress, or after the last call of one, has no effect.
+    void Cancel();
+
+    // RunAll over a memory-mapped file.
+    void Load(const std::string& path, const ResultCallback& callback = nullptr);
+    // Like Load, but runs the code an earlier LoadCached compiled from the
+    // same source, read from cache_path, instead of parsing and compiling.
+    // Without one for this source and this build the source is compiled and
+    // the cache written, if it can be. A form whose special forms have been
+    // rebound since is compiled again.
+    void LoadCached(const std::string& path, const std::string& cache_path,
+                    const ResultCallback& callback = nullptr);
+
+    // Writes every global binding, with the data and procedures it reaches,
+    // to a binary image (image.h) at path.
+    void SaveImage(const std::string& path) const;
+    // Binds the globals of an image that SaveImage wrote, replacing those of
+    // the same names, without parsing or compiling anything. Images are read
+    // from a memory mapping and are for the build that wrote them.
+    void LoadImage(const std::string& path);
+
+    // Applies to every later Run, RunAll and Load as a whole. The step count
+    // and peak usage start over with each.
+    void SetLimits(const Limits& limits);
+    const Limits& GetLimits() const {
+        return limits_;
+    }
+
+    // Collects garbage first, so that only live objects are counted.
+    MemoryUsage GetMemoryUsage();
+
+    // Folds and prunes of every form compiled so far.
+    const CompileStats& GetCompileStats() const {
+        return compile_stats_;
+    }
+
+    // While profiling is enabled every procedure call is counted and timed;
+    // disabled, calls cost one pointer check. Disabling keeps the profile
+    // recorded so far, ClearProfile discards it.
+    void EnableProfiling(bool enabled = true);
+    bool IsProfiling() const;
+    void ClearProfile();
+
+    // Per-procedure statistics, by exclusive time, largest first.
+    std::vector<ProfileEntry> Profile() const;
+    // The statistics as a table.
+    void WriteProfile(std::ostream& out) const;
+    // Collapsed stacks with exclusive nanoseconds, for flame graph tools.
+    void WriteCollapsedStacks(std::ostream& out) const;
 };
\ No newline at end of file
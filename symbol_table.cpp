@@ -0,0 +1,88 @@
+#include "symbol_table.h"
+
+namespace {
+
+// What the current thread has looked up in the table lately. Forgotten once
+// it holds kMaxLocalSymbols, so that a thread running script after script
+// with names of their own doesn't keep a copy of the whole table.
+constexpr std::size_t kMaxLocalSymbols = 4096;
+
+struct LocalSymbols {
+    std::unordered_map<std::string_view, SymbolId> ids;
+    std::unordered_map<SymbolId, const std::string*> names;
+
+    void Remember(SymbolId id, const std::string* name) {
+        if (ids.size() == kMaxLocalSymbols || names.size() == kMaxLocalSymbols) {
+            ids.clear();
+            names.clear();
+        }
+        ids.emplace(*name, id);
+        names.emplace(id, name);
+    }
+};
+
+thread_local LocalSymbols local_symbols;
+
+}  // namespace
+
+SymbolTable& SymbolTable::Instance() {
+    static SymbolTable table;
+    return table;
+}
+
+const std::string& SymbolTable::InternLocked(std::string_view name, SymbolId* id) {
+    {
+        std::shared_lock lock(mutex_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            *id = it->second;
+            return names_[it->second];
+        }
+    }
+    std::unique_lock lock(mutex_);
+    auto it = ids_.find(name);
+    if (it != ids_.end()) {
+        *id = it->second;
+        return names_[it->second];
+    }
+    *id = static_cast<SymbolId>(names_.size());
+    names_.emplace_back(name);
+    ids_.emplace(names_.back(), *id);
+    return names_.back();
+}
+
+SymbolId SymbolTable::Intern(std::string_view name) {
+    LocalSymbols& local = local_symbols;
+    auto it = local.ids.find(name);
+    if (it != local.ids.end()) {
+        return it->second;
+    }
+    SymbolId id;
+    const std::string& stored = InternLocked(name, &id);
+    local.Remember(id, &stored);
+    return id;
+}
+
+const std::string& SymbolTable::Name(SymbolId id) const {
+    LocalSymbols& local = local_symbols;
+    auto it = local.names.find(id);
+    if (it != local.names.end()) {
+        return *it->second;
+    }
+    const std::string* name;
+    {
+        std::shared_lock lock(mutex_);
+        name = &names_[id];
+    }
+    local.Remember(id, name);
+    return *name;
+}
+
+std::size_t SymbolTable::Size() const {
+    std::shared_lock lock(mutex_);
+    return names_.size();
+}
+
+SymbolId Intern(std::string_view name) {
+    return SymbolTable::Instance().Intern(name);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using SymbolId = uint32_t;
+
+// Shared by all interpreters: interning takes a lock, but Symbol caches the
+// name pointer, so evaluation never touches the table. Ids are never taken
+// back and names never move, so every thread also remembers the ids and names
+// it has looked up recently and locks only for symbols new to it;
+// interpreters on other threads then don't contend even for the shared lock.
+//
+// As ids are never taken back, the table is bounded only by the distinct
+// names the process ever interns: each keeps its string and an index entry,
+// some 80 bytes beyond its length, until exit. Long-running processes that
+// evaluate scripts with names of their own grow it for good.
+class SymbolTable {
+private:
+    mutable std::shared_mutex mutex_;
+    std::deque<std::string> names_;
+    std::unordered_map<std::string_view, SymbolId> ids_;
+
+    SymbolTable() = default;
+    const std::string& InternLocked(std::string_view name, SymbolId* id);
+public:
+    static SymbolTable& Instance();
+
+    SymbolId Intern(std::string_view name);
+
+    const std::string& Name(SymbolId id) const;
+
+    // The names interned so far.
+    std::size_t Size() const;
+};
+
+SymbolId Intern(std::string_view name);
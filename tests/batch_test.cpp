@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+
+namespace {
+
+TEST(Batch, ResultsInScriptOrder) {
+    std::vector<std::string> scripts;
+    for (int i = 0; i < 500; ++i) {
+        // Uneven work, so that workers run out at different times and steal.
+        std::string work = i % 7 == 0 ? "(define (loop n) (if (= n 0) 0 (loop (- n 1)))) (loop 20000) " : "";
+        scripts.push_back(work + "(define x " + std::to_string(i) + ") (* x 2)");
+    }
+    BatchOptions options;
+    options.threads = 4;
+    BatchStats stats;
+    std::vector<BatchResult> results = RunBatch(scripts, options, &stats);
+    ASSERT_EQ(results.size(), scripts.size());
+    for (int i = 0; i < 500; ++i) {
+        EXPECT_EQ(results[i].status, BatchStatus::kOk) << i;
+        ASSERT_FALSE(results[i].values.empty()) << i;
+        EXPECT_EQ(results[i].values.back(), std::to_string(2 * i)) << i;
+    }
+    EXPECT_EQ(stats.scripts, 500u);
+    EXPECT_EQ(stats.failed, 0u);
+    EXPECT_EQ(stats.threads, 4u);
+}
+
+TEST(Batch, MapsErrorsToStatus) {
+    std::string deep;
+    for (int i = 0; i < 50000; ++i) {
+        deep += "(+ 1 ";
+    }
+    deep += "0" + std::string(50000, ')');
+    std::vector<std::string> scripts = {
+        "(+ 1 2)",
+        "(+ 1",
+        "(car 5)",
+        "(+ 1 undefined-name)",
+        "(define (loop) (loop)) (loop)",
+        deep,
+    };
+    BatchOptions options;
+    options.threads = 2;
+    options.limits.steps = 100000;
+    std::vector<BatchResult> results = RunBatch(scripts, options);
+    ASSERT_EQ(results.size(), scripts.size());
+    EXPECT_EQ(results[0].status, BatchStatus::kOk);
+    EXPECT_EQ(results[1].status, BatchStatus::kSyntaxError);
+    EXPECT_EQ(results[2].status, BatchStatus::kRuntimeError);
+    EXPECT_EQ(results[3].status, BatchStatus::kNameError);
+    EXPECT_EQ(results[4].status, BatchStatus::kLimitError);
+    EXPECT_EQ(results[5].status, BatchStatus::kLimitError);
+    for (std::size_t i = 1; i < results.size(); ++i) {
+        EXPECT_FALSE(results[i].error.empty()) << i;
+    }
+    EXPECT_STREQ(StatusName(results[0].status), "ok");
+    EXPECT_STREQ(StatusName(results[1].status), "SyntaxError");
+    EXPECT_STREQ(StatusName(results[2].status), "RuntimeError");
+    EXPECT_STREQ(StatusName(results[3].status), "NameError");
+    EXPECT_STREQ(StatusName(results[4].status), "LimitError");
+}
+
+TEST(Batch, OneFailureAmongMany) {
+    std::vector<std::string> scripts(300, "(define a 1) (+ a 1)");
+    scripts[137] = "(define a 1) a (car '()) (+ a 1)";
+    BatchOptions options;
+    options.threads = 3;
+    BatchStats stats;
+    std::vector<BatchResult> results = RunBatch(scripts, options, &stats);
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        if (i == 137) {
+            continue;
+        }
+        EXPECT_EQ(results[i].status, BatchStatus::kOk) << i;
+        EXPECT_EQ(results[i].values, (std::vector<std::string>{"()", "2"})) << i;
+    }
+    // What ran before the error is kept.
+    EXPECT_EQ(results[137].status, BatchStatus::kRuntimeError);
+    EXPECT_EQ(results[137].values, (std::vector<std::string>{"()", "1"}));
+    EXPECT_EQ(stats.failed, 1u);
+}
+
+TEST(Batch, ScriptsDoNotShareGlobals) {
+    std::vector<std::string> scripts;
+    for (int i = 0; i < 100; ++i) {
+        std::string script;
+        // Names of their own, as well as one every script defines.
+        for (int j = 0; j < 50; ++j) {
+            script += "(define batch-" + std::to_string(i) + "-" + std::to_string(j) + " " + std::to_string(j) + ") ";
+        }
+        script += i % 2 == 0 ? "(define shared " + std::to_string(i) + ") shared" : "shared";
+        scripts.push_back(script);
+    }
+    BatchOptions options;
+    options.threads = 4;
+    std::vector<BatchResult> results = RunBatch(scripts, options);
+    for (int i = 0; i < 100; ++i) {
+        if (i % 2 == 0) {
+            EXPECT_EQ(results[i].status, BatchStatus::kOk) << i;
+            EXPECT_EQ(results[i].values.back(), std::to_string(i)) << i;
+        } else {
+            EXPECT_EQ(results[i].status, BatchStatus::kNameError) << i;
+        }
+    }
+}
+
+TEST(Batch, HeapLimitPerScript) {
+    std::string defines;
+    for (int j = 0; j < 20000; ++j) {
+        defines += "(define many-" + std::to_string(j) + " " + std::to_string(j) + ") ";
+    }
+    std::vector<std::string> scripts = {"(+ 1 2)", defines, "(list 1 2 3)"};
+    BatchOptions options;
+    options.threads = 2;
+    options.limits.heap_bytes = 1 << 18;
+    std::vector<BatchResult> results = RunBatch(scripts, options);
+    EXPECT_EQ(results[0].status, BatchStatus::kOk);
+    EXPECT_EQ(results[1].status, BatchStatus::kLimitError);
+    EXPECT_EQ(results[2].status, BatchStatus::kOk);
+    EXPECT_EQ(results[2].values, (std::vector<std::string>{"(1 2 3)"}));
+}
+
+TEST(Batch, CancelledBeforeStarting) {
+    std::atomic<bool> cancel{true};
+    BatchOptions options;
+    options.threads = 2;
+    options.cancel = &cancel;
+    BatchStats stats;
+    std::vector<BatchResult> results = RunBatch(std::vector<std::string>(10, "(+ 1 2)"), options, &stats);
+    for (const BatchResult& result : results) {
+        EXPECT_EQ(result.status, BatchStatus::kCancelled);
+        EXPECT_TRUE(result.values.empty());
+    }
+    EXPECT_STREQ(StatusName(BatchStatus::kCancelled), "cancelled");
+    EXPECT_EQ(stats.cancelled, 10u);
+    EXPECT_EQ(stats.failed, 0u);
+}
+
+TEST(Batch, CancelStopsRunningScripts) {
+    // Scripts that never end unless cancelled, behind ones that end at once.
+    std::vector<std::string> scripts(4, "(+ 1 2)");
+    for (int i = 0; i < 4; ++i) {
+        scripts.push_back("(define (spin) (spin)) 'spinning (spin) 'never");
+    }
+    std::atomic<bool> cancel{false};
+    BatchOptions options;
+    options.threads = 2;
+    options.cancel = &cancel;
+    std::thread canceller([&cancel] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        cancel.store(true);
+    });
+    BatchStats stats;
+    std::vector<BatchResult> results = RunBatch(scripts, options, &stats);
+    canceller.join();
+    for (std::size_t i = 0; i < 4; ++i) {
+        EXPECT_EQ(results[i].status, BatchStatus::kOk) << i;
+    }
+    std::size_t stopped = 0;
+    for (std::size_t i = 4; i < results.size(); ++i) {
+        EXPECT_EQ(results[i].status, BatchStatus::kCancelled) << i;
+        // Those that were running keep what they printed.
+        if (!results[i].values.empty()) {
+            EXPECT_EQ(results[i].values, (std::vector<std::string>{"()", "spinning"})) << i;
+            ++stopped;
+        }
+    }
+    EXPECT_GE(stopped, 1u);
+    EXPECT_EQ(stats.cancelled, 4u);
+    EXPECT_EQ(stats.failed, 0u);
+}
+
+TEST(Batch, CountsNewSymbols) {
+    // Names no other run of the test has made.
+    static int runs = 0;
+    std::string prefix = "batch-new-symbol-" + std::to_string(runs++) + "-";
+    std::vector<std::string> scripts;
+    for (int i = 0; i < 100; ++i) {
+        scripts.push_back("(define " + prefix + std::to_string(i) + " 1)");
+    }
+    BatchStats stats;
+    RunBatch(scripts, {}, &stats);
+    EXPECT_GE(stats.new_symbols, 100u);
+    // The table keeps them: they aren't new the second time.
+    RunBatch(scripts, {}, &stats);
+    EXPECT_EQ(stats.new_symbols, 0u);
+}
+
+TEST(Batch, EmptyAndSmallBatches) {
+    BatchStats stats;
+    EXPECT_TRUE(RunBatch({}, {}, &stats).empty());
+    EXPECT_EQ(stats.scripts, 0u);
+    EXPECT_EQ(stats.threads, 1u);
+
+    BatchOptions options;
+    options.threads = 8;
+    std::vector<BatchResult> results = RunBatch({"1", "2"}, options, &stats);
+    EXPECT_EQ(stats.threads, 2u);
+    EXPECT_EQ(results[1].values, (std::vector<std::string>{"2"}));
+}
+
+}  // namespace
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "bignum.h"
+
+namespace {
+
+const BigInt kBase(int64_t{1} << 32);
+
+// The value of limbs, least significant first, built with additions and
+// multiplications by one limb only.
+BigInt FromLimbs(const std::vector<uint32_t>& limbs, bool negative = false) {
+    BigInt value(0);
+    for (std::size_t i = limbs.size(); i > 0; --i) {
+        value = value * kBase + BigInt(int64_t{limbs[i - 1]});
+    }
+    return negative ? value.Negate() : value;
+}
+
+std::vector<uint32_t> RandomLimbs(std::mt19937& rng, std::size_t size) {
+    std::vector<uint32_t> limbs(size);
+    for (uint32_t& limb : limbs) {
+        // Runs of all-ones limbs make carries travel far.
+        limb = rng() % 4 == 0 ? 0xffffffffu : static_cast<uint32_t>(rng());
+    }
+    if (size != 0 && limbs.back() == 0) {
+        limbs.back() = 1;
+    }
+    return limbs;
+}
+
+// a * b one limb of b at a time, which never takes the Karatsuba path.
+BigInt SchoolbookProduct(const BigInt& a, const std::vector<uint32_t>& b) {
+    BigInt product(0);
+    for (std::size_t i = b.size(); i > 0; --i) {
+        product = product * kBase + a * BigInt(int64_t{b[i - 1]});
+    }
+    return product;
+}
+
+// Checks a / b against the definition of truncating division.
+void ExpectQuotient(const BigInt& a, const BigInt& b) {
+    BigInt quotient = a / b;
+    BigInt remainder = a - quotient * b;
+    EXPECT_LT(Compare(remainder.Abs(), b.Abs()), 0) << a.ToString() << " / " << b.ToString();
+    EXPECT_TRUE(remainder.IsZero() || remainder.IsNegative() == a.IsNegative())
+        << a.ToString() << " / " << b.ToString();
+}
+
+TEST(BigInt, KaratsubaMatchesSchoolbook) {
+    std::mt19937 rng(42);
+    const std::pair<std::size_t, std::size_t> sizes[] = {{40, 40}, {41, 40}, {64, 64}, {79, 80},
+                                                         {40, 300}, {257, 100}, {500, 499}};
+    for (auto [a_size, b_size] : sizes) {
+        for (int round = 0; round < 3; ++round) {
+            std::vector<uint32_t> a_limbs = RandomLimbs(rng, a_size);
+            std::vector<uint32_t> b_limbs = RandomLimbs(rng, b_size);
+            BigInt a = FromLimbs(a_limbs);
+            BigInt expected = SchoolbookProduct(a, b_limbs);
+            BigInt b = FromLimbs(b_limbs);
+            EXPECT_EQ(Compare(a * b, expected), 0) << a_size << " x " << b_size;
+            EXPECT_EQ(Compare(b * a, expected), 0) << b_size << " x " << a_size;
+            EXPECT_EQ(Compare(a.Negate() * b, expected.Negate()), 0);
+            EXPECT_EQ(Compare(a.Negate() * b.Negate(), expected), 0);
+        }
+    }
+}
+
+TEST(BigInt, KaratsubaAllOnes) {
+    // (B^n - 1)^2 = B^2n - 2 B^n + 1.
+    std::vector<uint32_t> ones(128, 0xffffffffu);
+    BigInt a = FromLimbs(ones);
+    BigInt power = a + BigInt(1);
+    EXPECT_EQ(Compare(a * a, power * power - power - power + BigInt(1)), 0);
+}
+
+TEST(BigInt, DivisionUndoesMultiplication) {
+    std::mt19937 rng(7);
+    for (std::size_t b_size : {1, 2, 3, 17, 60}) {
+        for (std::size_t q_size : {1, 2, 5, 45}) {
+            BigInt b = FromLimbs(RandomLimbs(rng, b_size));
+            BigInt q = FromLimbs(RandomLimbs(rng, q_size));
+            BigInt r = FromLimbs(RandomLimbs(rng, b_size)) / BigInt(3);
+            if (Compare(r, b) >= 0) {
+                r = BigInt(0);
+            }
+            EXPECT_EQ(Compare((q * b + r) / b, q), 0) << b_size << ", " << q_size;
+            ExpectQuotient(q * b + r, b);
+        }
+    }
+}
+
+TEST(BigInt, DivisionRandomSigns) {
+    std::mt19937 rng(11);
+    for (int round = 0; round < 200; ++round) {
+        BigInt a = FromLimbs(RandomLimbs(rng, 1 + rng() % 12), rng() % 2 == 0);
+        BigInt b = FromLimbs(RandomLimbs(rng, 1 + rng() % 6), rng() % 2 == 0);
+        ExpectQuotient(a, b);
+    }
+}
+
+TEST(BigInt, DivisionAddsDivisorBack) {
+    // The first estimated quotient limb passes the two-limb test but is one
+    // too large: the multiply-subtract goes negative and is undone.
+    BigInt a = FromLimbs({0, 0, 0x80000000u, 0x7fffffffu});
+    BigInt b = FromLimbs({1, 0, 0x80000000u});
+    EXPECT_EQ((a / b).ToString(), "4294967294");
+    ExpectQuotient(a, b);
+
+    a = FromLimbs({3, 0, 0x80000000u});
+    b = FromLimbs({1, 0, 0x20000000u});
+    EXPECT_EQ((a / b).ToString(), "3");
+    ExpectQuotient(a, b);
+}
+
+TEST(BigInt, DivisionCorrectsEstimateTwice) {
+    // The estimate from the top two limbs is two too large.
+    BigInt a = FromLimbs({0, 0x7fffffffu, 0x80000000u, 0x7fffffffu});
+    BigInt b = FromLimbs({0x7fffffffu, 0xffffffffu});
+    EXPECT_EQ((a / b).ToString(), "9223372035781033984");
+    ExpectQuotient(a, b);
+}
+
+TEST(BigInt, DivisionByOneLimb) {
+    BigInt a = FromLimbs({0xffffffffu, 0xffffffffu, 0xffffffffu});
+    EXPECT_EQ((a / BigInt(0xffffffffLL)).ToString(), "18446744078004518913");
+    EXPECT_EQ((a / BigInt(1)).ToString(), a.ToString());
+    EXPECT_EQ((a / BigInt(-1)).ToString(), a.Negate().ToString());
+    ExpectQuotient(a, BigInt(7));
+    ExpectQuotient(a.Negate(), BigInt(7));
+}
+
+TEST(BigInt, DivisionTruncatesTowardsZero) {
+    EXPECT_EQ((BigInt(7) / BigInt(2)).ToString(), "3");
+    EXPECT_EQ((BigInt(-7) / BigInt(2)).ToString(), "-3");
+    EXPECT_EQ((BigInt(7) / BigInt(-2)).ToString(), "-3");
+    EXPECT_EQ((BigInt(-7) / BigInt(-2)).ToString(), "3");
+    EXPECT_TRUE((BigInt(-1) / BigInt(2)).IsZero());
+    EXPECT_FALSE((BigInt(-1) / BigInt(2)).IsNegative());
+
+    BigInt big = BigInt::Parse("-123456789012345678901234567890");
+    EXPECT_EQ((big / BigInt::Parse("1000000000000000000000")).ToString(), "-123456789");
+    EXPECT_TRUE((BigInt::Parse("99999999999999999999") / big).IsZero());
+    EXPECT_EQ((big / big).ToString(), "1");
+    EXPECT_EQ((big / big.Negate()).ToString(), "-1");
+}
+
+}  // namespace
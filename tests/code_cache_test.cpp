@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "code_cache.h"
+#include "scheme.h"
+
+namespace {
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+// Cells 1 ... length, made one at a time.
+Object* NumberList(int64_t length) {
+    Object* list = nullptr;
+    for (int64_t i = length; i > 0; --i) {
+        list = Make<Cell>(Number::Make(i), list);
+    }
+    return list;
+}
+
+TEST(CodeCacheWriter, KeepsAddedObjectsFromBeingReused) {
+    Heap heap;
+    HeapScope scope(heap);
+    Builtins builtins;
+    CodeCacheWriter writer(builtins, &heap);
+    CachedForm first;
+    first.chunk.constants.push_back(NumberList(3));
+    writer.Add(first);
+    // Nothing else refers to the list once the form has run: the next one
+    // made would get its cells, were they collected.
+    first.chunk.constants.clear();
+    heap.Collect();
+    CachedForm second;
+    second.chunk.constants.push_back(Make<Cell>(Number::Make(7), NumberList(2)));
+    writer.Add(second);
+
+    std::string cache = writer.Finish("source");
+    std::vector<CachedForm> forms;
+    ASSERT_TRUE(ReadCodeCache(cache, "source", builtins, &forms));
+    ASSERT_EQ(forms.size(), 2u);
+    EXPECT_EQ(ToString(forms[0].chunk.constants.at(0)), "(1 2 3)");
+    EXPECT_EQ(ToString(forms[1].chunk.constants.at(0)), "(7 1 2)");
+}
+
+// A source file and its cache in the test's temporary directory. Each source
+// defines a procedure with a call that is folded when it is compiled, so the
+// compile stats tell a load that compiled from one that used the cache.
+class CodeCache : public ::testing::Test {
+protected:
+    std::string source_path_;
+    std::string cache_path_;
+
+    void SetUp() override {
+        std::string name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        source_path_ = ::testing::TempDir() + name + ".scm";
+        cache_path_ = ::testing::TempDir() + name + ".cache";
+        std::remove(cache_path_.c_str());
+    }
+
+    void TearDown() override {
+        std::remove(source_path_.c_str());
+        std::remove(cache_path_.c_str());
+    }
+
+    // Loads the source in a new interpreter, or in *interpreter if given,
+    // and returns its results; *compiled is whether it was compiled.
+    std::vector<std::string> Load(bool* compiled, Interpreter* interpreter = nullptr) {
+        Interpreter own;
+        if (interpreter == nullptr) {
+            interpreter = &own;
+        }
+        std::size_t folded = interpreter->GetCompileStats().folded;
+        std::vector<std::string> results;
+        interpreter->LoadCached(source_path_, cache_path_,
+                                [&results](const std::string& result) { results.push_back(result); });
+        *compiled = interpreter->GetCompileStats().folded != folded;
+        return results;
+    }
+};
+
+TEST_F(CodeCache, SecondLoadUsesTheCache) {
+    WriteFile(source_path_, "(define (f) (+ 1 2)) (define x 10) (+ x (f))");
+    bool compiled;
+    EXPECT_EQ(Load(&compiled), (std::vector<std::string>{"()", "()", "13"}));
+    EXPECT_TRUE(compiled);
+    std::string cache = ReadFile(cache_path_);
+    EXPECT_FALSE(cache.empty());
+    EXPECT_EQ(Load(&compiled), (std::vector<std::string>{"()", "()", "13"}));
+    EXPECT_FALSE(compiled);
+    EXPECT_EQ(ReadFile(cache_path_), cache);
+}
+
+TEST_F(CodeCache, SourceChangeInvalidates) {
+    WriteFile(source_path_, "(define (f) (+ 1 2)) (+ 10 (f))");
+    bool compiled;
+    EXPECT_EQ(Load(&compiled).back(), "13");
+    // Same length, other text.
+    WriteFile(source_path_, "(define (f) (+ 1 2)) (+ 20 (f))");
+    EXPECT_EQ(Load(&compiled).back(), "23");
+    EXPECT_TRUE(compiled);
+    EXPECT_EQ(Load(&compiled).back(), "23");
+    EXPECT_FALSE(compiled);
+}
+
+TEST_F(CodeCache, OtherBytecodeVersionInvalidates) {
+    WriteFile(source_path_, "(define (f) (+ 1 2)) (f)");
+    bool compiled;
+    Load(&compiled);
+    std::string cache = ReadFile(cache_path_);
+    // The version follows the 8-byte magic and the format version; the
+    // checksum is made right again, as a build with another version would.
+    std::string other = cache;
+    uint32_t version = kBytecodeVersion + 1;
+    std::memcpy(other.data() + 12, &version, sizeof(version));
+    uint64_t checksum = HashBytes(std::string_view(other).substr(0, other.size() - sizeof(checksum)));
+    std::memcpy(other.data() + other.size() - sizeof(checksum), &checksum, sizeof(checksum));
+    WriteFile(cache_path_, other);
+
+    EXPECT_EQ(Load(&compiled).back(), "3");
+    EXPECT_TRUE(compiled);
+    // Written again for this build.
+    EXPECT_EQ(ReadFile(cache_path_), cache);
+}
+
+TEST_F(CodeCache, FailedChecksumInvalidates) {
+    WriteFile(source_path_, "(define (f) (+ 1 2)) (define big 123456789012345678901234567890) (f)");
+    bool compiled;
+    Load(&compiled);
+    std::string cache = ReadFile(cache_path_);
+    for (std::size_t at : {cache.size() / 3, cache.size() / 2, cache.size() - 1}) {
+        std::string damaged = cache;
+        damaged[at] ^= 0x10;
+        WriteFile(cache_path_, damaged);
+        EXPECT_EQ(Load(&compiled).back(), "3") << at;
+        EXPECT_TRUE(compiled) << at;
+        EXPECT_EQ(ReadFile(cache_path_), cache) << at;
+    }
+    WriteFile(cache_path_, cache.substr(0, cache.size() / 2));
+    EXPECT_EQ(Load(&compiled).back(), "3");
+    EXPECT_TRUE(compiled);
+}
+
+TEST_F(CodeCache, RebindingSpecialFormRecompilesForm) {
+    WriteFile(source_path_, "(define (f) (+ 1 2)) (if #f (f) (+ (f) 1))");
+    bool compiled;
+    EXPECT_EQ(Load(&compiled).back(), "4");
+
+    // With if bound to a procedure, the cached code of the form that
+    // compiled if as a special form is not used: it becomes a call.
+    Interpreter interpreter;
+    interpreter.Run("(define (if test then else) then)");
+    EXPECT_EQ(Load(&compiled, &interpreter), (std::vector<std::string>{"()", "3"}));
+    // The define of f, which assumed nothing about if, still comes from the
+    // cache.
+    EXPECT_FALSE(compiled);
+
+    EXPECT_EQ(Load(&compiled).back(), "4");
+    EXPECT_FALSE(compiled);
+}
+
+}  // namespace
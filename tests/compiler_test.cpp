@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "scheme.h"
+
+namespace {
+
+// (+ 1 (+ 1 ... (+ 1 0))) with depth additions.
+std::string NestedSum(std::size_t depth) {
+    std::string source;
+    for (std::size_t i = 0; i < depth; ++i) {
+        source += "(+ 1 ";
+    }
+    source += "0";
+    source.append(depth, ')');
+    return source;
+}
+
+TEST(Compiler, DeepNestingThrowsWithoutLimits) {
+    Interpreter interpreter;
+    EXPECT_THROW(interpreter.Run(NestedSum(50000)), LimitError);
+    EXPECT_EQ(interpreter.Run("(+ 1 2)"), "3");
+}
+
+TEST(Compiler, DeepNestingThrowsWithLargerLimit) {
+    Interpreter interpreter;
+    interpreter.SetLimits(Limits{0, 1000000, 0});
+    EXPECT_THROW(interpreter.Run(NestedSum(50000)), LimitError);
+    // In a procedure body, where calls on constants are folded.
+    EXPECT_THROW(interpreter.Run("(define (f x) " + NestedSum(50000) + ")"), LimitError);
+    EXPECT_THROW(interpreter.Prepare(NestedSum(50000)), LimitError);
+    EXPECT_EQ(interpreter.Run("(+ 1 2)"), "3");
+}
+
+TEST(Compiler, NestingBelowTheCapCompiles) {
+    Interpreter interpreter;
+    std::size_t depth = CompileOptions::kMaxDepth / 2;
+    EXPECT_EQ(interpreter.Run(NestedSum(depth)), std::to_string(depth));
+    interpreter.Run("(define (f) " + NestedSum(depth) + ")");
+    EXPECT_EQ(interpreter.Run("(f)"), std::to_string(depth));
+}
+
+TEST(Compiler, DepthLimitBelowTheCap) {
+    Interpreter interpreter;
+    interpreter.SetLimits(Limits{0, 100, 0});
+    EXPECT_EQ(interpreter.Run(NestedSum(50)), "50");
+    EXPECT_THROW(interpreter.Run(NestedSum(200)), LimitError);
+}
+
+TEST(Compiler, CountsFoldedCallsAndSites) {
+    Interpreter interpreter;
+    interpreter.Run("(define (f x) (+ x (* 2 (- 5 2)) (max 1 4)))");
+    EXPECT_EQ(interpreter.GetCompileStats().folded, 3u);
+    EXPECT_EQ(interpreter.GetCompileStats().fold_sites, 2u);
+    EXPECT_EQ(interpreter.Run("(f 1)"), "11");
+}
+
+}  // namespace
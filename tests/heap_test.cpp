@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "scheme.h"
+
+namespace {
+
+class TestRoots : public RootSet {
+public:
+    std::vector<Object*> objects;
+
+    void MarkRoots(Marker& marker) override {
+        for (Object* obj : objects) {
+            marker.Mark(obj);
+        }
+    }
+};
+
+std::size_t CountObjects(const Heap& heap) {
+    std::size_t count = 0;
+    heap.ForEachObject([&count](const Object&, std::size_t) { ++count; });
+    return count;
+}
+
+TEST(Heap, CollectsUnreachableCycle) {
+    Heap heap;
+    HeapScope scope(heap);
+    Cell* a = Make<Cell>();
+    Cell* b = Make<Cell>(a, nullptr);
+    a->SetSecond(b);
+    a->SetFirst(a);
+    EXPECT_EQ(CountObjects(heap), 2u);
+    heap.Collect();
+    EXPECT_EQ(CountObjects(heap), 0u);
+    EXPECT_EQ(heap.Size(), 0u);
+}
+
+TEST(Heap, KeepsCycleReachableFromRoot) {
+    Heap heap;
+    HeapScope scope(heap);
+    TestRoots roots;
+    heap.AddRoots(&roots);
+    Cell* a = Make<Cell>();
+    Cell* b = Make<Cell>(Make<Symbol>("b"), a);
+    a->SetSecond(b);
+    Make<Cell>(a, b);
+    roots.objects.push_back(b);
+    heap.Collect();
+    EXPECT_EQ(CountObjects(heap), 3u);
+    EXPECT_EQ(a->GetSecond(), b);
+    EXPECT_EQ(As<Symbol>(b->GetFirst())->GetName(), "b");
+
+    roots.objects.clear();
+    heap.Collect();
+    EXPECT_EQ(CountObjects(heap), 0u);
+    heap.RemoveRoots(&roots);
+}
+
+TEST(Heap, ClosureKeepsWhatItCaptured) {
+    Interpreter interpreter;
+    interpreter.Run("(define (make-getter) (define data (list 1 (list 2 3) 4)) (lambda () data))");
+    interpreter.Run("(define get (make-getter))");
+    interpreter.Run("(define make-getter 0)");
+    std::size_t before = interpreter.GetMemoryUsage().collections;
+    // Reuses whatever the collection freed.
+    interpreter.Run("(define junk (list 7 7 7 7 7 7 7 7 7 7 7 7))");
+    EXPECT_GT(interpreter.GetMemoryUsage().collections, before);
+    EXPECT_EQ(interpreter.Run("(get)"), "(1 (2 3) 4)");
+}
+
+TEST(Heap, CollectsAtCallsWhileFramesHoldObjects) {
+    Interpreter interpreter;
+    interpreter.Run("(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))");
+    // keep lives only in the frames of churn, and of the closure made in it,
+    // while every round allocates garbage past the collection threshold.
+    interpreter.Run(
+        "(define (churn n keep)"
+        "  (define (again) (churn (- n 1) keep))"
+        "  (if (= n 0) keep (if (null? (build 2000 '())) 0 (again))))");
+    std::size_t before = interpreter.GetMemoryUsage().collections;
+    EXPECT_EQ(interpreter.Run("(churn 300 (list 1 (vector 2 3) 4))"), "(1 #(2 3) 4)");
+    EXPECT_GT(interpreter.GetMemoryUsage().collections, before + 1);
+    EXPECT_LT(interpreter.GetMemoryUsage().live_bytes, std::size_t{1} << 20);
+}
+
+TEST(Heap, LimitCountsGarbageUntilCollected) {
+    Interpreter interpreter;
+    interpreter.Run("(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))");
+    interpreter.SetLimits(Limits{1 << 20, 0, 0});
+    // Each list fits, all of them together don't: collections make room.
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(interpreter.Run("(list-ref (build 10000 '()) 9999)"), "10000");
+    }
+    EXPECT_THROW(interpreter.Run("(build 100000 '())"), LimitError);
+    EXPECT_EQ(interpreter.Run("(+ 1 2)"), "3");
+}
+
+}  // namespace
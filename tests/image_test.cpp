@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "scheme.h"
+
+namespace {
+
+std::string ImagePath(const std::string& name) {
+    return ::testing::TempDir() + name + ".img";
+}
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+TEST(Image, KeepsSharing) {
+    std::string path = ImagePath("sharing");
+    {
+        Interpreter interpreter;
+        interpreter.Run("(define a (list 1 2))");
+        interpreter.Run("(define b (list a a (vector a 3)))");
+        interpreter.SaveImage(path);
+    }
+    Interpreter interpreter;
+    interpreter.LoadImage(path);
+    EXPECT_EQ(interpreter.Run("b"), "((1 2) (1 2) #((1 2) 3))");
+    // One list, reached from a global, from two cells and from a vector.
+    interpreter.Run("(set-car! a 7)");
+    EXPECT_EQ(interpreter.Run("b"), "((7 2) (7 2) #((7 2) 3))");
+}
+
+TEST(Image, KeepsCycles) {
+    std::string path = ImagePath("cycles");
+    {
+        Interpreter interpreter;
+        interpreter.Run("(define c (list 1 2))");
+        interpreter.Run("(set-car! c c)");
+        interpreter.Run("(define v (vector 0 0))");
+        interpreter.Run("(vector-set! v 1 v)");
+        interpreter.SaveImage(path);
+    }
+    Interpreter interpreter;
+    interpreter.LoadImage(path);
+    EXPECT_EQ(interpreter.Run("(car (cdr (car (car c))))"), "2");
+    EXPECT_EQ(interpreter.Run("(vector-length (vector-ref (vector-ref v 1) 1))"), "2");
+    interpreter.Run("(vector-set! v 0 5)");
+    EXPECT_EQ(interpreter.Run("(vector-ref (vector-ref v 1) 0)"), "5");
+}
+
+TEST(Image, KeepsClosures) {
+    std::string path = ImagePath("closures");
+    {
+        Interpreter interpreter;
+        interpreter.Run("(define (make-counter) (define n 0) (list (lambda () (set! n (+ n 1)) n) (lambda () n)))");
+        interpreter.Run("(define counter (make-counter))");
+        interpreter.Run("(define inc (car counter))");
+        interpreter.Run("(define get (car (cdr counter)))");
+        interpreter.Run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+        interpreter.Run("(define (g) (h))");
+        interpreter.Run("(define (h) 1)");
+        interpreter.Run("(inc)");
+        interpreter.SaveImage(path);
+    }
+    Interpreter interpreter;
+    interpreter.LoadImage(path);
+    // Both closures still share the one variable they captured.
+    EXPECT_EQ(interpreter.Run("(inc)"), "2");
+    EXPECT_EQ(interpreter.Run("(get)"), "2");
+    EXPECT_EQ(interpreter.Run("(fib 20)"), "6765");
+    // Globals in the loaded code are looked up by name.
+    interpreter.Run("(define (h) 2)");
+    EXPECT_EQ(interpreter.Run("(g)"), "2");
+}
+
+TEST(Image, ReplacesOnlyItsOwnBindings) {
+    std::string path = ImagePath("replace");
+    {
+        Interpreter interpreter;
+        interpreter.Run("(define x 1)");
+        interpreter.SaveImage(path);
+    }
+    Interpreter interpreter;
+    interpreter.Run("(define x 10)");
+    interpreter.Run("(define y 20)");
+    interpreter.LoadImage(path);
+    EXPECT_EQ(interpreter.Run("(+ x y)"), "21");
+}
+
+TEST(Image, BindsNothingAtTheHeapLimit) {
+    constexpr int kGlobals = 200;
+    std::string path = ImagePath("limit");
+    {
+        Interpreter interpreter;
+        interpreter.Run("(define x 1)");
+        for (int i = 0; i < kGlobals; ++i) {
+            interpreter.Run("(define g" + std::to_string(i) + " " + std::to_string(i) + ")");
+        }
+        interpreter.SaveImage(path);
+    }
+    Interpreter interpreter;
+    interpreter.Run("(define x 10)");
+    // Room for a few more bindings, not for all of them.
+    std::size_t live = interpreter.GetMemoryUsage().live_bytes;
+    interpreter.SetLimits(Limits{live + 64, 0, 0});
+    EXPECT_THROW(interpreter.LoadImage(path), LimitError);
+    EXPECT_EQ(interpreter.Run("x"), "10");
+    for (int i = 0; i < kGlobals; ++i) {
+        EXPECT_THROW(interpreter.Run("g" + std::to_string(i)), NameError) << i;
+    }
+
+    interpreter.SetLimits(Limits{});
+    interpreter.LoadImage(path);
+    EXPECT_EQ(interpreter.Run("x"), "1");
+    EXPECT_EQ(interpreter.Run("(+ g0 g199)"), "199");
+}
+
+TEST(Image, RejectsCorruptChecksum) {
+    std::string path = ImagePath("corrupt");
+    {
+        Interpreter interpreter;
+        interpreter.Run("(define data (list 1 2 3))");
+        interpreter.SaveImage(path);
+    }
+    std::string image = ReadFile(path);
+    ASSERT_GT(image.size(), 16u);
+
+    std::string flipped = image;
+    flipped[flipped.size() / 2] ^= 1;
+    WriteFile(path, flipped);
+    Interpreter interpreter;
+    EXPECT_THROW(interpreter.LoadImage(path), RuntimeError);
+    EXPECT_THROW(interpreter.Run("data"), NameError);
+
+    std::string checksum = image;
+    checksum.back() ^= 0x80;
+    WriteFile(path, checksum);
+    EXPECT_THROW(interpreter.LoadImage(path), RuntimeError);
+
+    WriteFile(path, image.substr(0, image.size() - 1));
+    EXPECT_THROW(interpreter.LoadImage(path), RuntimeError);
+    EXPECT_THROW(interpreter.Run("data"), NameError);
+
+    WriteFile(path, image);
+    interpreter.LoadImage(path);
+    EXPECT_EQ(interpreter.Run("data"), "(1 2 3)");
+}
+
+}  // namespace
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "kernels.h"
+
+namespace {
+
+// Lengths around the widths the kernels unroll to (2 and 4 values), and
+// longer ones with every tail.
+const std::size_t kLengths[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 100, 1001};
+
+BigInt ScalarSum(const int64_t* values, std::size_t count) {
+    BigInt sum(0);
+    for (std::size_t i = 0; i < count; ++i) {
+        sum = sum + BigInt(values[i]);
+    }
+    return sum;
+}
+
+// Checks SumFixnums against ScalarSum, returning whether it fit in 64 bits.
+bool ExpectSum(const int64_t* values, std::size_t count) {
+    int64_t sum = 0;
+    BigInt big;
+    BigInt expected = ScalarSum(values, count);
+    int64_t expected_fixnum;
+    bool fits = expected.ToInt64(&expected_fixnum);
+    bool fixnum = SumFixnums(values, count, &sum, &big);
+    EXPECT_EQ(fixnum, fits) << count;
+    if (fixnum) {
+        EXPECT_EQ(sum, expected_fixnum) << count;
+    } else {
+        EXPECT_EQ(Compare(big, expected), 0) << count;
+    }
+    return fixnum;
+}
+
+std::vector<int64_t> RandomValues(std::mt19937_64& rng, std::size_t count) {
+    std::vector<int64_t> values(count);
+    for (int64_t& value : values) {
+        value = static_cast<int64_t>(rng()) >> (rng() % 64);
+    }
+    return values;
+}
+
+TEST(Kernels, SumMatchesScalarLoop) {
+    std::mt19937_64 rng(3);
+    for (std::size_t length : kLengths) {
+        // One extra value in front: offset 1 starts off a 16-byte boundary.
+        std::vector<int64_t> values = RandomValues(rng, length + 1);
+        for (std::size_t offset : {0, 1}) {
+            ExpectSum(values.data() + offset, length);
+        }
+    }
+}
+
+TEST(Kernels, SumOfNothingIsZero) {
+    int64_t sum = 1;
+    BigInt big;
+    EXPECT_TRUE(SumFixnums(nullptr, 0, &sum, &big));
+    EXPECT_EQ(sum, 0);
+}
+
+TEST(Kernels, SumPromotesToBignum) {
+    for (std::size_t length : kLengths) {
+        if (length < 2) {
+            continue;
+        }
+        std::vector<int64_t> values(length + 1, INT64_MAX);
+        for (std::size_t offset : {0, 1}) {
+            EXPECT_FALSE(ExpectSum(values.data() + offset, length)) << length;
+        }
+        values.assign(length + 1, INT64_MIN);
+        for (std::size_t offset : {0, 1}) {
+            EXPECT_FALSE(ExpectSum(values.data() + offset, length)) << length;
+        }
+    }
+    // The last value overflows, in the tail after the full vectors.
+    std::vector<int64_t> values = {0, 0, 0, INT64_MAX, 1};
+    EXPECT_FALSE(ExpectSum(values.data(), values.size()));
+}
+
+TEST(Kernels, SumOverflowsOnlyInTheMiddle) {
+    // Partial sums leave 64 bits, the total comes back.
+    std::vector<int64_t> values = {INT64_MAX, INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN, INT64_MIN, 5};
+    for (std::size_t offset : {0, 1}) {
+        EXPECT_TRUE(ExpectSum(values.data() + offset, values.size() - offset));
+    }
+    std::vector<int64_t> edge = {INT64_MAX, 0, 0, 0, 0};
+    EXPECT_TRUE(ExpectSum(edge.data(), edge.size()));
+    edge = {INT64_MIN, -1, 1, 0, 0};
+    EXPECT_TRUE(ExpectSum(edge.data(), edge.size()));
+    edge.push_back(-1);
+    EXPECT_FALSE(ExpectSum(edge.data(), edge.size()));
+}
+
+TEST(Kernels, ExtremesMatchScalarLoop) {
+    std::mt19937_64 rng(5);
+    for (std::size_t length : kLengths) {
+        if (length == 0) {
+            continue;
+        }
+        std::vector<int64_t> values = RandomValues(rng, length + 1);
+        for (std::size_t offset : {0, 1}) {
+            const int64_t* begin = values.data() + offset;
+            EXPECT_EQ(MaxFixnum(begin, length), *std::max_element(begin, begin + length)) << length;
+            EXPECT_EQ(MinFixnum(begin, length), *std::min_element(begin, begin + length)) << length;
+        }
+    }
+}
+
+TEST(Kernels, ExtremeInEveryPosition) {
+    for (std::size_t length : kLengths) {
+        for (std::size_t at = 0; at < length && at < 20; ++at) {
+            std::vector<int64_t> values(length, 0);
+            values[at] = INT64_MAX;
+            EXPECT_EQ(MaxFixnum(values.data(), length), INT64_MAX) << length << " at " << at;
+            EXPECT_EQ(MinFixnum(values.data(), length), length == 1 ? INT64_MAX : 0) << length << " at " << at;
+            values[at] = INT64_MIN;
+            EXPECT_EQ(MinFixnum(values.data(), length), INT64_MIN) << length << " at " << at;
+        }
+    }
+}
+
+}  // namespace
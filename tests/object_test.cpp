@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "scheme.h"
+
+namespace {
+
+TEST(Fixnums, RoundTripWithoutAllocating) {
+    Heap heap;
+    HeapScope scope(heap);
+    for (int64_t value : {int64_t{0}, int64_t{1}, int64_t{-1}, int64_t{1024}, int64_t{1025}, int64_t{-129},
+                          int64_t{1} << 40, -(int64_t{1} << 40), Number::kMinFixnum, Number::kMaxFixnum}) {
+        Object* number = Number::Make(value);
+        EXPECT_TRUE(IsFixnum(number)) << value;
+        EXPECT_TRUE(Is<Number>(number)) << value;
+        EXPECT_FALSE(Is<Cell>(number)) << value;
+        EXPECT_EQ(Number::ValueOf(number), value);
+        EXPECT_EQ(Number::Make(value), number) << value;
+    }
+    EXPECT_EQ(heap.Size(), 0u);
+}
+
+TEST(Fixnums, OutsideTheRangeAreObjects) {
+    Heap heap;
+    HeapScope scope(heap);
+    for (int64_t value : {Number::kMaxFixnum + 1, Number::kMinFixnum - 1, INT64_MAX, INT64_MIN}) {
+        Object* number = Number::Make(value);
+        EXPECT_FALSE(IsFixnum(number)) << value;
+        EXPECT_TRUE(Is<Number>(number)) << value;
+        EXPECT_EQ(Number::ValueOf(number), value);
+    }
+    EXPECT_GT(heap.Size(), 0u);
+    EXPECT_THROW(Number::ValueOf(Boolean::True()), RuntimeError);
+    EXPECT_THROW(Number::ValueOf(nullptr), RuntimeError);
+}
+
+TEST(Fixnums, ArithmeticAcrossTheBoundary) {
+    Interpreter interpreter;
+    interpreter.Run("(define max-fixnum 4611686018427387903)");
+    EXPECT_EQ(interpreter.Run("(+ max-fixnum 1)"), "4611686018427387904");
+    EXPECT_EQ(interpreter.Run("(- (+ max-fixnum 1) 1)"), "4611686018427387903");
+    EXPECT_EQ(interpreter.Run("(- 0 max-fixnum 2)"), "-4611686018427387905");
+    EXPECT_EQ(interpreter.Run("(= (+ max-fixnum 1) 4611686018427387904)"), "#t");
+    EXPECT_EQ(interpreter.Run("(< max-fixnum (+ max-fixnum 1) 9223372036854775807)"), "#t");
+    EXPECT_EQ(interpreter.Run("(* 2 (+ max-fixnum 1))"), "9223372036854775808");
+    EXPECT_EQ(interpreter.Run("(abs -9223372036854775807)"), "9223372036854775807");
+}
+
+TEST(Fixnums, InDataStructuresAcrossCollections) {
+    Interpreter interpreter;
+    interpreter.Run("(define xs (list 1 -2 4611686018427387904 -9223372036854775808))");
+    interpreter.Run("(define v (vector 1 xs))");
+    // Enough garbage for several collections.
+    interpreter.Run("(define (churn n) (if (= n 0) 0 (begin-churn n)))");
+    interpreter.Run("(define (begin-churn n) (cons n n) (churn (- n 1)))");
+    interpreter.Run("(churn 200000)");
+    EXPECT_EQ(interpreter.Run("xs"), "(1 -2 4611686018427387904 -9223372036854775808)");
+    EXPECT_EQ(interpreter.Run("(vector-ref v 0)"), "1");
+    EXPECT_EQ(interpreter.Run("(list-ref (vector-ref v 1) 2)"), "4611686018427387904");
+}
+
+}  // namespace
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "parser.h"
+#include "scheme.h"
+
+namespace {
+
+// Reads exactly one datum from source into the current heap.
+Object* ReadOne(std::string_view source) {
+    Tokenizer tokenizer{source};
+    Object* obj = Read(&tokenizer);
+    if (!tokenizer.IsEnd()) {
+        throw SyntaxError("SyntaxError");
+    }
+    return obj;
+}
+
+TEST(Parser, ReadsVeryLongList) {
+    Heap heap;
+    HeapScope scope(heap);
+    constexpr int kLength = 1000000;
+    std::string source = "(";
+    for (int i = 0; i < kLength; ++i) {
+        source += std::to_string(i % 10);
+        source += ' ';
+    }
+    source += ")";
+    Object* list = ReadOne(source);
+    int length = 0;
+    for (Object* cur = list; cur != nullptr; cur = As<Cell>(cur)->GetSecond()) {
+        EXPECT_EQ(Number::ValueOf(As<Cell>(cur)->GetFirst()), length % 10);
+        ++length;
+    }
+    EXPECT_EQ(length, kLength);
+}
+
+TEST(Parser, ReadsNestingTooDeepForRecursion) {
+    Heap heap;
+    HeapScope scope(heap);
+    // Deep enough to overflow the native stack one frame per level.
+    constexpr int kDepth = 1000000;
+    std::string source(kDepth, '(');
+    source += "x";
+    source.append(kDepth, ')');
+    Object* obj = ReadOne(source);
+    int depth = 0;
+    while (Is<Cell>(obj)) {
+        EXPECT_EQ(As<Cell>(obj)->GetSecond(), nullptr);
+        obj = As<Cell>(obj)->GetFirst();
+        ++depth;
+    }
+    EXPECT_EQ(depth, kDepth);
+    EXPECT_EQ(As<Symbol>(obj)->GetName(), "x");
+
+    std::string quotes(kDepth, '\'');
+    quotes += "y";
+    obj = ReadOne(quotes);
+    // 'x is read as (quote . x).
+    for (depth = 0; Is<Cell>(obj); ++depth) {
+        EXPECT_EQ(As<Symbol>(As<Cell>(obj)->GetFirst())->GetName(), "quote");
+        obj = As<Cell>(obj)->GetSecond();
+    }
+    EXPECT_EQ(depth, kDepth);
+}
+
+TEST(Parser, ReadsDottedPairs) {
+    Interpreter interpreter;
+    EXPECT_EQ(interpreter.Run("'(1 . 2)"), "(1 . 2)");
+    EXPECT_EQ(interpreter.Run("'(1 2 . 3)"), "(1 2 . 3)");
+    EXPECT_EQ(interpreter.Run("'(1 . (2 . (3 . ())))"), "(1 2 3)");
+    EXPECT_EQ(interpreter.Run("'((1 . 2) . (3 . 4))"), "((1 . 2) 3 . 4)");
+    EXPECT_EQ(interpreter.Run("(cdr '(a . b))"), "b");
+}
+
+TEST(Parser, RejectsMalformedDots) {
+    Interpreter interpreter;
+    for (const char* source : {"'(. 1)", "'(1 .)", "'(1 . 2 3)", "'(1 . . 2)", "'(.)", "'#(1 . 2)"}) {
+        EXPECT_THROW(interpreter.Run(source), SyntaxError) << source;
+    }
+}
+
+TEST(Parser, RejectsUnbalancedParens) {
+    Interpreter interpreter;
+    for (const char* source : {"(+ 1 2", "((1 2)", "'(1 (2 3)", ")", "(+ 1 2))", "'(1))", "#(1 2", "'"}) {
+        EXPECT_THROW(interpreter.Run(source), SyntaxError) << source;
+    }
+    std::string deep(100000, '(');
+    EXPECT_THROW(interpreter.Run(deep), SyntaxError);
+    // Still usable.
+    EXPECT_EQ(interpreter.Run("(+ 1 2)"), "3");
+}
+
+}  // namespace
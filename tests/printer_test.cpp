@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "scheme.h"
+
+namespace {
+
+// A proper list of the numbers first, ..., first + length - 1.
+Cell* NumberList(int64_t first, int length) {
+    Object* list = nullptr;
+    for (int i = length - 1; i >= 0; --i) {
+        list = Make<Cell>(Number::Make(first + i), list);
+    }
+    return As<Cell>(list);
+}
+
+Cell* Nth(Cell* list, int n) {
+    for (int i = 0; i < n; ++i) {
+        list = As<Cell>(list->GetSecond());
+    }
+    return list;
+}
+
+TEST(Printer, SelfCycles) {
+    Heap heap;
+    HeapScope scope(heap);
+    Cell* list = NumberList(1, 3);
+    list->SetFirst(list);
+    EXPECT_EQ(ToString(list), "#0=(#0# 2 3)");
+
+    Cell* pair = Make<Cell>(nullptr, nullptr);
+    pair->SetFirst(pair);
+    pair->SetSecond(pair);
+    EXPECT_EQ(ToString(pair), "#0=(#0# . #0#)");
+
+    Vector* vector = Vector::Make(2, nullptr);
+    vector->Set(1, vector);
+    EXPECT_EQ(ToString(vector), "#0=#(() #0#)");
+}
+
+TEST(Printer, CyclesThroughCdr) {
+    Heap heap;
+    HeapScope scope(heap);
+    Cell* list = NumberList(1, 3);
+    Nth(list, 2)->SetSecond(list);
+    EXPECT_EQ(ToString(list), "#0=(1 2 3 . #0#)");
+
+    // Entering the middle of the list.
+    list = NumberList(1, 4);
+    Nth(list, 3)->SetSecond(Nth(list, 1));
+    EXPECT_EQ(ToString(list), "(1 . #0=(2 3 4 . #0#))");
+
+    Cell* last = Make<Cell>(Number::Make(9), nullptr);
+    last->SetSecond(last);
+    EXPECT_EQ(ToString(Make<Cell>(Number::Make(8), last)), "(8 . #0=(9 . #0#))");
+}
+
+TEST(Printer, SeveralLabels) {
+    Heap heap;
+    HeapScope scope(heap);
+    // ((1 . <inner>) 2 . <outer>) with inner cycling to itself through
+    // its car.
+    Cell* inner = NumberList(10, 2);
+    inner->SetFirst(inner);
+    Cell* outer = NumberList(1, 2);
+    outer->SetFirst(Make<Cell>(Number::Make(1), inner));
+    Nth(outer, 1)->SetSecond(outer);
+    EXPECT_EQ(ToString(outer), "#1=((1 . #0=(#0# 11)) 2 . #1#)");
+
+    // Labels in the middle of lists, nested.
+    Cell* a = NumberList(1, 3);
+    Cell* b = NumberList(4, 3);
+    Nth(a, 2)->SetSecond(Nth(a, 1));
+    Nth(b, 2)->SetSecond(Nth(b, 1));
+    Nth(a, 1)->SetFirst(b);
+    EXPECT_EQ(ToString(a), "(1 . #1=((4 . #0=(5 6 . #0#)) 3 . #1#))");
+}
+
+TEST(Printer, SharingWithoutCyclesIsNotLabelled) {
+    Heap heap;
+    HeapScope scope(heap);
+    Cell* shared = NumberList(1, 2);
+    Cell* list = Make<Cell>(shared, Make<Cell>(shared, Make<Cell>(shared, nullptr)));
+    EXPECT_EQ(ToString(list), "((1 2) (1 2) (1 2))");
+
+    // A shared tail.
+    Cell* tail = NumberList(3, 2);
+    Cell* both = Make<Cell>(Make<Cell>(Number::Make(1), tail), Make<Cell>(Number::Make(2), tail));
+    EXPECT_EQ(ToString(both), "((1 3 4) 2 3 4)");
+
+    Vector* vector = Vector::Make(3, shared);
+    EXPECT_EQ(ToString(vector), "#((1 2) (1 2) (1 2))");
+
+    // The same nodes again after a cycle was printed are not labelled either.
+    Cell* cyclic = NumberList(1, 1);
+    cyclic->SetSecond(cyclic);
+    EXPECT_EQ(ToString(Make<Cell>(shared, Make<Cell>(cyclic, Make<Cell>(shared, nullptr)))),
+              "((1 2) #0=(1 . #0#) (1 2))");
+}
+
+TEST(Printer, AppendsToWhatIsThere) {
+    Heap heap;
+    HeapScope scope(heap);
+    Cell* list = NumberList(1, 4);
+    Nth(list, 3)->SetSecond(Nth(list, 2));
+    Printer printer;
+    std::string out = "value: ";
+    printer.Print(list, out);
+    out += "; again: ";
+    printer.Print(list, out);
+    EXPECT_EQ(out, "value: (1 2 . #0=(3 4 . #0#)); again: (1 2 . #0=(3 4 . #0#))");
+}
+
+TEST(Printer, LongCycles) {
+    Heap heap;
+    HeapScope scope(heap);
+    // Every element of a long list cycles back to a cell before it, so
+    // every cell gets a label.
+    constexpr int kLength = 20000;
+    Cell* list = NumberList(0, kLength);
+    for (Object* cell = list; cell != nullptr; cell = As<Cell>(cell)->GetSecond()) {
+        As<Cell>(cell)->SetFirst(Make<Cell>(cell, nullptr));
+    }
+    std::string printed = ToString(list);
+    std::string expected;
+    for (int i = 0; i < kLength; ++i) {
+        std::string label = std::to_string(i);
+        expected += i == 0 ? "#" + label + "=(" : " . #" + label + "=(";
+        expected += "(#" + label + "#)";
+    }
+    expected.append(kLength, ')');
+    EXPECT_EQ(printed, expected);
+}
+
+TEST(Printer, ManyLabelsFarBack) {
+    Heap heap;
+    HeapScope scope(heap);
+    // Lists nested kDepth deep around a vector that refers back to every one
+    // of them: each label goes in near the start of the output, after most
+    // of it has been written.
+    constexpr int kDepth = 20000;
+    std::vector<Cell*> lists;
+    Vector* vector = Vector::Make(kDepth, nullptr);
+    Object* inner = vector;
+    for (int i = 0; i < kDepth; ++i) {
+        lists.push_back(Make<Cell>(inner, nullptr));
+        inner = lists.back();
+    }
+    for (int i = 0; i < kDepth; ++i) {
+        vector->Set(i, lists[i]);
+    }
+    std::string expected;
+    for (int i = kDepth - 1; i >= 0; --i) {
+        expected += "#" + std::to_string(i) + "=(";
+    }
+    expected += "#(";
+    for (int i = 0; i < kDepth; ++i) {
+        expected += (i > 0 ? " #" : "#") + std::to_string(i) + "#";
+    }
+    expected += ")";
+    expected.append(kDepth, ')');
+    // Not EXPECT_EQ, which would print both in full.
+    EXPECT_TRUE(ToString(inner) == expected);
+}
+
+}  // namespace
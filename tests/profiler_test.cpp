@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "scheme.h"
+
+namespace {
+
+std::map<std::string, ProfileEntry> ByName(const Interpreter& interpreter) {
+    std::map<std::string, ProfileEntry> entries;
+    for (const ProfileEntry& entry : interpreter.Profile()) {
+        entries.emplace(entry.name, entry);
+    }
+    return entries;
+}
+
+std::vector<std::string> CollapsedLines(const Interpreter& interpreter) {
+    std::ostringstream out;
+    interpreter.WriteCollapsedStacks(out);
+    std::istringstream in(out.str());
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// The call paths of the collapsed stacks, without their times.
+std::vector<std::string> CollapsedPaths(const Interpreter& interpreter) {
+    std::vector<std::string> paths;
+    for (const std::string& line : CollapsedLines(interpreter)) {
+        paths.push_back(line.substr(0, line.rfind(' ')));
+    }
+    return paths;
+}
+
+bool Contains(const std::vector<std::string>& paths, const std::string& path) {
+    return std::find(paths.begin(), paths.end(), path) != paths.end();
+}
+
+constexpr const char* kFact = "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))";
+
+TEST(Profiler, CountsRecursiveCalls) {
+    Interpreter interpreter;
+    interpreter.Run(kFact);
+    interpreter.EnableProfiling();
+    EXPECT_EQ(interpreter.Run("(fact 10)"), "3628800");
+    auto entries = ByName(interpreter);
+    ASSERT_EQ(entries.count("fact"), 1u);
+    const ProfileEntry& fact = entries["fact"];
+    EXPECT_EQ(fact.calls, 11u);
+    // Recursion is counted once in inclusive time.
+    EXPECT_GE(fact.inclusive_ns, fact.exclusive_ns);
+
+    interpreter.Run("(fact 5)");
+    EXPECT_EQ(ByName(interpreter)["fact"].calls, 17u);
+}
+
+TEST(Profiler, AttributesBuiltins) {
+    Interpreter interpreter;
+    interpreter.Run(kFact);
+    interpreter.EnableProfiling();
+    interpreter.Run("(fact 10)");
+    auto entries = ByName(interpreter);
+    EXPECT_EQ(entries["="].calls, 11u);
+    EXPECT_EQ(entries["*"].calls, 10u);
+    EXPECT_EQ(entries["-"].calls, 10u);
+    EXPECT_EQ(entries.count("+"), 0u);
+
+    // A builtin is named after its binding, also once rebound.
+    interpreter.Run("(define times *)");
+    interpreter.Run("(define * +)");
+    interpreter.ClearProfile();
+    interpreter.Run("(times 2 3)");
+    entries = ByName(interpreter);
+    EXPECT_EQ(entries["times"].calls, 1u);
+    EXPECT_EQ(entries.count("*"), 0u);
+}
+
+TEST(Profiler, UnwindsAfterError) {
+    Interpreter interpreter;
+    interpreter.Run("(define (fail n) (if (= n 0) (car n) (+ 1 (fail (- n 1)))))");
+    interpreter.Run("(define (ok n) (if (= n 0) 'ok (ok (- n 1))))");
+    interpreter.EnableProfiling();
+    EXPECT_THROW(interpreter.Run("(fail 5)"), RuntimeError);
+    EXPECT_EQ(ByName(interpreter)["fail"].calls, 6u);
+    EXPECT_EQ(ByName(interpreter)["car"].calls, 1u);
+
+    // Had the calls that failed not been exited, these would be recorded
+    // under them.
+    interpreter.Run("(ok 1000)");
+    std::vector<std::string> paths = CollapsedPaths(interpreter);
+    EXPECT_TRUE(Contains(paths, "ok"));
+    EXPECT_TRUE(Contains(paths, "ok;="));
+    for (const std::string& path : paths) {
+        EXPECT_EQ(path.find("fail;ok"), std::string::npos) << path;
+    }
+    // And the failed recursion still counts its inclusive time once it is
+    // over.
+    EXPECT_GT(ByName(interpreter)["fail"].inclusive_ns, 0u);
+}
+
+TEST(Profiler, CollapsedStacksFormat) {
+    Interpreter interpreter;
+    interpreter.Run("(define (leaf n) (if (= n 0) 0 (leaf (- n 1))))");
+    interpreter.Run("(define (middle) (+ 1 (leaf 1000)))");
+    interpreter.Run("(define (top) (middle) (leaf 1000))");
+    interpreter.EnableProfiling();
+    interpreter.Run("(top)");
+    std::vector<std::string> lines = CollapsedLines(interpreter);
+    ASSERT_FALSE(lines.empty());
+    const std::regex line_format("[^; ]+(;[^; ]+)* [1-9][0-9]*");
+    for (const std::string& line : lines) {
+        EXPECT_TRUE(std::regex_match(line, line_format)) << line;
+    }
+    std::vector<std::string> paths = CollapsedPaths(interpreter);
+    // A tail call replaces its caller: the loop in leaf is one level deep,
+    // and the leaf called last in top is under the top level.
+    EXPECT_TRUE(Contains(paths, "top;middle;leaf"));
+    EXPECT_TRUE(Contains(paths, "leaf"));
+    EXPECT_TRUE(Contains(paths, "leaf;="));
+    EXPECT_TRUE(Contains(paths, "top;middle;leaf;-"));
+    // Each path once.
+    std::vector<std::string> sorted = paths;
+    std::sort(sorted.begin(), sorted.end());
+    EXPECT_EQ(std::unique(sorted.begin(), sorted.end()), sorted.end());
+}
+
+TEST(Profiler, ClearProfile) {
+    Interpreter interpreter;
+    interpreter.Run(kFact);
+    interpreter.EnableProfiling();
+    interpreter.Run("(fact 3)");
+    EXPECT_FALSE(interpreter.Profile().empty());
+    interpreter.ClearProfile();
+    EXPECT_TRUE(interpreter.Profile().empty());
+    EXPECT_TRUE(CollapsedLines(interpreter).empty());
+    EXPECT_TRUE(interpreter.IsProfiling());
+    interpreter.Run("(fact 2)");
+    EXPECT_EQ(ByName(interpreter)["fact"].calls, 3u);
+
+    // Disabled, the profile is kept but nothing more is added to it.
+    interpreter.EnableProfiling(false);
+    interpreter.Run("(fact 2)");
+    EXPECT_EQ(ByName(interpreter)["fact"].calls, 3u);
+    interpreter.ClearProfile();
+    EXPECT_TRUE(interpreter.Profile().empty());
+}
+
+}  // namespace
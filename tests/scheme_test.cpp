@@ -0,0 +1,329 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "scheme.h"
+
+namespace {
+
+constexpr const char* kCount = "(define (count n) (if (= n 0) 'done (count (- n 1))))";
+
+// Calls body on another thread and Cancel on this one until body returns:
+// only a Cancel made while a run is in progress takes effect.
+// Hands out its text a few bytes per underflow, and keeps what out held at
+// each, to tell what was written before the rest of the input was read.
+class ChunkedInput : public std::streambuf {
+private:
+    std::string text_;
+    std::size_t chunk_;
+    std::size_t pos_ = 0;
+    const std::ostringstream* out_;
+public:
+    std::vector<std::pair<std::size_t, std::string>> written_at;
+
+    ChunkedInput(std::string text, std::size_t chunk, const std::ostringstream* out)
+        : text_(std::move(text)), chunk_(chunk), out_(out) {
+    }
+protected:
+    int_type underflow() override {
+        written_at.emplace_back(pos_, out_->str());
+        if (pos_ == text_.size()) {
+            return traits_type::eof();
+        }
+        std::size_t size = std::min(chunk_, text_.size() - pos_);
+        char* begin = text_.data() + pos_;
+        setg(begin, begin, begin + size);
+        pos_ += size;
+        return traits_type::to_int_type(*begin);
+    }
+};
+
+std::string RunStream(Interpreter& interpreter, const std::string& source, std::size_t chunk) {
+    std::ostringstream out;
+    ChunkedInput buf(source, chunk, &out);
+    std::istream in(&buf);
+    interpreter.RunAll(in, out);
+    return out.str();
+}
+
+template <class F>
+void CancelWhile(Interpreter& interpreter, F body) {
+    std::atomic<bool> done{false};
+    std::thread runner([&] {
+        body();
+        done.store(true);
+    });
+    while (!done.load()) {
+        interpreter.Cancel();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    runner.join();
+}
+
+TEST(RunAll, FormsAcrossLinesAndChunks) {
+    std::string source =
+        "(define (add a b)\n"
+        "  (+ a\n"
+        "     b))\n"
+        "(add 1 2) (add\n"
+        "3 4)\n"
+        "'(x . y)";
+    for (std::size_t chunk : {1, 2, 5, 64}) {
+        Interpreter interpreter;
+        EXPECT_EQ(RunStream(interpreter, source, chunk), "()\n3\n7\n(x . y)\n") << chunk;
+    }
+}
+
+TEST(RunAll, WritesEachResultBeforeReadingOn) {
+    Interpreter interpreter;
+    std::ostringstream out;
+    std::string source = "(+ 1 2)\n(+ 3 4)\n";
+    ChunkedInput buf(source, 1, &out);
+    std::istream in(&buf);
+    interpreter.RunAll(in, out);
+    EXPECT_EQ(out.str(), "3\n7\n");
+    // The second line was first read after the first result was written.
+    auto second_line = std::find_if(buf.written_at.begin(), buf.written_at.end(),
+                                    [](const auto& read) { return read.first == 8; });
+    ASSERT_NE(second_line, buf.written_at.end());
+    EXPECT_EQ(second_line->second, "3\n");
+}
+
+TEST(RunAll, Comments) {
+    Interpreter interpreter;
+    EXPECT_EQ(RunStream(interpreter, "; header\n(+ 1 ; one\n 2) ; three\n; the end", 3), "3\n");
+    EXPECT_EQ(RunStream(interpreter, "(+ 1 2);", 1), "3\n");
+    EXPECT_EQ(RunStream(interpreter, ";;\n", 1), "");
+    std::vector<std::string> results;
+    interpreter.RunAll("1 ; 2\n3 ;", [&results](const std::string& result) { results.push_back(result); });
+    EXPECT_EQ(results, (std::vector<std::string>{"1", "3"}));
+}
+
+TEST(RunAll, Int64Limits) {
+    Interpreter interpreter;
+    EXPECT_EQ(RunStream(interpreter,
+                        "9223372036854775807\n-9223372036854775808\n9223372036854775808\n"
+                        "(+ 9223372036854775807 1)\n(- -9223372036854775808 1)\n"
+                        "(- 9223372036854775808 1)",
+                        4),
+              "9223372036854775807\n-9223372036854775808\n9223372036854775808\n"
+              "9223372036854775808\n-9223372036854775809\n9223372036854775807\n");
+}
+
+TEST(RunAll, StopsAtFirstError) {
+    Interpreter interpreter;
+    std::ostringstream out;
+    std::istringstream in("(define x 1)\n(+ x 1)\n(car x)\n(+ x 2)\n");
+    EXPECT_THROW(interpreter.RunAll(in, out), RuntimeError);
+    EXPECT_EQ(out.str(), "()\n2\n");
+    std::istringstream unbalanced("(+ x 1)\n(+ x");
+    out.str("");
+    EXPECT_THROW(interpreter.RunAll(unbalanced, out), SyntaxError);
+    EXPECT_EQ(out.str(), "2\n");
+}
+
+// Live objects of type in usage.
+ObjectUsage UsageOf(const MemoryUsage& usage, ObjectType type) {
+    for (const ObjectUsage& objects : usage.objects) {
+        if (objects.type == type) {
+            return objects;
+        }
+    }
+    return ObjectUsage{type};
+}
+
+TEST(MemoryUsage, LiveBytesDropWhenGarbageIsReleased) {
+    Interpreter interpreter;
+    interpreter.Run("(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))");
+    interpreter.Run("(define big '())");
+    std::size_t before = interpreter.GetMemoryUsage().live_bytes;
+    interpreter.Run("(set! big (build 10000 '()))");
+    MemoryUsage held = interpreter.GetMemoryUsage();
+    EXPECT_EQ(UsageOf(held, ObjectType::kCell).count, 10000u);
+    EXPECT_GE(held.live_bytes, before + UsageOf(held, ObjectType::kCell).bytes);
+    EXPECT_GE(held.allocated_bytes, UsageOf(held, ObjectType::kCell).bytes);
+
+    interpreter.Run("(set! big '())");
+    MemoryUsage released = interpreter.GetMemoryUsage();
+    EXPECT_EQ(UsageOf(released, ObjectType::kCell).count, 0u);
+    EXPECT_EQ(released.live_bytes, before);
+    EXPECT_GT(released.collections, held.collections);
+}
+
+TEST(MemoryUsage, StepsCountCallsOfTheLastRun) {
+    Interpreter interpreter;
+    EXPECT_EQ(interpreter.GetMemoryUsage().steps, 0u);
+    interpreter.Run("(define (loop n) (if (= n 0) 0 (loop (- n 1))))");
+    EXPECT_EQ(interpreter.GetMemoryUsage().steps, 0u);
+    // 11 calls of loop, 11 of = and 10 of -.
+    interpreter.Run("(loop 10)");
+    EXPECT_EQ(interpreter.GetMemoryUsage().steps, 32u);
+    interpreter.Run("(loop 100)");
+    EXPECT_EQ(interpreter.GetMemoryUsage().steps, 302u);
+    interpreter.Run("(+ 1 2)");
+    EXPECT_EQ(interpreter.GetMemoryUsage().steps, 1u);
+    // A failed Run counts up to the error.
+    EXPECT_THROW(interpreter.Run("(loop (car 1))"), RuntimeError);
+    EXPECT_EQ(interpreter.GetMemoryUsage().steps, 1u);
+    // RunAll counts the calls of every form.
+    interpreter.RunAll("(loop 10) (loop 10)", nullptr);
+    EXPECT_EQ(interpreter.GetMemoryUsage().steps, 64u);
+}
+
+TEST(MemoryUsage, ObjectsByType) {
+    Interpreter interpreter;
+    MemoryUsage before = interpreter.GetMemoryUsage();
+    EXPECT_GT(UsageOf(before, ObjectType::kProcedure).count, 0u);
+    EXPECT_EQ(UsageOf(before, ObjectType::kCell).count, 0u);
+
+    interpreter.Run("(define xs '(a b c))");
+    interpreter.Run("(define v (vector 1 2 3))");
+    interpreter.Run("(define boxed (vector xs xs))");
+    interpreter.Run("(define f (lambda (x) x))");
+    // Fixnums, booleans and the empty list are not heap objects.
+    interpreter.Run("(define n 12345)");
+    interpreter.Run("(define t #t)");
+    MemoryUsage after = interpreter.GetMemoryUsage();
+    EXPECT_EQ(UsageOf(after, ObjectType::kCell).count, 3u);
+    EXPECT_EQ(UsageOf(after, ObjectType::kSymbol).count, 3u);
+    EXPECT_EQ(UsageOf(after, ObjectType::kVector).count, 2u);
+    EXPECT_EQ(UsageOf(after, ObjectType::kLambda).count, 1u);
+    EXPECT_EQ(UsageOf(after, ObjectType::kNumber).count, 0u);
+    EXPECT_EQ(UsageOf(after, ObjectType::kBoolean).count, 0u);
+    EXPECT_EQ(UsageOf(after, ObjectType::kProcedure).count, UsageOf(before, ObjectType::kProcedure).count);
+
+    std::size_t object_bytes = 0;
+    for (const ObjectUsage& objects : after.objects) {
+        EXPECT_GT(objects.count, 0u) << TypeName(objects.type);
+        EXPECT_GE(objects.bytes, objects.count * sizeof(Object)) << TypeName(objects.type);
+        object_bytes += objects.bytes;
+    }
+    // The rest is the global table.
+    EXPECT_LE(object_bytes, after.live_bytes);
+}
+
+TEST(Prepare, ExecutesRepeatedly) {
+    Interpreter interpreter;
+    interpreter.Run(kCount);
+    auto program = interpreter.Prepare("(count 1000)");
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(interpreter.Execute(*program), "done");
+    }
+    // Nothing is run by Prepare.
+    auto failing = interpreter.Prepare("(car 1)");
+    EXPECT_THROW(interpreter.Execute(*failing), RuntimeError);
+    EXPECT_THROW(interpreter.Execute(*failing), RuntimeError);
+    EXPECT_EQ(interpreter.Execute(*program), "done");
+}
+
+TEST(Prepare, SeesGlobalsReboundBetweenExecutions) {
+    Interpreter interpreter;
+    interpreter.Run("(define x 1)");
+    interpreter.Run("(define (f) 'first)");
+    auto program = interpreter.Prepare("(list (+ x 1) (f))");
+    EXPECT_EQ(interpreter.Execute(*program), "(2 first)");
+    interpreter.Run("(define x 41)");
+    interpreter.Run("(define (f) 'second)");
+    EXPECT_EQ(interpreter.Execute(*program), "(42 second)");
+    interpreter.Run("(set! x -1)");
+    EXPECT_EQ(interpreter.Execute(*program), "(0 second)");
+    // Rebinding a builtin the code folded.
+    auto folded = interpreter.Prepare("(+ 1 2)");
+    EXPECT_EQ(interpreter.Execute(*folded), "3");
+    interpreter.Run("(define + *)");
+    EXPECT_EQ(interpreter.Execute(*folded), "2");
+}
+
+TEST(Prepare, RecompilesWhenSpecialFormIsRebound) {
+    Interpreter interpreter;
+    interpreter.Run("(define x 0)");
+    auto program = interpreter.Prepare("(if (= x 0) 'zero 'other)");
+    EXPECT_EQ(interpreter.Execute(*program), "zero");
+
+    // Now a call, which evaluates every argument.
+    interpreter.Run("(define (if test then else) else)");
+    EXPECT_EQ(interpreter.Execute(*program), "other");
+    EXPECT_EQ(interpreter.Execute(*program), "other");
+    interpreter.Run("(define (if test then else) then)");
+    EXPECT_EQ(interpreter.Execute(*program), "zero");
+}
+
+TEST(Slices, RunInSlices) {
+    Interpreter interpreter;
+    interpreter.Run(kCount);
+    auto evaluation = interpreter.Start("(count 1000)", 10);
+    int slices = 1;
+    while (!interpreter.Resume(*evaluation, 10)) {
+        ++slices;
+    }
+    EXPECT_GT(slices, 90);
+    EXPECT_EQ(evaluation->Result(), "done");
+}
+
+TEST(Cancel, LateCancelDoesNotStopNextRun) {
+    Interpreter interpreter;
+    interpreter.Run(kCount);
+    interpreter.Cancel();
+    EXPECT_EQ(interpreter.Run("(+ 1 2)"), "3");
+    interpreter.Cancel();
+    EXPECT_EQ(interpreter.Run("(count 100)"), "done");
+    interpreter.Cancel();
+    auto program = interpreter.Prepare("(count 10)");
+    EXPECT_EQ(interpreter.Execute(*program), "done");
+}
+
+TEST(Cancel, LateCancelDoesNotStopNextSlice) {
+    Interpreter interpreter;
+    interpreter.Run(kCount);
+    interpreter.Cancel();
+    auto evaluation = interpreter.Start("(count 100)", 10);
+    EXPECT_FALSE(evaluation->Done());
+    // Between slices: no slice is in progress.
+    interpreter.Cancel();
+    EXPECT_TRUE(interpreter.Resume(*evaluation, 1000));
+    EXPECT_EQ(evaluation->Result(), "done");
+}
+
+TEST(Cancel, StopsRunInProgress) {
+    Interpreter interpreter;
+    interpreter.Run("(define (loop) (loop))");
+    bool cancelled = false;
+    CancelWhile(interpreter, [&] {
+        try {
+            interpreter.Run("(loop)");
+        } catch (const CancelledError&) {
+            cancelled = true;
+        }
+    });
+    EXPECT_TRUE(cancelled);
+    EXPECT_EQ(interpreter.Run("(+ 1 2)"), "3");
+}
+
+TEST(Cancel, EndsOnlyTheSliceInProgress) {
+    Interpreter interpreter;
+    interpreter.Run(kCount);
+    interpreter.Run("(define (loop) (loop))");
+    auto looping = interpreter.Start("(loop)", 10);
+    auto counting = interpreter.Start("(count 100)", 10);
+    bool cancelled = false;
+    CancelWhile(interpreter, [&] {
+        try {
+            interpreter.Resume(*looping, UINT64_MAX);
+        } catch (const CancelledError&) {
+            cancelled = true;
+        }
+    });
+    EXPECT_TRUE(cancelled);
+    EXPECT_TRUE(looping->Done());
+    EXPECT_TRUE(interpreter.Resume(*counting, 1000));
+    EXPECT_EQ(counting->Result(), "done");
+}
+
+}  // namespace
@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "error.h"
+#include "tokenizer.h"
+
+namespace {
+
+// Hands out its text a few bytes per underflow, so that tokens and lines
+// straddle the reads of the stream.
+class ChunkedBuf : public std::streambuf {
+private:
+    std::string text_;
+    std::size_t chunk_;
+    std::size_t pos_ = 0;
+public:
+    ChunkedBuf(std::string text, std::size_t chunk) : text_(std::move(text)), chunk_(chunk) {
+    }
+protected:
+    int_type underflow() override {
+        if (pos_ == text_.size()) {
+            return traits_type::eof();
+        }
+        std::size_t size = std::min(chunk_, text_.size() - pos_);
+        char* begin = text_.data() + pos_;
+        setg(begin, begin, begin + size);
+        pos_ += size;
+        return traits_type::to_int_type(*begin);
+    }
+};
+
+// The tokens as strings, with the source offset of each.
+std::vector<std::string> Describe(Tokenizer* tokenizer, std::vector<std::size_t>* positions = nullptr) {
+    std::vector<std::string> tokens;
+    while (!tokenizer->IsEnd()) {
+        const Token& token = tokenizer->GetToken();
+        if (auto symbol = std::get_if<SymbolToken>(&token)) {
+            tokens.emplace_back(symbol->name);
+        } else if (auto constant = std::get_if<ConstantToken>(&token)) {
+            tokens.push_back(constant->big.empty() ? std::to_string(constant->value)
+                                                   : "big:" + std::string(constant->big));
+        } else if (auto bracket = std::get_if<BracketToken>(&token)) {
+            tokens.push_back(*bracket == BracketToken::OPEN ? "(" : ")");
+        } else if (std::holds_alternative<QuoteToken>(token)) {
+            tokens.push_back("'");
+        } else if (std::holds_alternative<DotToken>(token)) {
+            tokens.push_back(".");
+        } else {
+            tokens.push_back("#(");
+        }
+        if (positions != nullptr) {
+            positions->push_back(tokenizer->Position());
+        }
+        tokenizer->Next();
+    }
+    return tokens;
+}
+
+std::vector<std::string> FromView(std::string_view source, std::vector<std::size_t>* positions = nullptr) {
+    Tokenizer tokenizer{source};
+    return Describe(&tokenizer, positions);
+}
+
+std::vector<std::string> FromStream(const std::string& source, std::size_t chunk,
+                                    std::vector<std::size_t>* positions = nullptr) {
+    ChunkedBuf buf(source, chunk);
+    std::istream in(&buf);
+    Tokenizer tokenizer{&in};
+    return Describe(&tokenizer, positions);
+}
+
+TEST(Tokenizer, StreamMatchesViewAcrossChunks) {
+    std::string source =
+        "(define (long-symbol-name argument-one)\n"
+        "  (+ argument-one 1234567890 -987654321))\n"
+        "'(a . b) #(1 2 3)\n"
+        "(long-symbol-name\n"
+        "   42)";
+    std::vector<std::size_t> view_positions;
+    std::vector<std::string> tokens = FromView(source, &view_positions);
+    EXPECT_EQ(tokens.size(), 28u);
+    for (std::size_t chunk : {1, 2, 3, 7, 64}) {
+        std::vector<std::size_t> positions;
+        EXPECT_EQ(FromStream(source, chunk, &positions), tokens) << chunk;
+        EXPECT_EQ(positions, view_positions) << chunk;
+    }
+}
+
+TEST(Tokenizer, LineEndsSeparateTokens) {
+    EXPECT_EQ(FromView("abc\ndef\n12\n34"), (std::vector<std::string>{"abc", "def", "12", "34"}));
+    EXPECT_EQ(FromStream("abc\ndef\n12\n34", 2), (std::vector<std::string>{"abc", "def", "12", "34"}));
+    // A form may span any number of lines.
+    EXPECT_EQ(FromStream("(\n\n+\n1\n\n2\n)\n", 1), (std::vector<std::string>{"(", "+", "1", "2", ")"}));
+}
+
+TEST(Tokenizer, LongLineAfterManyShortOnes) {
+    // Enough lines that the consumed front of the buffer is dropped several
+    // times before the long line is read.
+    std::string source;
+    for (int i = 0; i < 1000; ++i) {
+        source += "x" + std::to_string(i) + "\n";
+    }
+    std::string long_symbol(100000, 'y');
+    source += "(" + long_symbol + ")";
+    std::vector<std::size_t> view_positions;
+    std::vector<std::string> tokens = FromView(source, &view_positions);
+    ASSERT_EQ(tokens.size(), 1003u);
+    EXPECT_EQ(tokens[1001], long_symbol);
+    std::vector<std::size_t> positions;
+    EXPECT_EQ(FromStream(source, 5, &positions), tokens);
+    EXPECT_EQ(positions, view_positions);
+}
+
+TEST(Tokenizer, Comments) {
+    std::vector<std::string> expected = {"(", "+", "1", "2", ")"};
+    std::string source = "; leading\n(+ 1 ; inside\n 2) ; trailing\n;; only a comment\n";
+    EXPECT_EQ(FromView(source), expected);
+    EXPECT_EQ(FromStream(source, 3), expected);
+    // At the end of the input, without a newline after it.
+    EXPECT_EQ(FromView("(+ 1 2);done"), expected);
+    EXPECT_EQ(FromStream("(+ 1 2)\n; done", 4), expected);
+    EXPECT_TRUE(FromView("; nothing else").empty());
+    EXPECT_TRUE(FromStream(";\n;\n", 1).empty());
+    // Not part of a symbol or number either side of it.
+    EXPECT_EQ(FromView("abc;def\n12;34"), (std::vector<std::string>{"abc", "12"}));
+}
+
+TEST(Tokenizer, Int64Limits) {
+    std::vector<std::string> tokens = FromView(
+        "9223372036854775807 -9223372036854775808 9223372036854775808 -9223372036854775809 "
+        "+9223372036854775807 +9223372036854775808 18446744073709551616 -0");
+    EXPECT_EQ(tokens, (std::vector<std::string>{
+                          std::to_string(INT64_MAX),
+                          std::to_string(INT64_MIN),
+                          "big:9223372036854775808",
+                          "big:-9223372036854775809",
+                          std::to_string(INT64_MAX),
+                          "big:+9223372036854775808",
+                          "big:18446744073709551616",
+                          "0",
+                      }));
+    EXPECT_EQ(FromStream("9223372036854775807\n-9223372036854775808", 3),
+              (std::vector<std::string>{std::to_string(INT64_MAX), std::to_string(INT64_MIN)}));
+}
+
+TEST(Tokenizer, RejectsUnknownCharacters) {
+    for (const char* source : {"\"text\"", "(a [b])", "{", "@"}) {
+        EXPECT_THROW(FromView(source), SyntaxError) << source;
+        EXPECT_THROW(FromStream(source, 1), SyntaxError) << source;
+    }
+}
+
+}  // namespace
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "parser.h"
+#include "scheme.h"
+
+namespace {
+
+TEST(Closures, CaptureValuesWhenCreated) {
+    Interpreter interpreter;
+    interpreter.Run("(define (adder n) (lambda (x) (+ x n)))");
+    interpreter.Run("(define add2 (adder 2))");
+    interpreter.Run("(define add10 (adder 10))");
+    EXPECT_EQ(interpreter.Run("(add2 1)"), "3");
+    EXPECT_EQ(interpreter.Run("(add10 1)"), "11");
+    // Free variables of nested lambdas are captured through the enclosing
+    // closure.
+    interpreter.Run("(define (curry3 a) (lambda (b) (lambda (c) (list a b c))))");
+    EXPECT_EQ(interpreter.Run("(((curry3 1) 2) 3)"), "(1 2 3)");
+}
+
+TEST(Closures, AssignedCapturesAreShared) {
+    Interpreter interpreter;
+    interpreter.Run(
+        "(define (make-account balance)"
+        "  (list (lambda (amount) (set! balance (+ balance amount)) balance)"
+        "        (lambda () balance)))");
+    interpreter.Run("(define account (make-account 100))");
+    interpreter.Run("(define deposit (car account))");
+    interpreter.Run("(define balance (car (cdr account)))");
+    EXPECT_EQ(interpreter.Run("(deposit 10)"), "110");
+    EXPECT_EQ(interpreter.Run("(deposit 5)"), "115");
+    EXPECT_EQ(interpreter.Run("(balance)"), "115");
+    // Each call of make-account has a variable of its own.
+    interpreter.Run("(define other (make-account 0))");
+    EXPECT_EQ(interpreter.Run("((car other) 1)"), "1");
+    EXPECT_EQ(interpreter.Run("(balance)"), "115");
+}
+
+TEST(Closures, AssignmentAfterCaptureIsSeen) {
+    Interpreter interpreter;
+    interpreter.Run("(define (f) (define x 1) (define get (lambda () x)) (set! x 2) (get))");
+    EXPECT_EQ(interpreter.Run("(f)"), "2");
+    // Global variables are not captured: a closure sees their current value.
+    interpreter.Run("(define y 1)");
+    interpreter.Run("(define (get-y) y)");
+    interpreter.Run("(set! y 5)");
+    EXPECT_EQ(interpreter.Run("(get-y)"), "5");
+}
+
+TEST(Frames, SlotsOfParametersAndInternalDefines) {
+    Interpreter interpreter;
+    interpreter.Run(
+        "(define (f a b)"
+        "  (define c (+ a b))"
+        "  (define d (* c 2))"
+        "  (set! a (- d a))"
+        "  (list a b c d))");
+    EXPECT_EQ(interpreter.Run("(f 1 2)"), "(5 2 3 6)");
+    // Locals shadow globals of the same name, and leave them alone.
+    interpreter.Run("(define c 100)");
+    EXPECT_EQ(interpreter.Run("(f 10 20)"), "(50 20 30 60)");
+    EXPECT_EQ(interpreter.Run("c"), "100");
+    // Every activation has frames of its own.
+    interpreter.Run("(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))");
+    EXPECT_EQ(interpreter.Run("(fact 20)"), "2432902008176640000");
+}
+
+TEST(Frames, WrongArgumentCountThrows) {
+    Interpreter interpreter;
+    interpreter.Run("(define (f a b) a)");
+    EXPECT_THROW(interpreter.Run("(f 1)"), RuntimeError);
+    EXPECT_THROW(interpreter.Run("(f 1 2 3)"), RuntimeError);
+    EXPECT_EQ(interpreter.Run("(f 1 2)"), "1");
+}
+
+// Well under the iterations of the loops below.
+constexpr std::size_t kSmallDepth = 100;
+
+TEST(TailCalls, LoopRunsInConstantDepth) {
+    Interpreter interpreter;
+    interpreter.SetLimits({0, kSmallDepth, 0});
+    interpreter.Run("(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))");
+    EXPECT_EQ(interpreter.Run("(loop 1000000 0)"), "1000000");
+    // The same recursion outside tail position reaches the limit.
+    interpreter.Run("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))");
+    EXPECT_THROW(interpreter.Run("(count 1000000)"), LimitError);
+    EXPECT_EQ(interpreter.Run("(count 10)"), "10");
+}
+
+TEST(TailCalls, MutualRecursion) {
+    Interpreter interpreter;
+    interpreter.SetLimits({0, kSmallDepth, 0});
+    interpreter.Run("(define (even? n) (if (= n 0) #t (odd? (- n 1))))");
+    interpreter.Run("(define (odd? n) (if (= n 0) #f (even? (- n 1))))");
+    EXPECT_EQ(interpreter.Run("(even? 1000000)"), "#t");
+    EXPECT_EQ(interpreter.Run("(odd? 1000001)"), "#t");
+}
+
+TEST(TailCalls, LastOperandOfAndOr) {
+    Interpreter interpreter;
+    interpreter.SetLimits({0, kSmallDepth, 0});
+    interpreter.Run("(define (all n) (and #t (or (= n 0) (all (- n 1)))))");
+    EXPECT_EQ(interpreter.Run("(all 1000000)"), "#t");
+    interpreter.Run("(define (none n) (or #f (and (> n 0) (none (- n 1)))))");
+    EXPECT_EQ(interpreter.Run("(none 1000000)"), "#f");
+}
+
+TEST(TailCalls, ThroughClosures) {
+    Interpreter interpreter;
+    interpreter.SetLimits({0, kSmallDepth, 0});
+    // The tail call is to a closure made on each iteration.
+    interpreter.Run("(define (loop n) (if (= n 0) 'done ((lambda (m) (loop m)) (- n 1))))");
+    EXPECT_EQ(interpreter.Run("(loop 1000000)"), "done");
+}
+
+TEST(Globals, ReadsFollowRebinding) {
+    Interpreter interpreter;
+    interpreter.Run("(define x 1)");
+    interpreter.Run("(define (get) x)");
+    EXPECT_EQ(interpreter.Run("(get)"), "1");
+    interpreter.Run("(set! x 2)");
+    EXPECT_EQ(interpreter.Run("(get)"), "2");
+    interpreter.Run("(define x 3)");
+    EXPECT_EQ(interpreter.Run("(get)"), "3");
+    // Enough new bindings for the table to grow several times under the
+    // cell get found x in.
+    for (int i = 0; i < 1000; ++i) {
+        interpreter.Run("(define g" + std::to_string(i) + " " + std::to_string(i) + ")");
+    }
+    EXPECT_EQ(interpreter.Run("(get)"), "3");
+    interpreter.Run("(set! x 4)");
+    EXPECT_EQ(interpreter.Run("(get)"), "4");
+    EXPECT_EQ(interpreter.Run("(+ g0 g999)"), "999");
+}
+
+TEST(Globals, UnboundUntilDefined) {
+    Interpreter interpreter;
+    interpreter.Run("(define (get-y) y)");
+    EXPECT_THROW(interpreter.Run("(get-y)"), NameError);
+    interpreter.Run("(define z 0)");
+    EXPECT_THROW(interpreter.Run("(get-y)"), NameError);
+    interpreter.Run("(define y 5)");
+    EXPECT_EQ(interpreter.Run("(get-y)"), "5");
+}
+
+TEST(Globals, SameCodeInSeveralEnvironments) {
+    Heap heap;
+    HeapScope scope(heap);
+    Environment first;
+    Environment second;
+    first.Define(Intern("x"), Number::Make(1));
+    second.Define(Intern("x"), Number::Make(2));
+    Tokenizer tokenizer{std::string_view("x")};
+    Chunk chunk;
+    Compile(Read(&tokenizer), first, &chunk);
+    VM vm;
+    EXPECT_EQ(Number::ValueOf(vm.Execute(chunk, first)), 1);
+    EXPECT_EQ(Number::ValueOf(vm.Execute(chunk, second)), 2);
+    EXPECT_EQ(Number::ValueOf(vm.Execute(chunk, first)), 1);
+    // A cleared environment binds nothing, whatever its cells still hold.
+    first.Clear();
+    EXPECT_THROW(vm.Execute(chunk, first), NameError);
+    first.Define(Intern("y"), Number::Make(3));
+    EXPECT_THROW(vm.Execute(chunk, first), NameError);
+    first.Define(Intern("x"), Number::Make(4));
+    EXPECT_EQ(Number::ValueOf(vm.Execute(chunk, first)), 4);
+}
+
+}  // namespace
@@ -1,9 +1,49 @@
 #include "tokenizer.h"
 #include "error.h"
-#include <iostream>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+enum CharClass : uint8_t {
+    kSpace = 1,
+    kDigit = 2,
+    kSymbolStart = 4,
+    kSymbolChar = 8,
+};
+
+constexpr std::array<uint8_t, 256> MakeCharClasses() {
+    std::array<uint8_t, 256> classes{};
+    for (unsigned char c : std::string_view(" \t\n\v\f\r")) {
+        classes[c] |= kSpace;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        classes[c] |= kDigit | kSymbolChar;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        classes[c] |= kSymbolStart | kSymbolChar;
+        classes[c - 'a' + 'A'] |= kSymbolStart | kSymbolChar;
+    }
+    for (unsigned char c : std::string_view("<=>*/#")) {
+        classes[c] |= kSymbolStart | kSymbolChar;
+    }
+    for (unsigned char c : std::string_view("?!-")) {
+        classes[c] |= kSymbolChar;
+    }
+    return classes;
+}
+
+constexpr std::array<uint8_t, 256> kCharClasses = MakeCharClasses();
+
+bool HasClass(char c, CharClass cls) {
+    return (kCharClasses[static_cast<unsigned char>(c)] & cls) != 0;
+}
+
+}  // namespace
 
 bool ConstantToken::operator==(const ConstantToken& other) const {
-    return (value == other.value);
+    return value == other.value && big == other.big;
 }
 
 bool SymbolToken::operator==(const SymbolToken& other) const {
@@ -18,63 +58,129 @@ bool QuoteToken::operator==(const QuoteToken&) const {
     return true;
 }
 
-Tokenizer::Tokenizer(std::istream* in) : in_(in) {
-    Next();
+bool VectorToken::operator==(const VectorToken&) const {
+    return true;
+}
+
+Tokenizer::Tokenizer(std::istream* in) : in_(in), pending_(true) {
+}
+
+Tokenizer::Tokenizer(std::string_view source) : source_(source) {
+    Scan();
 }
 
 bool Tokenizer::IsEnd() {
+    if (pending_) {
+        ScanStream();
+    }
     return flag_;
 }
 
 void Tokenizer::Next() {
-    std::string first = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ<=>*/#";
-    std::string second = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ<=>*/#0123456789?!-";
-    while (!in_->eof() && std::isspace(in_->peek())) {
-        in_->get();
+    if (in_ != nullptr) {
+        pending_ = true;
+        return;
+    }
+    Scan();
+}
+
+// Scans the next token from what has been read of the stream, reading more
+// lines while the token, or the space before it, runs into the end of that.
+// Lines are read with a '\n' after them, so a token that ends a line is
+// complete without reading on.
+void Tokenizer::ScanStream() {
+    pending_ = false;
+    std::size_t start = pos_;
+    while (true) {
+        source_ = buffer_;
+        Scan();
+        if (pos_ < buffer_.size() || !std::getline(*in_, line_)) {
+            return;
+        }
+        // What was scanned before start goes once it is most of the buffer.
+        if (start >= buffer_.size() / 2) {
+            buffer_.erase(0, start);
+            consumed_ += start;
+            start = 0;
+        }
+        buffer_ += line_;
+        buffer_ += '\n';
+        pos_ = start;
+        flag_ = false;
+    }
+}
+
+void Tokenizer::Scan() {
+    const char* data = source_.data();
+    std::size_t size = source_.size();
+    std::size_t pos = pos_;
+    while (pos < size) {
+        if (HasClass(data[pos], kSpace)) {
+            ++pos;
+        } else if (data[pos] == ';') {
+            // A comment runs to the end of the line.
+            auto end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+            pos = end != nullptr ? end - data : size;
+        } else {
+            break;
+        }
     }
-    if (in_->eof()) {
+    token_start_ = pos;
+    if (pos == size) {
+        pos_ = pos;
         flag_ = true;
         return;
     }
-    int c = in_->get();
+    char c = data[pos++];
     switch (c) {
-        case '(': token_ = Token{BracketToken::OPEN}; break;
-        case ')': token_ = Token{BracketToken::CLOSE}; break;
-        case '.': token_ = Token{DotToken{}}; break;
-        case '\'': token_ = Token{QuoteToken{}}; break;
-        case '-':
-        case '+': {
-            if (!std::isdigit(in_->peek())) {
-                std::string temp;
-                temp += static_cast<char>(c);
-                token_ = Token{SymbolToken{temp}}; break;
-            }
-            int sgn = (c == '-') ? -1 : 1;
-            *in_ >> c;
-            token_ = Token{ConstantToken{sgn * c}}; break;
-        }
+        case '(': token_ = BracketToken::OPEN; break;
+        case ')': token_ = BracketToken::CLOSE; break;
+        case '.': token_ = DotToken{}; break;
+        case '\'': token_ = QuoteToken{}; break;
         default: {
-            if (std::isdigit(c)) {
-                c = static_cast<int>(static_cast<char>(c) - '0');
-                while (!in_->eof() && std::isdigit(in_->peek())) {
-                    c *= 10;
-                    c += static_cast<int>(static_cast<char>(in_->get()) - '0');
+            if (c == '#' && pos < size && data[pos] == '(') {
+                ++pos;
+                token_ = VectorToken{};
+                break;
+            }
+            bool sign = (c == '-' || c == '+');
+            if (sign && (pos == size || !HasClass(data[pos], kDigit))) {
+                token_ = SymbolToken{source_.substr(pos - 1, 1)};
+                break;
+            }
+            if (sign || HasClass(c, kDigit)) {
+                std::size_t start = pos - 1;
+                uint64_t value = sign ? 0 : c - '0';
+                bool overflow = false;
+                while (pos < size && HasClass(data[pos], kDigit)) {
+                    overflow |= __builtin_mul_overflow(value, 10, &value);
+                    overflow |= __builtin_add_overflow(value, data[pos++] - '0', &value);
+                }
+                uint64_t limit = (uint64_t{1} << 63) - (c == '-' ? 0 : 1);
+                if (overflow || value > limit) {
+                    token_ = ConstantToken{0, source_.substr(start, pos - start)};
+                } else {
+                    token_ = ConstantToken{static_cast<int64_t>(c == '-' ? 0 - value : value)};
                 }
-                token_ = Token{ConstantToken{c}}; break;
+                break;
             }
-            if (first.find(static_cast<char>(c)) == std::string::npos) {
+            if (!HasClass(c, kSymbolStart)) {
                 throw SyntaxError("Error");
             }
-            std::string s;
-            s += static_cast<char>(c);
-            while (!in_->eof() && second.find(in_->peek()) != std::string::npos) {
-                s += in_->get();
+            std::size_t start = pos - 1;
+            while (pos < size && HasClass(data[pos], kSymbolChar)) {
+                ++pos;
             }
-            token_ = Token{SymbolToken{s}}; break;
+            token_ = SymbolToken{source_.substr(start, pos - start)};
+            break;
         }
     }
+    pos_ = pos;
 }
 
-Token Tokenizer::GetToken() {
+const Token& Tokenizer::GetToken() {
+    if (pending_) {
+        ScanStream();
+    }
     return token_;
-}
\ No newline at end of file
+}
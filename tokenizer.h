@@ -1,11 +1,14 @@
 #pragma once
 
+#include <cstdint>
 #include <variant>
 #include <optional>
 #include <istream>
+#include <string>
+#include <string_view>
 
 struct SymbolToken {
-    std::string name;
+    std::string_view name;
     bool operator==(const SymbolToken& other) const;
 };
 
@@ -17,27 +20,63 @@ struct DotToken {
     bool operator==(const DotToken&) const;
 };
 
+// "#(", which opens a vector literal.
+struct VectorToken {
+    bool operator==(const VectorToken&) const;
+};
+
 enum class BracketToken { OPEN, CLOSE };
 
+// A number literal. One outside the 64-bit range keeps its text instead,
+// for the parser to read as a bignum.
 struct ConstantToken {
-    int value;
+    int64_t value;
+    std::string_view big = {};
     bool operator==(const ConstantToken& other) const;
 };
 
-using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken>;
+using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken, VectorToken>;
 
+// Tokenizes a contiguous buffer without copying it: symbol tokens are views
+// into the source, which must outlive the tokenizer. A ';' starts a comment
+// that runs to the end of the line. The istream constructor
+// reads the stream a line at a time into an owned buffer, and only once a
+// token is asked for, so a form on a line is read before any later line is
+// waited for. Tokens stay valid until Next.
 class Tokenizer {
 private:
+    std::istream* in_ = nullptr;
+    std::string buffer_;
+    std::string line_;
+    std::string_view source_;
+    std::size_t pos_ = 0;
+    std::size_t token_start_ = 0;
+    // Bytes of the stream dropped from the front of buffer_.
+    std::size_t consumed_ = 0;
     Token token_;
-    std::istream* in_;
     bool flag_ = false;
+    // Reading a stream, Next only sets this; the token is scanned when asked
+    // for.
+    bool pending_ = false;
+
+    void Scan();
+    void ScanStream();
 public:
     Tokenizer(std::istream* in);
 
+    Tokenizer(std::string_view source);
+
+    Tokenizer(const Tokenizer&) = delete;
+    Tokenizer& operator=(const Tokenizer&) = delete;
+
     bool IsEnd();
 
     void Next();
 
-    Token GetToken();
-};
+    const Token& GetToken();
 
+    // Offset of the current token in the source, its size at the end.
+    std::size_t Position() const {
+        return consumed_ + token_start_;
+    }
+};
@@ -0,0 +1,129 @@
+#include "batch.h"
+#include "mapped_file.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Set by the first interrupt; a second one ends the process as usual.
+std::atomic<bool> interrupted{false};
+
+extern "C" void OnInterrupt(int) {
+    interrupted.store(true);
+    std::signal(SIGINT, SIG_DFL);
+}
+
+struct Options {
+    BatchOptions batch;
+    // One label per script: the file it came from, or FILE:LINE for --lines.
+    std::vector<std::string> names;
+    std::vector<std::string> scripts;
+    bool quiet = false;
+};
+
+[[noreturn]] void Usage(const char* program, int status) {
+    std::cerr << "usage: " << program
+              << " [--threads N] [--heap-bytes N] [--depth N] [--steps N] [--quiet] [--lines FILE] [SCRIPT...]\n";
+    std::exit(status);
+}
+
+void ReadLines(const std::string& path, Options& options) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "cannot read " << path << "\n";
+        std::exit(2);
+    }
+    std::string line;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        options.names.push_back(path + ":" + std::to_string(number));
+        options.scripts.push_back(line);
+    }
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << "\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--threads") {
+            options.batch.threads = std::strtoull(value().c_str(), nullptr, 10);
+        } else if (arg == "--heap-bytes") {
+            options.batch.limits.heap_bytes = std::strtoull(value().c_str(), nullptr, 10);
+        } else if (arg == "--depth") {
+            options.batch.limits.depth = std::strtoull(value().c_str(), nullptr, 10);
+        } else if (arg == "--steps") {
+            options.batch.limits.steps = std::strtoull(value().c_str(), nullptr, 10);
+        } else if (arg == "--quiet") {
+            options.quiet = true;
+        } else if (arg == "--lines") {
+            ReadLines(value(), options);
+        } else if (arg == "--help") {
+            Usage(argv[0], 0);
+        } else if (!arg.empty() && arg[0] == '-') {
+            Usage(argv[0], 2);
+        } else {
+            try {
+                MappedFile file(arg);
+                options.scripts.emplace_back(file.View());
+            } catch (const std::exception&) {
+                std::cerr << "cannot read " << arg << "\n";
+                std::exit(2);
+            }
+            options.names.push_back(arg);
+        }
+    }
+    return options;
+}
+
+}  // namespace
+
+// Prints "NAME: VALUE..." per script, in the order given, followed by
+// "ERROR: MESSAGE" if it failed, or "cancelled: MESSAGE" if an interrupt
+// stopped it, then the throughput to stderr. Exits with 1 if any script
+// failed or was cancelled.
+int main(int argc, char** argv) {
+    Options options = ParseOptions(argc, argv);
+    options.batch.cancel = &interrupted;
+    std::signal(SIGINT, OnInterrupt);
+    BatchStats stats;
+    std::vector<BatchResult> results = RunBatch(options.scripts, options.batch, &stats);
+    if (!options.quiet) {
+        std::string out;
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            out += options.names[i];
+            out += ':';
+            for (const std::string& value : results[i].values) {
+                out += ' ';
+                out += value;
+            }
+            if (results[i].status != BatchStatus::kOk) {
+                out += ' ';
+                out += StatusName(results[i].status);
+                out += ": ";
+                out += results[i].error;
+            }
+            out += '\n';
+        }
+        std::fwrite(out.data(), 1, out.size(), stdout);
+    }
+    std::fprintf(stderr, "%zu scripts, %zu failed, %zu cancelled, %zu threads, %zu steals, %.3f s, %.0f scripts/s\n",
+                 stats.scripts, stats.failed, stats.cancelled, stats.threads, stats.steals, stats.seconds,
+                 stats.ScriptsPerSecond());
+    return stats.failed != 0 || stats.cancelled != 0 ? 1 : 0;
+}
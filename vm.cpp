@@ -0,0 +1,473 @@
+#include "vm.h"
+
+#include <algorithm>
+
+// Makes a VM the active one for an environment. On exit, also when an error
+// unwinds, restores the stack, the frames and the previously active VM.
+class VM::Activation {
+private:
+    VM* vm_;
+    VM* previous_;
+    Environment* previous_env_;
+    std::size_t stack_size_;
+    std::size_t depth_;
+    std::size_t chunks_;
+    std::size_t native_calls_;
+    std::size_t runs_;
+    std::size_t profile_depth_;
+public:
+    Activation(VM* vm, Environment& env)
+        : vm_(vm), previous_(ActiveSlot()), previous_env_(vm->env_), stack_size_(vm->stack_.size()),
+          depth_(vm->frames_.size()), chunks_(vm->chunks_.size()), native_calls_(vm->native_calls_),
+          runs_(vm->runs_), profile_depth_(vm->profiler_ != nullptr ? vm->profiler_->Depth() : 0) {
+        ActiveSlot() = vm;
+        vm->env_ = &env;
+    }
+    ~Activation() {
+        vm_->stack_.resize(stack_size_);
+        vm_->frames_.resize(depth_);
+        vm_->chunks_.resize(chunks_);
+        vm_->env_ = previous_env_;
+        vm_->native_calls_ = native_calls_;
+        vm_->runs_ = runs_;
+        if (vm_->profiler_ != nullptr) {
+            vm_->profiler_->Unwind(profile_depth_);
+        }
+        ActiveSlot() = previous_;
+    }
+    std::size_t Depth() const {
+        return depth_;
+    }
+};
+
+VM::VM(Heap* heap) : heap_(heap) {
+    if (heap_ != nullptr) {
+        heap_->AddRoots(this);
+    }
+}
+
+VM::~VM() {
+    if (heap_ != nullptr) {
+        heap_->RemoveRoots(this);
+    }
+}
+
+VM*& VM::ActiveSlot() {
+    thread_local VM* active = nullptr;
+    return active;
+}
+
+Object* VM::Execute(const Chunk& chunk, Environment& env) {
+    Activation activation(this, env);
+    chunks_.push_back(&chunk);
+    ++runs_;
+    return Run(Frame{&chunk, nullptr, 0, stack_.size()}, activation.Depth());
+}
+
+Object* VM::Execute(const Chunk& chunk, Environment& env, uint64_t fuel, Paused* paused) {
+    Activation activation(this, env);
+    chunks_.push_back(&chunk);
+    ++runs_;
+    return RunWithFuel(Frame{&chunk, nullptr, 0, stack_.size()}, activation.Depth(), fuel, paused);
+}
+
+Object* VM::Resume(Paused* paused, Environment& env, uint64_t fuel) {
+    if (paused->Empty()) {
+        throw RuntimeError("RuntimeError");
+    }
+    Activation activation(this, env);
+    std::size_t base = stack_.size();
+    stack_.insert(stack_.end(), paused->stack_.begin(), paused->stack_.end());
+    for (Frame& frame : paused->frames_) {
+        frame.base += base;
+    }
+    Frame frame = paused->frames_.back();
+    chunks_.push_back(paused->frames_.front().chunk);
+    frames_.insert(frames_.end(), paused->frames_.begin(), paused->frames_.end() - 1);
+    steps_ = paused->steps_;
+    paused->stack_.clear();
+    paused->frames_.clear();
+    ++runs_;
+    return RunWithFuel(frame, activation.Depth(), fuel, paused);
+}
+
+// Runs frame like Run, as the run that may pause, and moves what is left of
+// it to paused if it does.
+Object* VM::RunWithFuel(Frame frame, std::size_t depth, uint64_t fuel, Paused* paused) {
+    struct PauseScope {
+        VM* vm;
+        std::size_t run;
+        uint64_t at;
+        ~PauseScope() {
+            vm->pause_run_ = run;
+            vm->pause_at_ = at;
+            vm->pausing_ = false;
+            vm->UpdateStepCheck();
+        }
+    } scope{this, pause_run_, pause_at_};
+    fuel = std::max<uint64_t>(fuel, 1);
+    pause_run_ = runs_;
+    pause_at_ = fuel > UINT64_MAX - steps_ ? UINT64_MAX : steps_ + fuel;
+    UpdateStepCheck();
+    Object* result = Run(frame, depth);
+    if (pausing_) {
+        paused->frames_.assign(frames_.begin() + depth, frames_.end());
+        std::size_t base = paused->frames_.front().base;
+        paused->stack_.assign(stack_.begin() + base, stack_.end());
+        for (Frame& paused_frame : paused->frames_) {
+            paused_frame.base -= base;
+        }
+        paused->steps_ = steps_;
+    }
+    return result;
+}
+
+void VM::Cancel() {
+    cancelled_.store(true);
+    step_check_.store(0);
+}
+
+void VM::ClearCancel() {
+    cancelled_.store(false);
+    UpdateStepCheck();
+}
+
+bool VM::SlowStep(bool can_pause) {
+    if (cancelled_.exchange(false)) {
+        UpdateStepCheck();
+        throw CancelledError("evaluation cancelled");
+    }
+    if (step_check_.load() == 0) {
+        // The 0 of a Cancel whose flag was cleared before it was stored.
+        UpdateStepCheck();
+    }
+    if (steps_ > max_steps_) {
+        throw LimitError("step limit exceeded");
+    }
+    if (can_pause && runs_ == pause_run_ && steps_ > pause_at_) {
+        // The call is made, and counted, once the run resumes.
+        --steps_;
+        return true;
+    }
+    return false;
+}
+
+void VM::UpdateStepCheck() {
+    step_check_.store(std::min(max_steps_, pause_at_));
+    // Cancel sets the flag before it stores 0, so unless the flag is seen
+    // here the store above didn't overwrite its 0.
+    if (cancelled_.load()) {
+        step_check_.store(0);
+    }
+}
+
+Object* VM::Call(Object* procedure, Args args, Environment& env, bool rooted) {
+    Step();
+    if (!Is<Lambda>(procedure)) {
+        if (profiler_ == nullptr) {
+            return As<Procedure>(procedure)->Call(args);
+        }
+        Activation activation(this, env);
+        return CallNative(As<Procedure>(procedure), args);
+    }
+    CheckDepth();
+    if (runs_ >= kMaxRuns) {
+        throw LimitError("depth limit exceeded");
+    }
+    Activation activation(this, env);
+    ++runs_;
+    if (!rooted) {
+        ++native_calls_;
+    }
+    std::size_t callee = stack_.size();
+    if (args.begin() >= stack_.data() && args.begin() < stack_.data() + stack_.size()) {
+        std::vector<Object*> copy(args.begin(), args.end());
+        stack_.push_back(procedure);
+        stack_.insert(stack_.end(), copy.begin(), copy.end());
+    } else {
+        stack_.push_back(procedure);
+        stack_.insert(stack_.end(), args.begin(), args.end());
+    }
+    Frame frame = Enter(callee, args.size());
+    if (profiler_ != nullptr) {
+        profiler_->Enter(procedure);
+    }
+    return Run(frame, activation.Depth());
+}
+
+// Lays out the frame of the closure at stack_[callee], whose count arguments
+// follow it: checks the arity, collects rest arguments into a list and
+// reserves the slots of internal defines.
+VM::Frame VM::Enter(std::size_t callee, std::size_t count) {
+    const Lambda* closure = As<Lambda>(stack_[callee]);
+    const Prototype& prototype = *closure->GetPrototype();
+    std::size_t base = callee + 1;
+    if (count < prototype.arity || (count > prototype.arity && !prototype.has_rest)) {
+        throw RuntimeError("RuntimeError");
+    }
+    if (prototype.has_rest) {
+        Object* rest = nullptr;
+        for (std::size_t i = base + count; i > base + prototype.arity; --i) {
+            rest = Make<Cell>(stack_[i - 1], rest);
+        }
+        stack_.resize(base + prototype.arity);
+        stack_.push_back(rest);
+    }
+    stack_.resize(base + prototype.frame_size);
+    return Frame{&prototype.chunk, closure, 0, base};
+}
+
+namespace {
+
+bool FoldHolds(const Fold& fold, const Chunk& chunk, const Environment& env) {
+    if (fold.checked_environment == env.Id() && fold.checked_version == env.Version()) {
+        return true;
+    }
+    for (const Fold::Operator& op : fold.operators) {
+        auto value = env.Find(op.symbol);
+        if (value == nullptr || *value != chunk.constants[op.builtin]) {
+            return false;
+        }
+    }
+    fold.checked_environment = env.Id();
+    fold.checked_version = env.Version();
+    return true;
+}
+
+}  // namespace
+
+// Everything live is on the stack, in the frames (including the running one),
+// in the running chunks or in the environment.
+void VM::Collect(const Frame& frame) {
+    frames_.push_back(frame);
+    heap_->Collect();
+    frames_.pop_back();
+}
+
+void VM::MarkFrame(Marker& marker, const Frame& frame) {
+    if (frame.closure != nullptr) {
+        marker.Mark(*frame.closure->GetPrototype());
+    } else {
+        marker.Mark(*frame.chunk);
+    }
+}
+
+void VM::MarkRoots(Marker& marker) {
+    for (Object* value : stack_) {
+        marker.Mark(value);
+    }
+    for (const Frame& frame : frames_) {
+        MarkFrame(marker, frame);
+    }
+    for (const Chunk* chunk : chunks_) {
+        marker.Mark(*chunk);
+    }
+    if (env_ != nullptr) {
+        marker.Mark(*env_);
+    }
+}
+
+void VM::Paused::Mark(Marker& marker) const {
+    for (Object* value : stack_) {
+        marker.Mark(value);
+    }
+    for (const Frame& frame : frames_) {
+        MarkFrame(marker, frame);
+    }
+}
+
+Object* VM::Run(Frame frame, std::size_t depth) {
+    Environment& env = *env_;
+    while (true) {
+        const Instruction& instruction = frame.chunk->code[frame.pc++];
+        switch (instruction.op) {
+            case OpCode::kConstant:
+                stack_.push_back(frame.chunk->constants[instruction.arg]);
+                break;
+            case OpCode::kGlobal: {
+                const GlobalRead& global = frame.chunk->globals[instruction.arg];
+                if (global.layout != env.Layout()) {
+                    auto cell = env.Find(global.symbol);
+                    if (cell == nullptr) {
+                        throw NameError("NameError");
+                    }
+                    global.cell = cell;
+                    global.layout = env.Layout();
+                }
+                stack_.push_back(*global.cell);
+                break;
+            }
+            case OpCode::kDefine:
+                env.Define(instruction.arg, stack_.back());
+                stack_.back() = nullptr;
+                break;
+            case OpCode::kSet:
+                if (!env.Set(instruction.arg, stack_.back())) {
+                    throw NameError("NameError");
+                }
+                stack_.back() = nullptr;
+                break;
+            case OpCode::kLocal:
+                stack_.push_back(stack_[frame.base + instruction.arg]);
+                break;
+            case OpCode::kLocalBoxed:
+                stack_.push_back(As<Box>(stack_[frame.base + instruction.arg])->Get());
+                break;
+            case OpCode::kSetLocal:
+                stack_[frame.base + instruction.arg] = stack_.back();
+                stack_.back() = nullptr;
+                break;
+            case OpCode::kSetLocalBoxed:
+                As<Box>(stack_[frame.base + instruction.arg])->Set(stack_.back());
+                stack_.back() = nullptr;
+                break;
+            case OpCode::kCaptured:
+                stack_.push_back(frame.closure->GetCaptured()[instruction.arg]);
+                break;
+            case OpCode::kCapturedBoxed:
+                stack_.push_back(As<Box>(frame.closure->GetCaptured()[instruction.arg])->Get());
+                break;
+            case OpCode::kSetCapturedBoxed:
+                As<Box>(frame.closure->GetCaptured()[instruction.arg])->Set(stack_.back());
+                stack_.back() = nullptr;
+                break;
+            case OpCode::kBox: {
+                auto& slot = stack_[frame.base + instruction.arg];
+                slot = Make<Box>(slot);
+                break;
+            }
+            case OpCode::kClosure: {
+                const auto& prototype = frame.chunk->prototypes[instruction.arg];
+                std::vector<Object*> captured;
+                captured.reserve(prototype->captures.size());
+                for (const Capture& capture : prototype->captures) {
+                    captured.push_back(capture.from_captured ? frame.closure->GetCaptured()[capture.index]
+                                                             : stack_[frame.base + capture.index]);
+                }
+                stack_.push_back(Make<Lambda>(prototype, std::move(captured)));
+                break;
+            }
+            case OpCode::kPop:
+                stack_.pop_back();
+                break;
+            case OpCode::kJump:
+                frame.pc = instruction.arg;
+                break;
+            case OpCode::kJumpIfFalse: {
+                bool is_false = IsFalse(stack_.back());
+                stack_.pop_back();
+                if (is_false) {
+                    frame.pc = instruction.arg;
+                }
+                break;
+            }
+            case OpCode::kJumpIfFalseOrPop:
+                if (IsFalse(stack_.back())) {
+                    frame.pc = instruction.arg;
+                } else {
+                    stack_.pop_back();
+                }
+                break;
+            case OpCode::kJumpIfTrueOrPop:
+                if (!IsFalse(stack_.back())) {
+                    frame.pc = instruction.arg;
+                } else {
+                    stack_.pop_back();
+                }
+                break;
+            case OpCode::kCall: {
+                if (Step(true)) {
+                    return Pause(frame);
+                }
+                if (heap_ != nullptr && native_calls_ == 0 && heap_->ShouldCollect()) {
+                    Collect(frame);
+                }
+                std::size_t callee = stack_.size() - instruction.arg - 1;
+                if (Is<Lambda>(stack_[callee])) {
+                    CheckDepth();
+                    Frame callee_frame = Enter(callee, instruction.arg);
+                    if (profiler_ != nullptr) {
+                        profiler_->Enter(stack_[callee]);
+                    }
+                    frames_.push_back(frame);
+                    frame = callee_frame;
+                    break;
+                }
+                auto result =
+                    CallNative(As<Procedure>(stack_[callee]), Args(stack_.data() + callee + 1, instruction.arg));
+                stack_.resize(callee + 1);
+                stack_[callee] = result;
+                break;
+            }
+            case OpCode::kTailCall: {
+                if (Step(true)) {
+                    return Pause(frame);
+                }
+                if (heap_ != nullptr && native_calls_ == 0 && heap_->ShouldCollect()) {
+                    Collect(frame);
+                }
+                std::size_t callee = stack_.size() - instruction.arg - 1;
+                if (Is<Lambda>(stack_[callee])) {
+                    // Move the callee and its arguments over the running
+                    // frame, which ends here.
+                    std::size_t target = frame.base - 1;
+                    bool in_procedure = frame.closure != nullptr;
+                    std::copy(stack_.begin() + callee, stack_.end(), stack_.begin() + target);
+                    stack_.resize(target + instruction.arg + 1);
+                    frame = Enter(target, instruction.arg);
+                    if (profiler_ != nullptr) {
+                        if (in_procedure) {
+                            profiler_->Exit();
+                        }
+                        profiler_->Enter(stack_[target]);
+                    }
+                    break;
+                }
+                auto result =
+                    CallNative(As<Procedure>(stack_[callee]), Args(stack_.data() + callee + 1, instruction.arg));
+                stack_.resize(callee + 1);
+                stack_[callee] = result;
+                break;
+            }
+            case OpCode::kReturn: {
+                Object* result = stack_.back();
+                if (profiler_ != nullptr && frame.closure != nullptr) {
+                    profiler_->Exit();
+                }
+                if (frames_.size() == depth) {
+                    return result;
+                }
+                // The callee sits right below the frame; the result replaces it.
+                stack_.resize(frame.base);
+                stack_.back() = result;
+                frame = frames_.back();
+                frames_.pop_back();
+                break;
+            }
+            case OpCode::kFolded: {
+                const Fold& fold = frame.chunk->folds[instruction.arg];
+                if (FoldHolds(fold, *frame.chunk, env)) {
+                    stack_.push_back(frame.chunk->constants[fold.value]);
+                    frame.pc = fold.end;
+                }
+                break;
+            }
+        }
+    }
+}
+
+Object* Lambda::Call(Args args) {
+    VM* vm = VM::Active();
+    if (vm == nullptr || vm->env_ == nullptr) {
+        throw RuntimeError("RuntimeError");
+    }
+    return vm->Call(this, args, *vm->env_);
+}
+
+Object* CallWithRoots(Object* procedure, Args args) {
+    VM* vm = VM::Active();
+    if (vm == nullptr || vm->env_ == nullptr) {
+        return As<Procedure>(procedure)->Call(args);
+    }
+    return vm->Call(procedure, args, *vm->env_, true);
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bytecode.h"
+#include "object.h"
+#include "profiler.h"
+
+class VM : private RootSet {
+public:
+    class Paused;
+private:
+    // The running chunk; frames_ holds the suspended callers. Locals of a
+    // procedure live on stack_ from base, right after the callee itself.
+    struct Frame {
+        const Chunk* chunk;
+        const Lambda* closure;
+        std::size_t pc;
+        std::size_t base;
+    };
+
+    class Activation;
+    friend class Lambda;
+    friend Object* CallWithRoots(Object* procedure, Args args);
+
+    std::vector<Object*> stack_;
+    std::vector<Frame> frames_;
+    // Chunks passed to Execute that are still running. A frame suspended in
+    // a native call isn't in frames_, but its constants must stay alive.
+    std::vector<const Chunk*> chunks_;
+    Environment* env_ = nullptr;
+    Heap* heap_;
+    Profiler* profiler_ = nullptr;
+    // Calls made from native code, which may hold objects the collector
+    // can't see; no collections happen while there are any.
+    std::size_t native_calls_ = 0;
+    // Runs in progress, each with a running frame that isn't in frames_.
+    // Past the first, each is a procedure called from native code, which
+    // nests on the native stack.
+    std::size_t runs_ = 0;
+    std::size_t max_depth_ = SIZE_MAX;
+    uint64_t steps_ = 0;
+    uint64_t max_steps_ = UINT64_MAX;
+    // The run that may pause, the one of runs_ that was started with fuel,
+    // and the step count it pauses after.
+    std::size_t pause_run_ = 0;
+    uint64_t pause_at_ = UINT64_MAX;
+    // Steps past which Step takes the slow path: the step limit, the pause
+    // or 0 once cancelled, which Cancel sets from other threads.
+    std::atomic<uint64_t> step_check_{UINT64_MAX};
+    std::atomic<bool> cancelled_{false};
+    // Set by Run when it returns to pause, its running frame pushed onto
+    // frames_.
+    bool pausing_ = false;
+
+    static constexpr std::size_t kMaxRuns = 1000;
+
+    static VM*& ActiveSlot();
+    Frame Enter(std::size_t callee, std::size_t count);
+    // Counts a call. True if the run should pause before making it instead,
+    // which only the call instructions of the run that may pause can.
+    bool Step(bool can_pause = false) {
+        if (++steps_ > step_check_.load(std::memory_order_relaxed)) {
+            return SlowStep(can_pause);
+        }
+        return false;
+    }
+    bool SlowStep(bool can_pause);
+    void UpdateStepCheck();
+    // Throws unless another frame fits within the depth limit.
+    void CheckDepth() const {
+        if (frames_.size() + runs_ >= max_depth_) {
+            throw LimitError("depth limit exceeded");
+        }
+    }
+    Object* CallNative(Procedure* procedure, Args args) {
+        if (profiler_ == nullptr) {
+            return procedure->Call(args);
+        }
+        profiler_->Enter(procedure);
+        Object* result = procedure->Call(args);
+        profiler_->Exit();
+        return result;
+    }
+    Object* Run(Frame frame, std::size_t depth);
+    // Leaves Run before the call at frame.pc, for RunWithFuel to take.
+    Object* Pause(Frame frame) {
+        --frame.pc;
+        frames_.push_back(frame);
+        pausing_ = true;
+        return nullptr;
+    }
+    Object* RunWithFuel(Frame frame, std::size_t depth, uint64_t fuel, Paused* paused);
+    void Collect(const Frame& frame);
+    static void MarkFrame(Marker& marker, const Frame& frame);
+    void MarkRoots(Marker& marker) override;
+public:
+    // With a heap, the VM collects it at calls, marking its stack, frames and
+    // environment as roots.
+    explicit VM(Heap* heap = nullptr);
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+    ~VM();
+
+    // What a run paused by Execute with fuel still has to do: the frames it
+    // has entered and their part of the stack, taken off the VM.
+    class Paused {
+    private:
+        friend class VM;
+        std::vector<Object*> stack_;
+        std::vector<Frame> frames_;
+        uint64_t steps_ = 0;
+    public:
+        bool Empty() const {
+            return frames_.empty();
+        }
+        // Whoever holds it must mark it as a root of the VM's heap.
+        void Mark(Marker& marker) const;
+    };
+
+    // May collect the VM's heap: the caller must not hold objects that are
+    // only reachable from native code.
+    Object* Execute(const Chunk& chunk, Environment& env);
+
+    // Like Execute, but once fuel calls are made (at least one is) the run
+    // pauses before its next call into paused and the value returned means
+    // nothing. Calls of procedures called from native code don't pause, so
+    // those run to the end first. The chunk must outlive paused.
+    Object* Execute(const Chunk& chunk, Environment& env, uint64_t fuel, Paused* paused);
+    // Continues a run paused by Execute for another fuel calls, in the same
+    // way, with the step count it had. Its frames leave paused, so once an
+    // error unwinds them it is empty.
+    Object* Resume(Paused* paused, Environment& env, uint64_t fuel);
+
+    // May be called from any thread: the run in progress throws
+    // CancelledError at its next procedure call. A Cancel no call has seen
+    // yet stays pending until ClearCancel, which a caller starting work that
+    // earlier Cancels weren't meant for calls first.
+    void Cancel();
+    void ClearCancel();
+
+    // Calls a procedure with evaluated arguments. May grow the stack, so
+    // callers holding Args into it must not use them afterwards. Nothing is
+    // collected during the call unless the caller passes rooted: then
+    // everything it still uses must be reachable from a root set.
+    Object* Call(Object* procedure, Args args, Environment& env, bool rooted = false);
+
+    // A call that would make more than max_depth procedure frames active, or
+    // more than max_steps calls since ResetSteps, throws LimitError instead.
+    // Every loop is a call, so steps bound the running time. Procedures called
+    // from native code nest at most kMaxRuns deep in any case.
+    void SetLimits(std::size_t max_depth, uint64_t max_steps) {
+        max_depth_ = max_depth;
+        max_steps_ = max_steps;
+        UpdateStepCheck();
+    }
+    // Procedure calls made since ResetSteps.
+    uint64_t Steps() const {
+        return steps_;
+    }
+    void ResetSteps() {
+        steps_ = 0;
+    }
+
+    // Reports every procedure call to profiler, or stops with nullptr.
+    void SetProfiler(Profiler* profiler) {
+        profiler_ = profiler;
+    }
+    Profiler* GetProfiler() const {
+        return profiler_;
+    }
+
+    // The VM executing on this thread, if any.
+    static VM* Active() {
+        return ActiveSlot();
+    }
+};